@@ -26,57 +26,213 @@
 #include "libp265/pps.h"
 #include "libp265/vps.h"
 
+#include <atomic>
 #include <memory>
+#include <vector>
+#include <stdint.h>
 
 BEGIN_NAMESPACE_LIBP265
 
-#define MAX_WARNINGS 20
+#define MAX_WARNINGS 32   // size of the warning queue, has to be a power of two
+
+#define P265_ERROR_CODE_SLOTS 384  // number of distinct error codes that are tracked
 
 #define P265_MAX_VPS_SETS 16   // this is the maximum as defined in the standard
 #define P265_MAX_SPS_SETS 16   // this is the maximum as defined in the standard
 #define P265_MAX_PPS_SETS 64   // this is the maximum as defined in the standard
 
+#define MAX_DIAGNOSTICS 64 // number of diagnostic events that are kept, power of two
+
+class NAL_unit;
+class snapshot_writer;
+class snapshot_reader;
+
+
+/* A warning or error with the place in the stream where it occurred. */
+struct diagnostic_event
+{
+  P265_error  code;
+  int64_t     stream_offset;     // byte offset of the NAL in the input stream, -1 if unknown
+  int64_t     nal_index;         // index of the NAL in the stream, -1 if unknown
+  int16_t     nal_unit_type;     // -1 if unknown
+  int16_t     parameter_set_id;  // id of the VPS/SPS/PPS being parsed, -1 if unknown
+  const char* syntax_element;    // name of the offending syntax element (static string) or NULL
+};
+
+
+/* Queue of warnings for the application.
+
+   The queue is a fixed-size lock-free ring. Warnings may be added from several
+   threads concurrently. When the queue is full, new warnings are dropped and
+   P265_WARNING_WARNING_BUFFER_FULL is returned once the queue has been emptied.
+   Independent of the queue, each code is counted, so that no information is lost.
+
+   Additionally, each warning is stored as a diagnostic_event with its position in
+   the stream in a second fixed-size ring that keeps the most recent events. The
+   position is set with set_location() by the thread parsing the headers.
+ */
 class error_queue
 {
  public:
     LIBP265_API error_queue();
 
+    /* If 'once' is set, the warning is only queued the first time this code is
+       added with 'once' set. It is counted every time. */
     LIBP265_API void add_warning(P265_error warning, bool once);
+
+    /* Like add_warning(), with the offending syntax element and parameter set id
+       for the diagnostic event. */
+    LIBP265_API void add_diagnostic(P265_error code, const char* syntax_element,
+                                    int parameter_set_id = -1, bool once = false);
+
+    // Returns P265_OK when there are no more warnings.
     LIBP265_API P265_error get_warning();
 
+
+    // --- location of subsequent warnings ---
+
+    LIBP265_API void set_location(int64_t stream_offset, int64_t nal_index, int nal_unit_type);
+    LIBP265_API void set_location(const NAL_unit* nal);
+    void clear_location() { set_location(-1,-1,-1); }
+
+
+    // --- diagnostic events ---
+
+    /* Copy the events that were added after '*cursor' (start with 0) to 'out' and
+       advance the cursor. Events that have already been overwritten are skipped.
+       Returns the number of events copied. Thread-safe. */
+    LIBP265_API int get_diagnostics(diagnostic_event* out, int maxEvents, uint64_t* cursor) const;
+
+    // Total number of events since construction.
+    uint64_t get_num_diagnostics() const { return diag_write_pos.load(std::memory_order_relaxed); }
+
+    // Number of events that occurred in NALs of this type.
+    uint32_t get_nal_type_warning_count(int nal_unit_type) const {
+      return nal_type_counts[nal_unit_type & 63].load(std::memory_order_relaxed);
+    }
+
+    // How often a code was added since construction.
+    LIBP265_API uint32_t get_warning_count(P265_error code) const;
+
+    // Number of warnings that were dropped because the queue was full.
+    uint64_t get_num_dropped_warnings() const { return dropped.load(std::memory_order_relaxed); }
+
  private:
-    P265_error warnings[MAX_WARNINGS];
-    int nWarnings;
-    P265_error warnings_shown[MAX_WARNINGS]; // warnings that have already occurred
-    int nWarningsShown;
+    struct cell {
+      std::atomic<uint32_t> sequence;
+      P265_error code;
+    };
+
+    cell warnings[MAX_WARNINGS];
+    std::atomic<uint32_t> enqueue_pos;
+    std::atomic<uint32_t> dequeue_pos;
+
+    std::atomic<bool>     overflow;
+    std::atomic<uint64_t> dropped;
+
+    std::atomic<uint64_t> shown[P265_ERROR_CODE_SLOTS/64]; // 'once' warnings that already occurred
+    std::atomic<uint32_t> counts[P265_ERROR_CODE_SLOTS];
+    std::atomic<uint32_t> nal_type_counts[64];
+
+    std::atomic<int64_t> loc_stream_offset;
+    std::atomic<int64_t> loc_nal_index;
+    std::atomic<int>     loc_nal_unit_type;
+
+    // diagnostic events, each slot is protected by a sequence number (seqlock)
+    struct diag_slot {
+      std::atomic<uint64_t> sequence;  // 2n+1 while event n is written, 2n+2 when complete
+      std::atomic<uint64_t> words[4];
+    };
+
+    diag_slot diagnostics[MAX_DIAGNOSTICS];
+    std::atomic<uint64_t> diag_write_pos;
+
+    void queue_warning(P265_error warning);
+
+    error_queue(const error_queue&) = delete;
+    error_queue& operator=(const error_queue&) = delete;
+};
+
+/* Immutable view of all parameter sets that were stored at one point in time.
+   Every update of a parameter set publishes a new snapshot with an increased
+   epoch. Threads holding a snapshot keep a consistent view of the parameter sets,
+   even while another thread is publishing updates. */
+class parameter_set_snapshot
+{
+public:
+  parameter_set_snapshot() : epoch(0) { }
+
+  uint64_t epoch;
+
+  std::shared_ptr<video_parameter_set>  vps[ P265_MAX_VPS_SETS ];
+  std::shared_ptr<seq_parameter_set>    sps[ P265_MAX_SPS_SETS ];
+  std::shared_ptr<pic_parameter_set>    pps[ P265_MAX_PPS_SETS ];
+
+  // NAL data the parameter sets were read from (only with read_parameter_set_NAL())
+  std::shared_ptr<const std::vector<unsigned char> > vps_NAL[ P265_MAX_VPS_SETS ];
+  std::shared_ptr<const std::vector<unsigned char> > sps_NAL[ P265_MAX_SPS_SETS ];
+  std::shared_ptr<const std::vector<unsigned char> > pps_NAL[ P265_MAX_PPS_SETS ];
 };
 
+
 class parse_context : public error_queue
 {
 public:
 
-    parse_context() = default;
+    LIBP265_API parse_context();
     virtual ~parse_context() = default;
 
-    virtual bool has_sps(int id) { return (bool)sps[id]; }
-    virtual bool has_pps(int id) { return (bool)pps[id]; }
+    // --- lock-free access for concurrent readers ---
+
+    /* Get the currently active set of parameter sets. This never blocks and the
+       returned snapshot stays valid (and unchanged) as long as it is held. */
+    std::shared_ptr<const parameter_set_snapshot> get_snapshot() const { return std::atomic_load(&current); }
+    uint64_t get_epoch() const { return get_snapshot()->epoch; }
+
+
+    // --- single parameter sets ---
+
+    virtual bool has_vps(int id) { return (bool)get_snapshot()->vps[id]; }
+    virtual bool has_sps(int id) { return (bool)get_snapshot()->sps[id]; }
+    virtual bool has_pps(int id) { return (bool)get_snapshot()->pps[id]; }
 
-    virtual std::shared_ptr<seq_parameter_set> get_shared_sps(int id) { return sps[id]; }
-    virtual std::shared_ptr<pic_parameter_set> get_shared_pps(int id) { return pps[id]; }
+    virtual std::shared_ptr<video_parameter_set> get_shared_vps(int id) { return get_snapshot()->vps[id]; }
+    virtual std::shared_ptr<seq_parameter_set> get_shared_sps(int id) { return get_snapshot()->sps[id]; }
+    virtual std::shared_ptr<pic_parameter_set> get_shared_pps(int id) { return get_snapshot()->pps[id]; }
 
-    /* */ seq_parameter_set* get_sps(int id)       { return sps[id].get(); }
-    const seq_parameter_set* get_sps(int id) const { return sps[id].get(); }
-    /* */ pic_parameter_set* get_pps(int id)       { return pps[id].get(); }
-    const pic_parameter_set* get_pps(int id) const { return pps[id].get(); }
+    /* The raw pointers are only guaranteed to stay valid until the parameter set is
+       replaced. Threads running concurrently to the updating thread should hold a
+       snapshot (or a shared pointer) instead. */
+    /* */ seq_parameter_set* get_sps(int id)       { return get_snapshot()->sps[id].get(); }
+    const seq_parameter_set* get_sps(int id) const { return get_snapshot()->sps[id].get(); }
+    /* */ pic_parameter_set* get_pps(int id)       { return get_snapshot()->pps[id].get(); }
+    const pic_parameter_set* get_pps(int id) const { return get_snapshot()->pps[id].get(); }
 
-    virtual void set_sps(int id, std::shared_ptr<seq_parameter_set> sps) { this->sps[id] = sps; }
-    virtual void set_pps(int id, std::shared_ptr<pic_parameter_set> pps) { this->pps[id] = pps; }
+    /* Each update publishes a new snapshot (copy-on-write). Concurrent updates
+       are allowed, no update gets lost. */
+    LIBP265_API virtual void set_vps(int id, std::shared_ptr<video_parameter_set> vps);
+    LIBP265_API virtual void set_sps(int id, std::shared_ptr<seq_parameter_set> sps);
+    LIBP265_API virtual void set_pps(int id, std::shared_ptr<pic_parameter_set> pps);
+
+
+    /* Parse a VPS, SPS or PPS NAL and store the parameter set together with its NAL (for
+       save_state()), in one update. Other NAL types are ignored (returns P265_OK). The
+       location for diagnostics is set to this NAL. */
+    LIBP265_API P265_error read_parameter_set_NAL(const NAL_unit* nal);
+
+
+    // --- state snapshots (see snapshot.h) ---
+
+    /* Returns P265_ERROR_SNAPSHOT_INCOMPLETE if a parameter set was installed with
+       set_vps/sps/pps() instead of read_parameter_set_NAL(), its NAL is not known. */
+    LIBP265_API P265_error save_state(snapshot_writer&) const;
+    LIBP265_API P265_error restore_state(snapshot_reader&);
 
 private:
 
-    std::shared_ptr<video_parameter_set>  vps[ P265_MAX_VPS_SETS ];
-    std::shared_ptr<seq_parameter_set>    sps[ P265_MAX_SPS_SETS ];
-    std::shared_ptr<pic_parameter_set>    pps[ P265_MAX_PPS_SETS ];
+    std::shared_ptr<const parameter_set_snapshot> current; // only accessed atomically
+
+    template <class Modifier> void publish(Modifier modify);
 };
 
 END_NAMESPACE_LIBP265
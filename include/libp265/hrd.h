@@ -0,0 +1,174 @@
+/*
+ * H.265 video codec parser.
+ * Copyright (c) 2023 John Willard <john.willard@shotover.com>
+ *
+ * This file is part of libp265.
+ *
+ * libp265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libp265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libp265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBP265_HRD_H
+#define LIBP265_HRD_H
+
+#include "libp265/libp265.h"
+#include "libp265/sei.h"
+#include "libp265/nal-parser.h"
+#include "libp265/context.h"
+
+#include <deque>
+#include <vector>
+
+BEGIN_NAMESPACE_LIBP265
+
+/* Hypothetical reference decoder (Annex C) for checking the buffer behaviour of a
+   bitstream. The CPB is simulated as a leaky bucket on access unit level (C.3),
+   driven by the access unit sizes and the buffering period / picture timing SEIs.
+   Decoding units (sub-picture HRD) are not simulated.
+
+   For the DPB, only the pictures waiting for output (C.3.3, output timing) are
+   counted, as reference picture marking is not known at this level.
+ */
+
+
+// One access unit as seen by the HRD.
+struct hrd_access_unit
+{
+  int64_t size_bits;   // b(n), NAL or VCL size depending on the HRD type
+  bool    irap;
+  bool    discardable; // TemporalId > 0, or a RASL, RADL or sub-layer non-reference picture
+
+  bool    has_buffering_period;
+  sei_buffering_period buffering_period;
+
+  bool    has_pic_timing;
+  sei_pic_timing pic_timing;
+};
+
+
+struct hrd_au_result
+{
+  int64_t au_index;     // in decoding order
+  P265_error status;    // P265_OK, or the reason why this AU could not be simulated
+
+  int64_t size_bits;
+  double  initial_arrival_time;  // t_ai(n) in seconds
+  double  final_arrival_time;    // t_af(n)
+  double  nominal_removal_time;  // t_r,n(n)
+  double  removal_time;          // t_r(n)
+  double  dpb_output_time;       // t_o,dpb(n)
+
+  int64_t max_cpb_fullness;      // maximum CPB fullness (bits) while this AU arrived
+  int     dpb_fullness;          // pictures waiting for output after decoding this AU
+
+  bool    cpb_underflow;  // the AU was not completely received at its removal time
+  bool    cpb_overflow;   // the CPB exceeded CpbSize while the AU arrived
+  bool    dpb_overflow;   // more pictures waiting for output than sps_max_dec_pic_buffering
+};
+
+
+class hrd_simulator
+{
+ public:
+  /* nalOrVcl: 0 = NAL HRD (type II, all NALs including start codes),
+               1 = VCL HRD (type I, VCL and filler data NALs only) */
+  LIBP265_API explicit hrd_simulator(int nalOrVcl = 0, int schedSelIdx = 0);
+
+  LIBP265_API void reset();
+
+
+  // --- access unit level ---
+
+  /* Simulate the next access unit. 'sps' is the SPS active for this AU. The HRD
+     parameters are taken from the SPS of the last buffering period. */
+  LIBP265_API P265_error add_access_unit(const hrd_access_unit& au, const seq_parameter_set* sps,
+                                         hrd_au_result* result);
+
+
+  // --- NAL level ---
+
+  /* Feed all NALs from a NAL_Parser in decoding order. The access unit boundaries
+     are detected here and the SEIs are decoded with the parameter sets in 'ctx'.
+     Parameter set NALs should be stored in 'ctx' after passing them to push_NAL(),
+     as they may complete the previous access unit.
+     Returns true when this NAL completed the previous access unit, whose result is
+     then written to 'result'. */
+  LIBP265_API bool push_NAL(const NAL_unit* nal, parse_context* ctx, hrd_au_result* result);
+
+  // At the end of the stream: finish the last access unit. Returns false if there is none.
+  LIBP265_API bool flush(parse_context* ctx, hrd_au_result* result);
+
+
+  // --- statistics ---
+
+  int64_t get_num_access_units() const { return au_count; }
+  int64_t get_num_underflows() const { return num_underflows; }
+  int64_t get_num_overflows() const { return num_overflows; }
+  int64_t get_num_dpb_overflows() const { return num_dpb_overflows; }
+
+ private:
+  int nalOrVcl;
+  int schedSelIdx;
+
+  // HRD parameters of the current buffering period
+  bool    initialized;
+  double  tc;          // clock tick
+  double  bit_rate;
+  int64_t cpb_size;
+  bool    cbr;
+  bool    low_delay;
+  int     dpb_size;    // sps_max_dec_pic_buffering of the highest sub-layer
+
+  int64_t au_count;
+  int64_t num_underflows;
+  int64_t num_overflows;
+  int64_t num_dpb_overflows;
+
+  // timing state
+  double  prev_final_arrival;           // t_af(n-1)
+  double  prev_nominal_removal;         // t_r,n(n-1)
+  double  prev_non_discardable_removal; // t_r,n(prevNonDiscardablePic)
+  double  bp_nominal_removal;           // t_r,n of the first AU of the buffering period
+  int64_t  prev_au_cpb_removal_delay_minus1;
+  int64_t  au_cpb_removal_delay_msb;   // for wrap-around of au_cpb_removal_delay_minus1
+  uint32_t init_cpb_removal_delay;
+  uint32_t init_cpb_removal_offset;
+
+  struct cpb_entry { double removal_time; int64_t bits; };
+  std::deque<cpb_entry> cpb;   // AUs that are in the CPB (received, not yet removed)
+  int64_t cpb_bits;
+
+  std::deque<double> dpb_output_times;  // pictures waiting for output
+
+
+  // --- NAL level state ---
+
+  bool    au_has_vcl;
+  bool    au_irap;
+  bool    au_discardable;
+  int64_t au_bits;
+  std::shared_ptr<seq_parameter_set> active_sps;
+  std::vector<uint8_t> bp_payload;
+  std::vector<uint8_t> pt_payload;
+  bool    au_has_bp;
+  bool    au_has_pt;
+
+  void start_access_unit();
+  bool finish_access_unit(parse_context* ctx, hrd_au_result* result);
+
+  bool configure(const seq_parameter_set* sps);
+};
+
+END_NAMESPACE_LIBP265
+
+#endif
@@ -68,6 +68,9 @@ enum P265_error {
   P265_ERROR_NO_INITIAL_SLICE_HEADER=16,
   P265_ERROR_PREMATURE_END_OF_SLICE=17,
   P265_ERROR_UNSPECIFIED_DECODING_ERROR=18,
+  P265_ERROR_INPUT_BUFFER_FULL=19,
+  P265_ERROR_SNAPSHOT_INCOMPLETE=20,
+  P265_ERROR_NO_SUCH_STREAM=21,
 
   // --- errors that should become obsolete in later libde265 versions ---
 
@@ -110,7 +113,9 @@ enum P265_error {
   P265_WARNING_REFERENCE_IMAGE_SIZE_DOES_NOT_MATCH_SPS=1029,
   P265_WARNING_CHROMA_OF_CURRENT_IMAGE_DOES_NOT_MATCH_SPS=1030,
   P265_WARNING_BIT_DEPTH_OF_CURRENT_IMAGE_DOES_NOT_MATCH_SPS=1031,
-  P265_WARNING_REFERENCE_IMAGE_CHROMA_FORMAT_DOES_NOT_MATCH=1032
+  P265_WARNING_REFERENCE_IMAGE_CHROMA_FORMAT_DOES_NOT_MATCH=1032,
+  P265_WARNING_SPS_EXCEEDS_LEVEL_LIMITS=1033,
+  P265_WARNING_PPS_EXCEEDS_LEVEL_LIMITS=1034
 };
 
 END_NAMESPACE_LIBP265
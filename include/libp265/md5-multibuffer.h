@@ -0,0 +1,73 @@
+/*
+ * H.265 video codec parser.
+ * Copyright (c) 2023 John Willard <john.willard@shotover.com>
+ *
+ * This file is part of libp265.
+ *
+ * libp265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libp265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libp265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBP265_MD5_MULTIBUFFER_H
+#define LIBP265_MD5_MULTIBUFFER_H
+
+#include "libp265/libp265.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+BEGIN_NAMESPACE_LIBP265
+
+/* Multi-buffer MD5: computes the MD5 sums of several independent messages at once.
+   Each SIMD lane processes a different message. When a message is finished, the
+   next pending message is started in its lane, so that all lanes are kept busy
+   as long as there are enough messages.
+
+   A message is given as a sequence of rows (e.g. an image plane), which are hashed
+   as if they were concatenated.
+ */
+
+struct md5_job
+{
+  const uint8_t* data;
+  ptrdiff_t stride;      // distance between rows in bytes
+  int       row_bytes;
+  int       rows;
+
+  /* The rows are 16-bit samples in host byte order. They are hashed in little-endian
+     byte order, as required for the decoded picture hash SEI. */
+  bool      samples16;
+
+  uint8_t   digest[16];  // output
+};
+
+
+enum md5_simd_level {
+  md5_simd_auto   = -1, // best implementation supported by the CPU
+  md5_simd_none   = 0,  // scalar, one message after the other
+  md5_simd_sse2   = 1,  // 4 lanes
+  md5_simd_avx2   = 2,  // 8 lanes
+  md5_simd_avx512 = 3   // 16 lanes
+};
+
+// Best implementation available on this CPU.
+LIBP265_API enum md5_simd_level md5_get_simd_level();
+
+/* Compute the digests of all jobs. Levels that are not supported by the CPU are reduced
+   to the best supported one. */
+LIBP265_API void md5_multibuffer(md5_job* jobs, int nJobs,
+                                 enum md5_simd_level level = md5_simd_auto);
+
+END_NAMESPACE_LIBP265
+
+#endif
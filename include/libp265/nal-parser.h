@@ -37,6 +37,13 @@ BEGIN_NAMESPACE_LIBP265
 
 typedef int64_t P265_PTS;
 
+class sei_metadata_extractor;
+class NAL_source;
+class snapshot_writer;
+class snapshot_reader;
+class NAL_range;
+class access_unit_range;
+
 class NAL_unit {
  public:
   LIBP265_API NAL_unit();
@@ -47,6 +54,16 @@ class NAL_unit {
   P265_PTS pts;
   std::shared_ptr<void> user_data;
 
+  int64_t stream_offset; // position of the NAL header in the input (after the start code)
+  int64_t nal_index;     // number of NALs in the stream before this one
+
+  /* Large VCL NALs may be delivered in fragments (NAL_Parser::set_limits()). 0 for a
+     complete NAL, otherwise the 1-based number of the fragment. Only the first fragment
+     contains the NAL header, all fragments have the same nal_index. Do not parse data()[0]
+     of continuation fragments (fragment > 1), 'header' holds the header of the NAL. */
+  int  fragment;
+  bool last_fragment;
+
 
   LIBP265_API void clear();
 
@@ -67,6 +84,9 @@ class NAL_unit {
   LIBP265_API int num_skipped_bytes_before(int byte_position, int headerLength) const;
   int  num_skipped_bytes() const { return static_cast<int>(skipped_bytes.size()); }
 
+  // Positions of the removed bytes in the original (escaped) NAL, ascending.
+  const std::vector<int>& get_skipped_bytes() const { return skipped_bytes; }
+
   //void clear_skipped_bytes() { skipped_bytes.clear(); }
 
   /* Mark a byte as skipped. It is assumed that the byte is already removed
@@ -81,6 +101,12 @@ class NAL_unit {
 
   LIBP265_API void insert_emulation_prevention_bytes();
 
+
+  // --- state snapshots (see snapshot.h), user_data is not included ---
+
+  LIBP265_API void save_state(snapshot_writer&) const;
+  LIBP265_API LIBP265_CHECK_RESULT bool restore_state(snapshot_reader&);
+
  private:
   unsigned char* nal_data;
   size_t data_size;
@@ -90,18 +116,82 @@ class NAL_unit {
 };
 
 
+/* View of a completed NAL that is passed to a NAL_handler. The data belongs to the
+   NAL_Parser (or to the caller of push_NAL()) and is only valid during the call. */
+struct NAL_view
+{
+  const unsigned char* data; // NAL including the 2-byte NAL header
+  int  size;
+
+  int  nal_unit_type;
+  int  nuh_layer_id;
+  int  temporal_id;
+
+  bool escaped;          // emulation prevention bytes have not been removed
+  bool payload_skipped;  // only the NAL header is available (P265_NAL_HANDLER_DISCARD)
+
+  int  fragment;         // see NAL_unit::fragment
+  bool last_fragment;
+
+  P265_PTS pts;
+  void*    user_data;    // NAL_unit::user_data.get()
+  int64_t  stream_offset;
+  int64_t  nal_index;
+};
+
+
+/* Handler that is called by the NAL_Parser as soon as a NAL is complete, from within
+   push_data(), push_NAL() or flush_data(). */
+class NAL_handler
+{
+public:
+  virtual ~NAL_handler() { }
+
+  // Return true if the NAL was consumed. Otherwise, it is put into the NAL queue as usual.
+  virtual bool on_NAL(const NAL_view& nal) = 0;
+};
+
+// handler flags
+
+// Do not remove the emulation prevention bytes (the NAL is still queued unescaped if not consumed).
+#define P265_NAL_HANDLER_NO_DEESCAPE 1
+
+/* Do not store the NAL payload at all. The handler (if any) only sees the NAL header and
+   the NAL is never queued. */
+#define P265_NAL_HANDLER_DISCARD     2
+
+
+enum NAL_category {
+  NAL_category_VCL,  // types 0-31
+  NAL_category_VPS,
+  NAL_category_SPS,
+  NAL_category_PPS,
+  NAL_category_AUD,
+  NAL_category_EOS,  // end of sequence and end of bitstream
+  NAL_category_SEI,  // prefix and suffix SEI
+  NAL_category_other
+};
+
+
 class NAL_Parser
 {
  public:
   LIBP265_API NAL_Parser();
   LIBP265_API ~NAL_Parser();
 
+  /* Returns P265_ERROR_INPUT_BUFFER_FULL without consuming the data when the NAL queue
+     is over its limits (see set_limits()). Pop NALs and push the data again. */
   LIBP265_API P265_error push_data(const unsigned char* data, int len,
                         P265_PTS pts, std::shared_ptr<void> user_data = NULL);
 
   LIBP265_API P265_error push_NAL(const unsigned char* data, int len,
                        P265_PTS pts, std::shared_ptr<void> user_data = NULL);
 
+  /* Push a NAL (with emulation prevention bytes) that the caller assembled in a NAL_unit
+     from alloc_NAL_unit(). The parser takes ownership. The queue limits are not checked,
+     use is_input_blocked() before. */
+  LIBP265_API void       push_NAL(NAL_unit* nal);
+
   LIBP265_API NAL_unit*   pop_from_NAL_queue();
   LIBP265_API P265_error flush_data();
   void        mark_end_of_stream() { end_of_stream=true; }
@@ -124,9 +214,55 @@ class NAL_Parser
     return static_cast<int>(NAL_queue.size());
   }
 
+  LIBP265_API LIBP265_CHECK_RESULT NAL_unit* alloc_NAL_unit(int size);
   LIBP265_API void free_NAL_unit(NAL_unit*);
 
 
+  /* Memory limits (0: unlimited).
+
+     max_queue_bytes, max_queue_NALs: push_data() and push_NAL() refuse input while the
+       NAL queue holds at least this much. The limits are checked before a chunk is parsed,
+       so the queue can exceed them by the NALs of one chunk.
+     max_NAL_size: larger NALs are dropped (the handler still sees the NAL header) and
+       counted in get_num_oversized_NALs().
+     VCL_fragment_size: VCL NALs are emitted in fragments of about this size instead of
+       being collected completely (see NAL_unit::fragment). Fragmented NALs are not
+       subject to max_NAL_size.
+
+   With max_NAL_size or VCL_fragment_size set, the pending NAL never holds much more than
+   these sizes, independent of the size of the input chunks. */
+  LIBP265_API void set_limits(int max_queue_bytes, int max_queue_NALs,
+                              int max_NAL_size, int VCL_fragment_size = 0);
+
+  bool is_input_blocked() const {
+    return ((max_queue_bytes > 0 && nBytes_in_NAL_queue >= max_queue_bytes) ||
+            (max_queue_NALs  > 0 && static_cast<int>(NAL_queue.size()) >= max_queue_NALs));
+  }
+
+  int get_max_NAL_size() const { return max_NAL_size; }
+  int64_t get_num_oversized_NALs() const { return num_oversized_NALs; }
+
+
+  /* Iterate over the NALs / access units from a source (see nal-source.h).
+     Byte-stream input only, do not mix with other input to this parser. */
+  LIBP265_API NAL_range nals(NAL_source* source);
+  LIBP265_API access_unit_range access_units(NAL_source* source);
+
+
+  /* SEI NALs are passed to the extractor when they are complete. The extractor has to
+     outlive the NAL_Parser (or be removed with NULL). */
+  void set_sei_metadata_extractor(sei_metadata_extractor* e) { sei_extractor = e; }
+
+  /* Install a handler for a NAL type (or NULL to remove it). The handler is not owned.
+     'flags' apply to the NAL type even without a handler. */
+  LIBP265_API void set_NAL_handler(int nal_unit_type, NAL_handler* handler, int flags = 0);
+  LIBP265_API void set_NAL_handler(enum NAL_category category, NAL_handler* handler, int flags = 0);
+
+  /* Byte-stream state, pending NAL and NAL queue (see snapshot.h). Restoring replaces
+     all pending input data, the limits and handlers are kept. */
+  LIBP265_API void       save_state(snapshot_writer&) const;
+  LIBP265_API P265_error restore_state(snapshot_reader&);
+
   int get_NAL_queue_length() const { return static_cast<int>(NAL_queue.size()); }
   bool is_end_of_stream() const { return end_of_stream; }
   bool is_end_of_frame() const { return end_of_frame; }
@@ -137,6 +273,19 @@ class NAL_Parser
   bool end_of_stream; // data in pending_input_data is end of stream
   bool end_of_frame;  // data in pending_input_data is end of frame
   int  input_push_state;
+  int64_t input_offset;  // number of input bytes pushed so far
+  int64_t nal_counter;
+  int  pending_NAL_flags; // handler flags of the NAL in pending_input_NAL
+
+  int  max_queue_bytes;
+  int  max_queue_NALs;
+  int  max_NAL_size;
+  int  VCL_fragment_size;
+  int64_t num_oversized_NALs;
+
+  P265_error push_data_slice(const unsigned char* data, int len,
+                             P265_PTS pts, const std::shared_ptr<void>& user_data);
+  P265_error check_pending_NAL_size();
 
   NAL_unit* pending_input_NAL;
 
@@ -146,14 +295,25 @@ class NAL_Parser
   std::queue<NAL_unit*> NAL_queue;  // enqueued NALs have suffing bytes removed
   int nBytes_in_NAL_queue; // data bytes currently in NAL_queue
 
-  void push_to_NAL_queue(NAL_unit*);
+  sei_metadata_extractor* sei_extractor;
+
+  NAL_handler* handlers[64];
+  int handler_flags[64];
+
+  void push_to_NAL_queue(NAL_unit*, bool unescaped = true);
+
+  // Returns true if the NAL was queued, false if it was consumed and can be reused.
+  bool complete_NAL(NAL_unit*, int flags);
+
+  // NAL input: oversized NALs and handlers that do not need a copy.
+  // Returns true if the NAL was consumed.
+  bool deliver_unqueued_NAL(const unsigned char* data, int len, P265_PTS pts, void* user_data);
+  void queue_escaped_NAL(NAL_unit*);
 
 
   // pool of unused NAL memory
 
   std::vector<NAL_unit*> NAL_free_list;  // maximum size: P265_NAL_FREE_LIST_SIZE
-
-  LIBP265_CHECK_RESULT NAL_unit* alloc_NAL_unit(int size);
 };
 
 END_NAMESPACE_LIBP265
@@ -0,0 +1,220 @@
+/*
+ * H.265 video codec parser.
+ * Copyright (c) 2023 John Willard <john.willard@shotover.com>
+ *
+ * This file is part of libp265.
+ *
+ * libp265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libp265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libp265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBP265_NAL_SOURCE_H
+#define LIBP265_NAL_SOURCE_H
+
+#include "libp265/libp265.h"
+#include "libp265/nal-parser.h"
+
+#include <vector>
+
+BEGIN_NAMESPACE_LIBP265
+
+/* Input sources and iteration over NALs and access units.
+
+     memory_NAL_source src(data, size);
+     for (NAL_unit& nal : parser.nals(&src)) { ... }
+
+   The ranges pull data from the source in large blocks when the parser has no complete
+   NAL left. The NAL (or access unit) an iterator points to is valid until the iterator
+   is advanced, after that it is returned to the parser.
+
+   Non-blocking sources may report that no data is available at the moment. The iteration
+   then ends with would_block() set. Iterating the same range again later continues at the
+   same position, nothing is lost.
+ */
+
+#define P265_SOURCE_END_OF_STREAM   0
+#define P265_SOURCE_WOULD_BLOCK   (-1)
+#define P265_SOURCE_ERROR         (-2)
+
+class NAL_source
+{
+public:
+  virtual ~NAL_source() { }
+
+  /* Get the next block of byte-stream data. It stays valid until the next call.
+     Returns the number of bytes or one of the P265_SOURCE_* codes. */
+  virtual int next_block(const unsigned char** data) = 0;
+};
+
+
+// A byte stream in memory (not copied).
+class memory_NAL_source : public NAL_source
+{
+public:
+  LIBP265_API memory_NAL_source(const unsigned char* data, size_t size, int block_size = (1<<20));
+
+  LIBP265_API virtual int next_block(const unsigned char** data);
+
+private:
+  const unsigned char* data;
+  size_t size;
+  size_t pos;
+  int block_size;
+};
+
+
+/* Reads from a file descriptor. A read of 0 bytes (end of file, or the peer closed the
+   pipe or socket) is P265_SOURCE_END_OF_STREAM. On a non-blocking descriptor, a read
+   that fails with EAGAIN/EWOULDBLOCK is reported as P265_SOURCE_WOULD_BLOCK. */
+class fd_NAL_source : public NAL_source
+{
+public:
+  LIBP265_API explicit fd_NAL_source(int fd, bool close_fd = false, int block_size = (1<<20));
+  LIBP265_API ~fd_NAL_source();
+
+  LIBP265_API virtual int next_block(const unsigned char** data);
+
+private:
+  int fd;
+  bool close_fd;
+  std::vector<unsigned char> buffer;
+};
+
+
+// Maps a complete file into memory (reads it where mmap is not available).
+class mmap_NAL_source : public NAL_source
+{
+public:
+  LIBP265_API explicit mmap_NAL_source(const char* filename, int block_size = (1<<20));
+  LIBP265_API ~mmap_NAL_source();
+
+  bool is_open() const { return !failed; }
+
+  LIBP265_API virtual int next_block(const unsigned char** data);
+
+private:
+  const unsigned char* data;
+  size_t size;
+  size_t pos;
+  int block_size;
+  bool mapped;
+  bool failed;
+};
+
+
+// --- ranges ---
+
+class NAL_range
+{
+public:
+  LIBP265_API NAL_range(NAL_Parser* parser, NAL_source* source);
+  LIBP265_API NAL_range(NAL_range&&);
+  LIBP265_API ~NAL_range();
+
+  class iterator
+  {
+  public:
+    explicit iterator(NAL_range* r = NULL) : range(r) { }
+
+    NAL_unit& operator*() const { return *range->current; }
+    NAL_unit* operator->() const { return range->current; }
+    iterator& operator++() { if (!range->fetch()) { range = NULL; } return *this; }
+
+    bool operator==(const iterator& i) const { return range == i.range; }
+    bool operator!=(const iterator& i) const { return range != i.range; }
+
+  private:
+    NAL_range* range;
+  };
+
+  LIBP265_API iterator begin();
+  iterator end() { return iterator(); }
+
+  bool would_block() const { return status == P265_SOURCE_WOULD_BLOCK; }
+  bool at_end_of_stream() const { return status == P265_SOURCE_END_OF_STREAM; }
+  bool has_error() const { return status == P265_SOURCE_ERROR; }
+
+private:
+  NAL_Parser* parser;
+  NAL_source* source;
+  NAL_unit* current;
+  int status; // why the iteration ended, 1 while running
+
+  friend class access_unit_range;
+
+  bool fetch();
+  NAL_unit* next_NAL(); // NULL when the iteration ends, see status
+
+  NAL_range(const NAL_range&) = delete;
+  NAL_range& operator=(const NAL_range&) = delete;
+};
+
+
+struct access_unit
+{
+  std::vector<NAL_unit*> nals;
+  int64_t  index;  // number of the access unit in the stream
+  P265_PTS pts;    // pts of the first NAL
+  bool     has_VCL;
+};
+
+
+/* Groups the NALs into access units (7.4.2.4.4). An access unit is complete when the first
+   NAL of the next one arrives, or at the end of the stream. */
+class access_unit_range
+{
+public:
+  LIBP265_API access_unit_range(NAL_Parser* parser, NAL_source* source);
+  LIBP265_API access_unit_range(access_unit_range&&);
+  LIBP265_API ~access_unit_range();
+
+  class iterator
+  {
+  public:
+    explicit iterator(access_unit_range* r = NULL) : range(r) { }
+
+    const access_unit& operator*() const { return range->current; }
+    const access_unit* operator->() const { return &range->current; }
+    iterator& operator++() { if (!range->fetch()) { range = NULL; } return *this; }
+
+    bool operator==(const iterator& i) const { return range == i.range; }
+    bool operator!=(const iterator& i) const { return range != i.range; }
+
+  private:
+    access_unit_range* range;
+  };
+
+  LIBP265_API iterator begin();
+  iterator end() { return iterator(); }
+
+  bool would_block() const { return nals.would_block(); }
+  bool at_end_of_stream() const { return nals.at_end_of_stream(); }
+  bool has_error() const { return nals.has_error(); }
+
+private:
+  NAL_range nals;
+
+  access_unit current;
+  access_unit building;
+  int64_t next_index;
+
+  bool fetch();
+  void release(access_unit*);
+
+  access_unit_range(const access_unit_range&) = delete;
+  access_unit_range& operator=(const access_unit_range&) = delete;
+};
+
+END_NAMESPACE_LIBP265
+
+#endif
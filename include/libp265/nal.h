@@ -117,6 +117,7 @@ LIBP265_API bool isIRAP(uint8_t unit_type);
 LIBP265_API bool isRADL(uint8_t unit_type);
 LIBP265_API bool isReferenceNALU(uint8_t unit_type);
 LIBP265_API bool isSublayerNonReference(uint8_t unit_type);
+LIBP265_API bool startsNewAccessUnit(uint8_t unit_type); // when following a VCL NAL
 
 LIBP265_API const char* get_NAL_name(uint8_t unit_type);
 
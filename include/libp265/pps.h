@@ -129,7 +129,8 @@ public:
   int tc_offset;
 
   char pic_scaling_list_data_present_flag;
-  struct scaling_list_data scaling_list; // contains valid data if sps->scaling_list_enabled_flag set
+  // If the PPS does not contain scaling lists, this is shared with the SPS.
+  std::shared_ptr<const scaling_list_data> scaling_list;
 
   char lists_modification_present_flag;
   int log2_parallel_merge_level; // [2 ; log2(max CB size)]
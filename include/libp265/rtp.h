@@ -0,0 +1,224 @@
+/*
+ * H.265 video codec parser.
+ * Copyright (c) 2023 John Willard <john.willard@shotover.com>
+ *
+ * This file is part of libp265.
+ *
+ * libp265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libp265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libp265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBP265_RTP_H
+#define LIBP265_RTP_H
+
+#include "libp265/libp265.h"
+#include "libp265/nal-parser.h"
+
+#include <stdint.h>
+#include <deque>
+#include <memory>
+#include <vector>
+
+BEGIN_NAMESPACE_LIBP265
+
+/* RTP payload format for HEVC (RFC 7798).
+
+   The packetizer produces RTP payloads from NALs (see rtp_packetizer below).
+
+   The depacketizer takes RTP packets and feeds the contained NALs into a NAL_Parser.
+   Single NAL unit packets are queued directly, aggregation packets (AP) are split, and
+   fragmentation units (FU) are reassembled in NAL_units from the parser's pool, so that
+   no Annex-B byte stream is built in between.
+
+   Packet loss (a gap in the sequence numbers) discards an incomplete FU. Packets that
+   arrive late (sequence number before the expected one) are dropped. There is no
+   jitter buffer, packets have to be passed in sequence number order.
+
+   A jump by 0x8000 or more that is not within P265_RTP_MAX_MISORDER of the expected
+   sequence number is dropped as well, but when the next packet continues from it, the
+   depacketizer resyncs to the new sequence numbers (as in RFC 3550, A.1) and counts the
+   skipped packets as lost.
+
+   When the stream uses DONL fields (sprop-max-don-diff > 0), the NALs are put back into
+   decoding order in a buffer of sprop-depack-buf-nalus NALs.
+ */
+
+#define P265_RTP_HEADER_SIZE    12
+#define P265_RTP_MAX_MISORDER   100
+
+#define P265_RTP_NAL_TYPE_AP    48
+#define P265_RTP_NAL_TYPE_FU    49
+#define P265_RTP_NAL_TYPE_PACI  50
+
+
+class rtp_depacketizer
+{
+public:
+  LIBP265_API rtp_depacketizer(NAL_Parser* parser);
+  LIBP265_API ~rtp_depacketizer();
+
+  /* Parameters from the SDP (sprop-max-don-diff, sprop-depack-buf-nalus). Must be set
+     before the first packet. With depack_buf_nalus=0, max_don_diff NALs are buffered. */
+  LIBP265_API void set_sprop_max_don_diff(int max_don_diff, int depack_buf_nalus = 0);
+
+  /* Push a complete RTP packet, including the RTP header. The NALs get the RTP timestamp
+     (extended to 64 bits) as pts.
+
+     Returns P265_ERROR_INPUT_BUFFER_FULL without consuming the packet if the NAL queue
+     of the parser is over its limits. Malformed packets are counted and skipped. */
+  LIBP265_API P265_error push_packet(const unsigned char* packet, int len,
+                                     std::shared_ptr<void> user_data = NULL);
+
+  // Push the payload of a packet whose RTP header was parsed by the caller.
+  LIBP265_API P265_error push_payload(const unsigned char* payload, int len,
+                                      uint16_t sequence_number, uint32_t timestamp, bool marker,
+                                      std::shared_ptr<void> user_data = NULL);
+
+  // End of stream: discard an incomplete FU and output the NALs in the reordering buffer.
+  LIBP265_API void flush();
+
+  int64_t get_num_lost_packets() const { return num_lost_packets; }
+  int64_t get_num_late_packets() const { return num_late_packets; }
+  int64_t get_num_malformed_packets() const { return num_malformed_packets; }
+  int64_t get_num_discarded_NALs() const { return num_discarded_NALs; } // incomplete FUs
+
+private:
+  NAL_Parser* parser;
+
+  int max_don_diff;
+  int depack_buf_nalus;
+
+  // packet sequence
+
+  bool     first_packet;
+  uint16_t expected_seq;
+  int      bad_seq;  // resync when this sequence number comes next, -1: none
+  uint32_t last_timestamp;
+  int64_t  ext_timestamp;
+
+  // FU reassembly
+
+  NAL_unit* fu_nal;   // NULL if no FU is in progress
+  uint16_t  fu_don;
+  bool      fu_truncated; // larger than the parser's max_NAL_size, only the start is kept
+
+  // DON reordering
+
+  struct reorder_entry {
+    int64_t   abs_don;
+    NAL_unit* nal;
+  };
+
+  std::vector<reorder_entry> reorder_buffer; // sorted by abs_don
+  bool     first_don;
+  uint16_t last_don;
+  int64_t  last_abs_don;
+  int64_t  max_abs_don;
+
+  int64_t num_lost_packets;
+  int64_t num_late_packets;
+  int64_t num_malformed_packets;
+  int64_t num_discarded_NALs;
+
+  bool uses_DON() const { return max_don_diff > 0; }
+
+  P265_error output_NAL(const unsigned char* header, const unsigned char* data, int len,
+                        uint16_t don, const std::shared_ptr<void>& user_data);
+  void output_NAL(NAL_unit* nal, uint16_t don);
+  void release_reordered_NALs(bool all);
+
+  void discard_FU();
+  P265_error push_FU(const unsigned char* payload, int len,
+                     const std::shared_ptr<void>& user_data);
+  P265_error push_AP(const unsigned char* payload, int len,
+                     const std::shared_ptr<void>& user_data);
+
+  rtp_depacketizer(const rtp_depacketizer&) = delete;
+  rtp_depacketizer& operator=(const rtp_depacketizer&) = delete;
+};
+
+
+
+/* Part of a payload (scatter-gather list, as for writev()/sendmsg()). */
+struct rtp_segment
+{
+  const unsigned char* data;
+  int size;
+};
+
+#define P265_RTP_SCRATCH_SIZE   64  // header bytes per payload
+#define P265_RTP_MIN_SEGMENTS    8
+#define P265_RTP_MAX_AP_NALS    16  // NALs per aggregation packet
+
+
+/* Splits NALs into RTP payloads of at most max_payload_size bytes (MTU minus IP, UDP
+   and RTP headers).
+
+   NALs that fit are sent as single NAL unit packets. Consecutive small NALs of the same
+   access unit (typically parameter sets and SEIs) are combined into an aggregation packet,
+   larger NALs are split into fragmentation units.
+
+   The payloads are not copied together. next_payload() describes each payload by segments
+   that point into the NAL data, into a small caller-provided scratch buffer for the
+   payload headers, and to constant data. NALs from NAL_Parser have their emulation
+   prevention bytes removed; these are inserted again as extra segments, so the NALs are
+   sent exactly as they were received.
+ */
+class rtp_packetizer
+{
+public:
+  LIBP265_API rtp_packetizer(int max_payload_size);
+
+  // Send DONL/DOND fields (for streams with sprop-max-don-diff > 0).
+  LIBP265_API void set_sprop_max_don_diff(int max_don_diff);
+
+  /* Queue a NAL. It is not copied and has to stay valid until all its packets have been
+     taken, i.e. until it is not among the last get_num_pending_NALs() pushed NALs anymore.
+     Aggregation packets are only built from NALs that are already queued, so push all
+     NALs of an access unit before taking its payloads. */
+  LIBP265_API void push_NAL(const NAL_unit* nal, bool last_in_access_unit);
+
+  /* Describe the next payload in 'segments' (max_segments >= P265_RTP_MIN_SEGMENTS).
+     Header bytes are written to 'scratch' (P265_RTP_SCRATCH_SIZE bytes), which has to stay
+     valid until the payload was sent. 'marker' is set for the last payload of an access
+     unit (RTP marker bit).
+
+     Returns the number of segments, or 0 if no NAL is pending. */
+  LIBP265_API int  next_payload(rtp_segment* segments, int max_segments,
+                                unsigned char* scratch, bool* marker);
+
+  int get_num_pending_NALs() const { return static_cast<int>(queue.size()); }
+
+private:
+  int max_payload_size;
+  int max_don_diff;
+
+  struct queued_NAL {
+    const NAL_unit* nal;
+    bool last_in_access_unit;
+  };
+
+  std::deque<queued_NAL> queue;
+
+  int      fu_pos;  // escaped position in the front NAL where the next FU starts, 0: no FU
+  uint16_t don;     // DON of the front NAL
+
+  bool uses_DON() const { return max_don_diff > 0; }
+
+  int next_AP(rtp_segment* segments, int max_segments, unsigned char* scratch, bool* marker);
+  int next_FU(rtp_segment* segments, int max_segments, unsigned char* scratch, bool* marker);
+};
+
+END_NAMESPACE_LIBP265
+
+#endif
@@ -36,6 +36,7 @@ typedef struct {
   uint8_t scanPos;
 } scan_position;
 
+// Can be called any number of times, also concurrently.
 LIBP265_API void init_scan_orders();
 
 /* scanIdx: 0 - diag, 1 - horiz, 2 - verti
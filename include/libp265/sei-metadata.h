@@ -0,0 +1,132 @@
+/*
+ * H.265 video codec parser.
+ * Copyright (c) 2023 John Willard <john.willard@shotover.com>
+ *
+ * This file is part of libp265.
+ *
+ * libp265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libp265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libp265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBP265_SEI_METADATA_H
+#define LIBP265_SEI_METADATA_H
+
+#include "libp265/libp265.h"
+#include "libp265/sei.h"
+#include "libp265/nal-parser.h"
+
+#include <atomic>
+#include <vector>
+
+BEGIN_NAMESPACE_LIBP265
+
+/* Extraction of caption and HDR metadata from SEI NALs while they pass through the
+   NAL_Parser. The NALs themselves are not modified.
+
+   The extracted records are stored in a ring buffer that is allocated once. The
+   NAL_Parser thread is the only producer, a single consumer may run in another
+   thread. When the ring buffer is full, new records are dropped and counted.
+ */
+
+enum sei_metadata_type {
+  sei_metadata_cea708_captions     = 0x01, // ATSC A/53 cc_data
+  sei_metadata_hdr10plus           = 0x02, // SMPTE ST 2094-40 (T.35 provider 0x003C)
+  sei_metadata_st2094_10           = 0x04, // SMPTE ST 2094-10 (ATSC A/341 'GA94' type 0x09)
+  sei_metadata_mastering_display   = 0x08,
+  sei_metadata_content_light_level = 0x10,
+
+  sei_metadata_all = 0x1F
+};
+
+#define P265_SEI_METADATA_MAX_SIZE 480
+
+struct sei_metadata_record
+{
+  enum sei_metadata_type type;
+  P265_PTS pts;          // NAL_unit::pts of the SEI NAL
+  uint8_t  nal_unit_type; // prefix or suffix SEI
+
+  int      size;         // number of bytes in data[]
+  bool     truncated;    // the payload did not fit into data[]
+
+  // cea708_captions only
+  uint8_t  cc_count;
+  uint8_t  em_data;
+  bool     process_cc_data_flag;
+
+  union {
+    /* cea708_captions: cc_count triplets (see sei_cc_data)
+       hdr10plus, st2094_10: the T.35 payload, starting at itu_t_t35_provider_code */
+    uint8_t data[P265_SEI_METADATA_MAX_SIZE];
+
+    sei_mastering_display_colour_volume mastering_display;
+    sei_content_light_level_info content_light_level;
+  };
+};
+
+
+class sei_metadata_extractor
+{
+ public:
+  // 'capacity' is rounded up to a power of two. 'types' is a mask of sei_metadata_type.
+  LIBP265_API explicit sei_metadata_extractor(int capacity = 64, unsigned int types = sei_metadata_all);
+
+  void set_types(unsigned int mask) { types = mask; }
+
+
+  // --- producer ---
+
+  // Extract the metadata from a NAL. Non-SEI NALs are ignored.
+  LIBP265_API void process_NAL(const NAL_unit* nal);
+
+
+  // --- consumer ---
+
+  // The oldest record, or NULL if there is none. It stays valid until pop() is called.
+  const sei_metadata_record* front() const {
+    uint64_t t = tail.load(std::memory_order_relaxed);
+    if (t == head.load(std::memory_order_acquire)) { return NULL; }
+    return &ring[t & mask];
+  }
+
+  void pop() {
+    tail.store(tail.load(std::memory_order_relaxed)+1, std::memory_order_release);
+  }
+
+  int size() const {
+    return static_cast<int>(head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire));
+  }
+
+  int capacity() const { return mask+1; }
+
+  uint64_t get_num_dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+ private:
+  std::vector<sei_metadata_record> ring;
+  uint32_t mask;
+  unsigned int types;
+
+  alignas(64) std::atomic<uint64_t> head; // written by the producer
+  alignas(64) std::atomic<uint64_t> tail; // written by the consumer
+  std::atomic<uint64_t> dropped;
+
+  sei_metadata_record* begin_record(enum sei_metadata_type type, const NAL_unit* nal);
+  void commit_record() { head.store(head.load(std::memory_order_relaxed)+1, std::memory_order_release); }
+
+  void process_user_data_registered(const sei_payload& payload, const NAL_unit* nal);
+  void store_raw(enum sei_metadata_type type, const NAL_unit* nal, const uint8_t* data, int size);
+};
+
+END_NAMESPACE_LIBP265
+
+#endif
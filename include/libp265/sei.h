@@ -23,9 +23,13 @@
 
 #include "libp265/libp265.h"
 #include "libp265/bitstream.h"
+#include "libp265/vui.h"
 
 BEGIN_NAMESPACE_LIBP265
 
+class NAL_unit;
+class seq_parameter_set;
+
 enum sei_payload_type {
   sei_payload_type_buffering_period = 0,
   sei_payload_type_pic_timing = 1,
@@ -51,7 +55,15 @@ enum sei_payload_type {
   sei_payload_type_scalable_nesting = 133,
   sei_payload_type_region_refresh_info = 134,
   sei_payload_type_no_display = 135,
-  sei_payload_type_motion_constrained_tile_sets = 136
+  sei_payload_type_time_code = 136,
+  sei_payload_type_mastering_display_colour_volume = 137,
+  sei_payload_type_segmented_rect_frame_packing_arrangement = 138,
+  sei_payload_type_motion_constrained_tile_sets = 139,
+  sei_payload_type_chroma_resampling_filter_hint = 140,
+  sei_payload_type_knee_function_info = 141,
+  sei_payload_type_colour_remapping_info = 142,
+  sei_payload_type_content_light_level_info = 144,
+  sei_payload_type_alternative_transfer_characteristics = 147
 };
 
 
@@ -70,22 +82,242 @@ struct sei_decoded_picture_hash {
 };
 
 
+struct sei_initial_cpb_removal {
+  uint32_t initial_cpb_removal_delay;
+  uint32_t initial_cpb_removal_offset;
+  uint32_t initial_alt_cpb_removal_delay;
+  uint32_t initial_alt_cpb_removal_offset;
+};
+
+struct sei_buffering_period {
+  uint8_t  bp_seq_parameter_set_id;
+  bool     irap_cpb_params_present_flag;
+  uint32_t cpb_delay_offset;
+  uint32_t dpb_delay_offset;
+  bool     concatenation_flag;
+  uint32_t au_cpb_removal_delay_delta_minus1;
+
+  bool     NalHrdBpPresentFlag;
+  bool     VclHrdBpPresentFlag;
+  uint8_t  CpbCnt;  // number of entries in nal[] and vcl[]
+  sei_initial_cpb_removal nal[MAX_HRD_CPB_CNT];
+  sei_initial_cpb_removal vcl[MAX_HRD_CPB_CNT];
+
+  bool     use_alt_cpb_params_flag;
+};
+
+struct sei_pic_timing {
+  bool     frame_field_info_present; // pic_struct, source_scan_type, duplicate_flag are coded
+  uint8_t  pic_struct;
+  uint8_t  source_scan_type;
+  bool     duplicate_flag;
+
+  bool     CpbDpbDelaysPresentFlag;
+  uint32_t au_cpb_removal_delay_minus1;
+  uint32_t pic_dpb_output_delay;
+  uint32_t pic_dpb_output_du_delay;
+
+  // decoding unit information (only the common part, the per-DU values are skipped)
+  bool     du_info_present;
+  uint32_t num_decoding_units_minus1;
+  bool     du_common_cpb_removal_delay_flag;
+  uint32_t du_common_cpb_removal_delay_increment_minus1;
+};
+
+struct sei_recovery_point {
+  int32_t  recovery_poc_cnt;
+  bool     exact_match_flag;
+  bool     broken_link_flag;
+};
+
+struct sei_mastering_display_colour_volume {
+  uint16_t display_primaries_x[3];  // in units of 0.00002
+  uint16_t display_primaries_y[3];
+  uint16_t white_point_x;
+  uint16_t white_point_y;
+  uint32_t max_display_mastering_luminance;  // in units of 0.0001 cd/m^2
+  uint32_t min_display_mastering_luminance;
+};
+
+struct sei_content_light_level_info {
+  uint16_t max_content_light_level;      // in cd/m^2
+  uint16_t max_pic_average_light_level;
+};
+
+struct sei_clock_timestamp {
+  bool     clock_timestamp_flag;
+  bool     units_field_based_flag;
+  uint8_t  counting_type;
+  bool     full_timestamp_flag;
+  bool     discontinuity_flag;
+  bool     cnt_dropped_flag;
+  uint16_t n_frames;
+  int8_t   seconds_value;  // -1 if not coded
+  int8_t   minutes_value;
+  int8_t   hours_value;
+  uint8_t  time_offset_length;
+  int32_t  time_offset_value;
+};
+
+struct sei_time_code {
+  uint8_t  num_clock_ts;
+  sei_clock_timestamp clock_ts[3];
+};
+
+/* The payload is not copied, 'data' points into the SEI NAL. */
+struct sei_user_data_registered {
+  uint8_t  itu_t_t35_country_code;
+  uint8_t  itu_t_t35_country_code_extension_byte;  // only if country_code==0xFF
+  const uint8_t* data;  // itu_t_t35_payload_byte[]
+  int      size;
+};
+
+#define ITU_T_T35_COUNTRY_CODE_US    0xB5
+#define ITU_T_T35_PROVIDER_CODE_ATSC 0x0031
+
+/* CEA-708 cc_data() as carried in ATSC A/53 'GA94' user data.
+   The caption data is not copied. */
+struct sei_cc_data {
+  bool     process_em_data_flag;
+  bool     process_cc_data_flag;
+  bool     additional_data_flag;
+  uint8_t  cc_count;
+  uint8_t  em_data;
+
+  /* cc_count triplets: (marker_bits:5, cc_valid:1, cc_type:2), cc_data_1, cc_data_2 */
+  const uint8_t* cc_data;
+
+  bool    cc_valid(int i) const { return cc_data[3*i] & 0x04; }
+  uint8_t cc_type (int i) const { return cc_data[3*i] & 0x03; }
+  uint8_t cc_data_1(int i) const { return cc_data[3*i+1]; }
+  uint8_t cc_data_2(int i) const { return cc_data[3*i+2]; }
+};
+
+
+/* One message of an SEI NAL unit. The payload is not copied, it points into the
+   NAL data and is only valid as long as the NAL is. */
+struct sei_payload {
+  enum sei_payload_type payload_type;
+  int payload_size;
+  const uint8_t* payload;
+};
+
+
 struct sei_message {
   enum sei_payload_type payload_type;
   int payload_size;
+  const uint8_t* payload;
 
   union {
     sei_decoded_picture_hash decoded_picture_hash;
+    sei_buffering_period buffering_period;
+    sei_pic_timing pic_timing;
+    sei_recovery_point recovery_point;
+    sei_mastering_display_colour_volume mastering_display_colour_volume;
+    sei_content_light_level_info content_light_level_info;
+    sei_user_data_registered user_data_registered;
+    sei_time_code time_code;
   } data;
 };
 
-class seq_parameter_set;
+
+/* Iterates over the SEI messages in a prefix or suffix SEI NAL unit. Only the message
+   headers are read, the payloads are returned as pointers into the NAL data.
+
+   while (iter.next(&payload)) {
+     ...
+   }
+   if (iter.get_error() != P265_OK) { ... truncated NAL ... }
+ */
+class sei_message_iterator
+{
+ public:
+  // 'rbsp' is the sei_rbsp() without NAL header and with emulation prevention bytes removed.
+  sei_message_iterator(const uint8_t* rbsp, int size) : ptr(rbsp), end(rbsp+size), err(P265_OK) { }
+
+  // Iterate over the messages of an SEI NAL from the NAL_Parser.
+  LIBP265_API explicit sei_message_iterator(const NAL_unit* nal);
+
+  // Returns false when there are no more messages (or the NAL is corrupt).
+  LIBP265_API bool next(sei_payload* msg);
+
+  P265_error get_error() const { return err; }
+
+ private:
+  const uint8_t* ptr;
+  const uint8_t* end;
+  P265_error err;
+};
+
 
 LIBP265_API const char* sei_type_name(enum sei_payload_type type);
 
 LIBP265_API P265_error read_sei(bitreader* reader, sei_message*, bool suffix, const seq_parameter_set* sps);
 LIBP265_API void dump_sei(const sei_message*, const seq_parameter_set* sps);
-LIBP265_API P265_error process_sei(const sei_message*, struct P265_image* img);
+
+/* Decode a message that was returned by sei_message_iterator. Unknown message types
+   are not decoded, only the payload pointer is set.
+   'sps' is the active SPS. It is needed for decoded_picture_hash and pic_timing.
+   For buffering_period, it has to be the SPS referenced by bp_seq_parameter_set_id
+   (see peek_sei_buffering_period_sps_id()). */
+LIBP265_API P265_error parse_sei_payload(const sei_payload& payload, sei_message*,
+                                         const seq_parameter_set* sps);
+
+
+// --- decoders for single message types ---
+
+LIBP265_API int peek_sei_buffering_period_sps_id(const sei_payload& payload);
+
+LIBP265_API P265_error parse_sei_buffering_period(const sei_payload&, sei_buffering_period*,
+                                                  const seq_parameter_set* sps);
+LIBP265_API P265_error parse_sei_pic_timing(const sei_payload&, sei_pic_timing*,
+                                            const seq_parameter_set* sps);
+LIBP265_API P265_error parse_sei_recovery_point(const sei_payload&, sei_recovery_point*);
+LIBP265_API P265_error parse_sei_mastering_display_colour_volume(const sei_payload&,
+                                                                 sei_mastering_display_colour_volume*);
+LIBP265_API P265_error parse_sei_content_light_level_info(const sei_payload&,
+                                                          sei_content_light_level_info*);
+LIBP265_API P265_error parse_sei_user_data_registered(const sei_payload&, sei_user_data_registered*);
+LIBP265_API P265_error parse_sei_time_code(const sei_payload&, sei_time_code*);
+
+/* Extract CEA-708 caption data from registered user data (ATSC A/53, 'GA94').
+   Returns P265_ERROR_CANNOT_PROCESS_SEI if the user data does not contain captions. */
+LIBP265_API P265_error parse_cea708_cc_data(const sei_user_data_registered*, sei_cc_data*);
+
+
+// --- decoded picture hash verification ---
+
+/* One plane of a decoded picture */
+struct picture_plane {
+  const uint8_t* data;
+  int stride;     // in samples
+  int width;
+  int height;
+  int bit_depth;  // samples are stored as uint16_t if bit_depth > 8
+};
+
+/* Compute the MD5 sums of all planes as defined for the decoded picture hash SEI.
+   The planes are processed in parallel. Passing the planes of several pictures at once
+   makes better use of the SIMD lanes. */
+LIBP265_API void compute_planes_MD5(const picture_plane* planes, int nPlanes, uint8_t (*md5)[16]);
+
+/* Check the planes of a decoded picture against a decoded picture hash SEI.
+   'planes' and 'strides' (in samples) are given for Y,Cb,Cr (only Y for monochrome).
+   Samples are stored as uint16_t if the bit depth is larger than 8.
+   Returns P265_OK if all planes match, P265_ERROR_CHECKSUM_MISMATCH otherwise.
+   If 'plane_match' is not NULL, it receives the result for each plane.
+
+   Large planes are split into row ranges that are processed in parallel (CRC, checksum),
+   MD5 sums are computed with one task per plane. The work runs on the shared thread pool
+   (get_shared_thread_pool()), max_threads limits the number of parts, 0 uses all CPU cores.
+ */
+LIBP265_API P265_error check_decoded_picture_hash(const sei_decoded_picture_hash* hash,
+                                                  const uint8_t* const planes[3], const int strides[3],
+                                                  int width, int height,
+                                                  int bit_depth_luma, int bit_depth_chroma,
+                                                  int chroma_format_idc,
+                                                  bool plane_match[3] = NULL,
+                                                  int max_threads = 0);
 
 END_NAMESPACE_LIBP265
 
@@ -0,0 +1,124 @@
+/*
+ * H.265 video codec parser.
+ * Copyright (c) 2023 John Willard <john.willard@shotover.com>
+ *
+ * This file is part of libp265.
+ *
+ * libp265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libp265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libp265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBP265_SNAPSHOT_H
+#define LIBP265_SNAPSHOT_H
+
+#include "libp265/libp265.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+BEGIN_NAMESPACE_LIBP265
+
+class NAL_Parser;
+class parse_context;
+
+/* Snapshots of the parsing state of a stream, so that parsing can continue in another
+   process or on another host, at any byte position.
+
+   The snapshot contains the NAL_Parser state (byte-stream state, the partially received
+   NAL and the NAL queue) and the active parameter sets of the parse_context. Parameter
+   sets are stored as their NAL data and parsed again on restore, hence all parameter sets
+   have to be read with parse_context::read_parameter_set_NAL(). Otherwise saving fails
+   with P265_ERROR_SNAPSHOT_INCOMPLETE.
+
+   Not included are configuration (handlers, limits, SEI extractor), user_data pointers
+   and the warnings/diagnostics of the error queue.
+
+   All values are stored little-endian, the format is independent of the host.
+ */
+
+#define P265_SNAPSHOT_MAGIC   0x50323635  // 'P265'
+#define P265_SNAPSHOT_VERSION 1
+
+
+class snapshot_writer
+{
+public:
+  void put_u8(uint8_t v) { buffer.push_back(v); }
+  void put_u32(uint32_t v) { for (int i=0;i<4;i++) { buffer.push_back((v >> (8*i)) & 0xFF); } }
+  void put_i64(int64_t v) { for (int i=0;i<8;i++) { buffer.push_back(((uint64_t)v >> (8*i)) & 0xFF); } }
+  void put_bytes(const unsigned char* data, size_t n) { buffer.insert(buffer.end(), data, data+n); }
+
+  std::vector<unsigned char> buffer;
+};
+
+
+class snapshot_reader
+{
+public:
+  snapshot_reader(const unsigned char* data, size_t size) : data(data), size(size), pos(0), error(false) { }
+
+  uint8_t get_u8() {
+    if (!check(1)) { return 0; }
+    return data[pos++];
+  }
+
+  uint32_t get_u32() {
+    if (!check(4)) { return 0; }
+    uint32_t v = 0;
+    for (int i=0;i<4;i++) { v |= (uint32_t)data[pos++] << (8*i); }
+    return v;
+  }
+
+  int64_t get_i64() {
+    if (!check(8)) { return 0; }
+    uint64_t v = 0;
+    for (int i=0;i<8;i++) { v |= (uint64_t)data[pos++] << (8*i); }
+    return (int64_t)v;
+  }
+
+  // Returns a pointer into the snapshot, or NULL if there are not enough bytes.
+  const unsigned char* get_bytes(size_t n) {
+    if (!check(n)) { return NULL; }
+    const unsigned char* p = data+pos;
+    pos += n;
+    return p;
+  }
+
+  bool ok() const { return !error; }
+  bool at_end() const { return pos == size; }
+
+private:
+  const unsigned char* data;
+  size_t size;
+  size_t pos;
+  bool error;
+
+  bool check(size_t n) {
+    if (error || size-pos < n) { error = true; return false; }
+    return true;
+  }
+};
+
+
+LIBP265_API P265_error save_stream_state(const NAL_Parser* parser, const parse_context* ctx,
+                                         std::vector<unsigned char>* out);
+
+/* Restore into a freshly constructed parser and context (already configured with handlers
+   and limits). Returns P265_ERROR_PARAMETER_PARSING if the snapshot is malformed. */
+LIBP265_API P265_error restore_stream_state(NAL_Parser* parser, parse_context* ctx,
+                                            const unsigned char* data, size_t size);
+
+END_NAMESPACE_LIBP265
+
+#endif
@@ -28,6 +28,7 @@
 #include "libp265/libp265.h"
 
 #include <vector>
+#include <memory>
 
 BEGIN_NAMESPACE_LIBP265
 
@@ -59,6 +60,33 @@ typedef struct scaling_list_data {
 } scaling_list_data;
 
 
+/* Limits of the level signalled in the SPS (Annex A) and the worst-case
+   resources that a stream using this SPS may need.
+ */
+struct sps_level_limits {
+  bool level_known;   // false if level_idc is not defined in Annex A (no limits checked)
+
+  // --- Table A.8 / A.9 (general tier and level limits) ---
+
+  int64_t MaxLumaPs;
+  int64_t MaxCPB;     // in bits, for NAL HRD (CpbNalFactor applied)
+  int64_t MaxBR;      // in bits/s, for NAL HRD (CpbNalFactor applied)
+  int64_t MaxLumaSr;
+  int     MaxSliceSegmentsPerPicture;
+  int     MaxTileRows;
+  int     MaxTileCols;
+  int     MaxDpbSize; // A.4.2, depends on the picture size
+
+  // --- resource budgets ---
+
+  int64_t decoded_picture_bytes;   // all planes of one decoded picture
+  int64_t max_coded_picture_bytes; // the CPB size, no coded picture can be larger
+  int     max_dpb_pictures;        // sps_max_dec_pic_buffering of the highest sub-layer
+  int64_t max_dpb_bytes;
+  int     max_slices_per_picture;
+};
+
+
 enum PresetSet {
   Preset_Default
 };
@@ -99,6 +127,97 @@ public:
   LIBP265_API void set_TB_log2size_range(int mini,int maxi);
   LIBP265_API void set_resolution(int w,int h);
 
+
+  /* The members are ordered by access frequency: the derived values and flags that
+     are used while decoding the slice data come first, so that they are packed
+     into a few cache lines. The remaining syntax elements follow. Large and rarely used structures
+     (scaling lists, VUI) are held in separate immutable blocks, which are shared
+     between copies of the SPS.
+   */
+
+  // --- derived values ---
+
+  LIBP265_API P265_error compute_derived_values(bool sanitize_values = false);
+
+  int Log2MinCbSizeY;
+  int Log2CtbSizeY;
+  int MinCbSizeY;
+  int CtbSizeY;
+  int PicWidthInMinCbsY;
+  int PicWidthInCtbsY;
+  int PicHeightInMinCbsY;
+  int PicHeightInCtbsY;
+  int PicSizeInMinCbsY;
+  int PicSizeInCtbsY;
+  int PicSizeInSamplesY;
+
+  int Log2MinTrafoSize;
+  int Log2MaxTrafoSize;
+
+  int Log2MinPUSize;
+  int PicWidthInMinPUs;  // might be rounded up
+  int PicHeightInMinPUs; // might be rounded up
+
+  int BitDepth_Y;
+  int QpBdOffset_Y;
+  int BitDepth_C;
+  int QpBdOffset_C;
+
+  int ChromaArrayType;
+  int SubWidthC, SubHeightC;
+
+  int CtbWidthC, CtbHeightC;
+
+  int Log2MinIpcmCbSizeY;
+  int Log2MaxIpcmCbSizeY;
+
+  uint8_t WpOffsetBdShiftY;
+  uint8_t WpOffsetBdShiftC;
+  int32_t WpOffsetHalfRangeY;
+  int32_t WpOffsetHalfRangeC;
+
+  // frequently tested flags
+
+  char amp_enabled_flag;
+  char sample_adaptive_offset_enabled_flag;
+  char pcm_enabled_flag;
+  char pcm_loop_filter_disable_flag;
+  char sps_temporal_mvp_enabled_flag;
+  char strong_intra_smoothing_enable_flag;
+  char scaling_list_enable_flag;
+  char long_term_ref_pics_present_flag;
+
+  int  max_transform_hierarchy_depth_inter;
+  int  max_transform_hierarchy_depth_intra;
+
+  // less frequently used derived values
+
+  int WinUnitX, WinUnitY;
+
+  int MaxPicOrderCntLsb;
+
+  int PicWidthInTbsY; // not in standard
+  int PicHeightInTbsY; // not in standard
+  int PicSizeInTbsY; // not in standard
+
+  int SpsMaxLatencyPictures[7]; // [temporal layer]
+
+
+  int getPUIndexRS(int pixelX,int pixelY) const {
+    return (pixelX>>Log2MinPUSize) + (pixelY>>Log2MinPUSize)*PicWidthInMinPUs;
+  }
+
+  int get_bit_depth(int cIdx) const {
+    if (cIdx==0) return BitDepth_Y;
+    else         return BitDepth_C;
+  }
+
+  int get_chroma_shift_W(int cIdx) const { return cIdx ? SubWidthC -1 : 0; }
+  int get_chroma_shift_H(int cIdx) const { return cIdx ? SubHeightC-1 : 0; }
+
+
+  // --- syntax elements ---
+
   bool sps_read; // whether the sps has been read from the bitstream
 
 
@@ -106,8 +225,6 @@ public:
   char sps_max_sub_layers;            // [1;7]
   char sps_temporal_id_nesting_flag;
 
-  profile_tier_level profile_tier_level_;
-
   int seq_parameter_set_id;
   int chroma_format_idc;
 
@@ -135,40 +252,24 @@ public:
   int  log2_diff_max_min_luma_coding_block_size;    // largest  CB size
   int  log2_min_transform_block_size;               // smallest TB size [2;5]
   int  log2_diff_max_min_transform_block_size;      // largest  TB size
-  int  max_transform_hierarchy_depth_inter;
-  int  max_transform_hierarchy_depth_intra;
 
-  char scaling_list_enable_flag;
   char sps_scaling_list_data_present_flag; /* if not set, the default scaling lists will be set
                                               in scaling_list */
 
-  struct scaling_list_data scaling_list;
-
-  char amp_enabled_flag;
-  char sample_adaptive_offset_enabled_flag;
-  char pcm_enabled_flag;
-
   char pcm_sample_bit_depth_luma;
   char pcm_sample_bit_depth_chroma;
   int  log2_min_pcm_luma_coding_block_size;
   int  log2_diff_max_min_pcm_luma_coding_block_size;
-  char pcm_loop_filter_disable_flag;
 
   int num_short_term_ref_pic_sets() const { return static_cast<int>(ref_pic_sets.size()); }
   std::vector<ref_pic_set> ref_pic_sets; // [0 ; num_short_term_ref_pic_set (<=MAX_REF_PIC_SETS) )
 
-  char long_term_ref_pics_present_flag;
-
   int num_long_term_ref_pics_sps;
 
   int  lt_ref_pic_poc_lsb_sps[MAX_NUM_LT_REF_PICS_SPS];
   char used_by_curr_pic_lt_sps_flag[MAX_NUM_LT_REF_PICS_SPS];
 
-  char sps_temporal_mvp_enabled_flag;
-  char strong_intra_smoothing_enable_flag;
-
   char vui_parameters_present_flag;
-  video_usability_information vui;
 
   char sps_extension_present_flag;
   char sps_range_extension_flag;
@@ -185,69 +286,29 @@ public:
     rbsp_trailing_bits()
   */
 
+  profile_tier_level profile_tier_level_;
 
-  // --- derived values ---
-
-  LIBP265_API P265_error compute_derived_values(bool sanitize_values = false);
-
-  int BitDepth_Y;
-  int QpBdOffset_Y;
-  int BitDepth_C;
-  int QpBdOffset_C;
-
-  int ChromaArrayType;
-  int SubWidthC, SubHeightC;
-  int WinUnitX, WinUnitY;
-
-  int MaxPicOrderCntLsb;
-
-  int Log2MinCbSizeY;
-  int Log2CtbSizeY;
-  int MinCbSizeY;
-  int CtbSizeY;
-  int PicWidthInMinCbsY;
-  int PicWidthInCtbsY;
-  int PicHeightInMinCbsY;
-  int PicHeightInCtbsY;
-  int PicSizeInMinCbsY;
-  int PicSizeInCtbsY;
-  int PicSizeInSamplesY;
-
-  int CtbWidthC, CtbHeightC;
 
-  int PicWidthInTbsY; // not in standard
-  int PicHeightInTbsY; // not in standard
-  int PicSizeInTbsY; // not in standard
+  // --- level limits ---
 
-  int Log2MinTrafoSize;
-  int Log2MaxTrafoSize;
+  /* Check the SPS against the limits of its level and compute the resource budgets.
+     Violations are reported as warnings. Returns false if a limit is exceeded.
+     Requires the derived values to be computed. */
+  LIBP265_API bool compute_level_limits(error_queue* errqueue);
 
-  int Log2MinPUSize;
-  int PicWidthInMinPUs;  // might be rounded up
-  int PicHeightInMinPUs; // might be rounded up
+  sps_level_limits level_limits;
 
-  int Log2MinIpcmCbSizeY;
-  int Log2MaxIpcmCbSizeY;
-
-  int SpsMaxLatencyPictures[7]; // [temporal layer]
 
-  uint8_t WpOffsetBdShiftY;
-  uint8_t WpOffsetBdShiftC;
-  int32_t WpOffsetHalfRangeY;
-  int32_t WpOffsetHalfRangeC;
+  // --- shared cold data ---
 
+  // The flat lists if scaling_list_enable_flag is not set. Lists are shared between
+  // all parameter sets with identical content (see intern_scaling_lists()).
+  std::shared_ptr<const scaling_list_data> scaling_list;
 
-  int getPUIndexRS(int pixelX,int pixelY) const {
-    return (pixelX>>Log2MinPUSize) + (pixelY>>Log2MinPUSize)*PicWidthInMinPUs;
-  }
+  // NULL if vui_parameters_present_flag is not set, use get_vui() to get the inferred values
+  std::shared_ptr<const video_usability_information> vui;
 
-  int get_bit_depth(int cIdx) const {
-    if (cIdx==0) return BitDepth_Y;
-    else         return BitDepth_C;
-  }
-
-  int get_chroma_shift_W(int cIdx) const { return cIdx ? SubWidthC -1 : 0; }
-  int get_chroma_shift_H(int cIdx) const { return cIdx ? SubHeightC-1 : 0; }
+  LIBP265_API const video_usability_information& get_vui() const;
 };
 
 LIBP265_API P265_error read_scaling_list(bitreader*, const seq_parameter_set*, scaling_list_data*, bool inPPS);
@@ -255,6 +316,15 @@ LIBP265_API P265_error read_scaling_list(bitreader*, const seq_parameter_set*, s
 //                                scaling_list_data* sclist, bool inPPS);
 LIBP265_API void set_default_scaling_lists(scaling_list_data*);
 
+/* Shared instances of the default (Table 7-5/7-6) and the flat (all 16) scaling lists.
+   They are built on first use. */
+LIBP265_API std::shared_ptr<const scaling_list_data> get_default_scaling_lists();
+LIBP265_API std::shared_ptr<const scaling_list_data> get_flat_scaling_lists();
+
+/* Returns an existing scaling list with the same content if there is one, or registers
+   'sclist' for later lookups otherwise. Thread-safe. */
+LIBP265_API std::shared_ptr<const scaling_list_data> intern_scaling_lists(std::shared_ptr<const scaling_list_data> sclist);
+
 END_NAMESPACE_LIBP265
 
 #endif
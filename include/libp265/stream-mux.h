@@ -0,0 +1,201 @@
+/*
+ * H.265 video codec parser.
+ * Copyright (c) 2023 John Willard <john.willard@shotover.com>
+ *
+ * This file is part of libp265.
+ *
+ * libp265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libp265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libp265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBP265_STREAM_MUX_H
+#define LIBP265_STREAM_MUX_H
+
+#include "libp265/libp265.h"
+#include "libp265/nal-parser.h"
+#include "libp265/context.h"
+#include "libp265/threads.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <vector>
+
+BEGIN_NAMESPACE_LIBP265
+
+/* Parsing of many independent streams on a shared thread pool.
+
+   Each stream has its own NAL_Parser and parse_context. Input chunks are copied into a
+   per-stream queue and parsed by a pool task. At most one task per stream runs at a time,
+   hence the NALs of a stream are delivered in stream order, while different streams are
+   parsed in parallel. A task parses a limited number of chunks and then requeues itself,
+   so that busy streams do not starve the others.
+
+   Parameter set NALs are stored in the stream's parse_context before the NAL is delivered.
+   NALs are delivered to the stream's handler (called from a pool thread), or, when the
+   stream has no handler, to a completion queue that the application polls with pop_NAL().
+
+   With numa_thread_pools, each stream is pinned to one node: its tasks only run on that
+   node's pool, and its parser state is allocated by a task on that node, so that the
+   state and the NAL buffers (first touch) stay in the node's memory.
+
+   When the pool has been stopped, push_data() parses the stream in the calling thread.
+
+   add_stream(), push_data() and remove_stream() for the same stream must not be called
+   concurrently. Different streams may be fed from different threads.
+ */
+
+class stream_handler
+{
+public:
+  virtual ~stream_handler() { }
+
+  // The NAL is freed when the call returns.
+  virtual void on_NAL(int stream_id, const NAL_unit* nal, parse_context* ctx) = 0;
+
+  virtual void on_end_of_stream(int stream_id) { }
+};
+
+
+#define P265_MUX_CHUNKS_PER_RUN 16
+
+
+class stream_multiplexer
+{
+ public:
+  /* 'max_streams' is the number of stream ids. If 'pool' is NULL, the shared thread pool
+     is used. */
+  LIBP265_API explicit stream_multiplexer(int max_streams, thread_pool* pool = NULL);
+
+  // Streams are distributed over the NUMA nodes. The pools have to outlive the multiplexer.
+  LIBP265_API stream_multiplexer(int max_streams, numa_thread_pools* pools);
+
+  LIBP265_API ~stream_multiplexer();
+
+  /* Returns the stream id, or -1 if all ids are in use. The handler may be NULL (completion queue).
+     'node' selects the NUMA node (index into numa_thread_pools), -1 takes the node with the
+     fewest streams. */
+  LIBP265_API int  add_stream(stream_handler* handler = NULL, int node = -1);
+
+  // Waits until the stream is idle and frees it. Undelivered NALs are discarded.
+  LIBP265_API void remove_stream(int stream_id);
+
+
+  // --- input ---
+
+  // The input functions return P265_ERROR_NO_SUCH_STREAM for an unknown or removed stream id.
+
+  // byte-stream data
+  LIBP265_API P265_error push_data(int stream_id, const unsigned char* data, int len, P265_PTS pts);
+
+  // a single NAL without start code
+  LIBP265_API P265_error push_NAL(int stream_id, const unsigned char* data, int len, P265_PTS pts);
+
+  // Flush the stream's pending data and notify the handler.
+  LIBP265_API P265_error push_end_of_stream(int stream_id);
+
+
+  // --- completion queue (streams without handler) ---
+
+  // Next parsed NAL of the stream or NULL. Return it with free_NAL().
+  LIBP265_API NAL_unit* pop_NAL(int stream_id);
+  LIBP265_API void      free_NAL(int stream_id, NAL_unit* nal);
+
+  // Whether the end of stream has been delivered through the completion queue.
+  LIBP265_API bool      is_end_of_stream(int stream_id);
+
+
+  // --- state ---
+
+  // Wait until all queued input of the stream has been parsed. The calling thread helps the pool.
+  LIBP265_API void wait_idle(int stream_id);
+
+  // The stream's context, e.g. to read its diagnostics. Valid until remove_stream().
+  LIBP265_API parse_context* get_context(int stream_id);
+
+  // Node (pool index) the stream is pinned to.
+  LIBP265_API int get_stream_node(int stream_id) const;
+
+  LIBP265_API int64_t get_bytes_queued(int stream_id) const;
+  uint64_t get_num_NALs() const { return num_NALs.load(std::memory_order_relaxed); }
+  int get_max_streams() const { return max_streams; }
+
+ private:
+  struct chunk {
+    std::vector<unsigned char> data;
+    P265_PTS pts;
+    enum chunk_kind { byte_stream, single_NAL, end_of_stream } kind;
+  };
+
+  struct stream;
+
+  class stream_task : public thread_task
+  {
+  public:
+    stream_multiplexer* mux;
+    stream* s;
+
+    virtual void work() { mux->process_stream(s); }
+    virtual std::string name() const { return "stream"; }
+  };
+
+  struct stream {
+    int id;
+    stream_handler* handler;
+
+    int node;
+    thread_pool* pool;
+
+    NAL_Parser parser;  // only accessed by the stream's task
+    parse_context ctx;
+
+    P265_mutex mutex;   // protects the following queues
+    std::deque<chunk*> input;
+    std::vector<chunk*> spare_chunks;
+    std::deque<NAL_unit*> output;     // completion queue
+    std::vector<NAL_unit*> returned;  // NALs given back with free_NAL()
+    bool end_of_stream_delivered;
+    int64_t bytes_queued;
+
+    std::atomic<bool> scheduled;
+    stream_task task;
+  };
+
+  int max_streams;
+
+  std::vector<thread_pool*> pools;  // one per node
+  std::unique_ptr<std::atomic<int>[]> streams_per_pool;
+
+  std::unique_ptr<std::atomic<stream*>[]> streams;
+
+  P265_mutex id_mutex;
+  std::vector<int> free_ids;
+
+  std::atomic<uint64_t> num_NALs;
+
+  void init(int max_streams);
+  stream* alloc_stream(thread_pool* pool);
+  void wait_unscheduled(stream*);
+
+  stream* get_stream(int stream_id) const;
+  P265_error enqueue(int stream_id, const unsigned char* data, int len, P265_PTS pts, chunk::chunk_kind kind);
+  void process_stream(stream*);
+  void deliver_NALs(stream*);
+
+  stream_multiplexer(const stream_multiplexer&) = delete;
+  stream_multiplexer& operator=(const stream_multiplexer&) = delete;
+};
+
+END_NAMESPACE_LIBP265
+
+#endif
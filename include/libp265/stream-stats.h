@@ -0,0 +1,156 @@
+/*
+ * H.265 video codec parser.
+ * Copyright (c) 2023 John Willard <john.willard@shotover.com>
+ *
+ * This file is part of libp265.
+ *
+ * libp265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libp265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libp265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBP265_STREAM_STATS_H
+#define LIBP265_STREAM_STATS_H
+
+#include "libp265/libp265.h"
+#include "libp265/nal-parser.h"
+
+#include <atomic>
+#include <vector>
+
+BEGIN_NAMESPACE_LIBP265
+
+#define P265_NUM_NAL_TYPES 64
+#define P265_MAX_TEMPORAL_LAYERS 7
+
+/* Statistics of a stream. All sizes are NAL unit sizes in bytes, including the
+   NAL header and the emulation prevention bytes, but without start codes.
+   Times are in PTS units. */
+struct stream_stats_snapshot
+{
+  int64_t sequence;        // increased with every published snapshot
+  P265_PTS pts;            // stream time of the snapshot
+
+  int64_t nal_count[P265_NUM_NAL_TYPES];   // see get_NAL_name()
+  int64_t nal_bytes[P265_NUM_NAL_TYPES];
+
+  int64_t temporal_layer_count[P265_MAX_TEMPORAL_LAYERS];  // all NALs, by TemporalId
+  int64_t temporal_layer_bytes[P265_MAX_TEMPORAL_LAYERS];
+
+  // access units
+  int64_t au_count;
+  int64_t au_bytes;
+  int64_t last_au_bytes;
+  int64_t max_au_bytes;
+
+  // GOPs (from one IRAP access unit to the next)
+  int64_t gop_count;             // completed GOPs
+  int64_t last_gop_bytes;
+  int64_t last_gop_pictures;
+  int64_t current_gop_bytes;
+  int64_t current_gop_pictures;
+
+  // IRAP intervals
+  int64_t irap_count;
+  int64_t last_irap_interval;    // in access units
+  int64_t min_irap_interval;
+  int64_t max_irap_interval;
+  int64_t last_irap_interval_pts;
+
+  // bitrates in bits/s (0 if unknown)
+  int64_t instant_bitrate;       // size of the last AU / time since the previous AU
+  int64_t window_bitrate;        // over the bitrate window
+
+  LIBP265_API void clear();
+
+  // Add the counters of another stream (e.g. from another thread).
+  // Sizes, counts and bitrates are summed up, maxima are combined.
+  LIBP265_API void accumulate(const stream_stats_snapshot& other);
+};
+
+
+/* Statistics stage for the NAL_Parser output. The NALs are only inspected.
+
+   All updates are done by one thread (typically the one parsing the stream) on
+   private counters without synchronization. Snapshots are published periodically
+   (every 'snapshot_interval' PTS units) and can be read lock-free from any thread.
+   For multi-threaded ingest, use one stream_statistics per thread and combine the
+   snapshots with accumulate().
+ */
+class stream_statistics
+{
+ public:
+  LIBP265_API explicit stream_statistics(int64_t pts_per_second = 90000,
+                                         int64_t bitrate_window = 90000,
+                                         int64_t snapshot_interval = 90000);
+
+  LIBP265_API void reset();
+
+
+  // --- writer thread ---
+
+  LIBP265_API void add_NAL(const NAL_unit* nal);
+
+  // Finish the current access unit (end of stream) and publish a snapshot.
+  LIBP265_API void flush();
+
+  // Publish the current counters now.
+  LIBP265_API void publish();
+
+  // The live counters. Only to be used from the writer thread.
+  const stream_stats_snapshot& get_current() const { return stats; }
+
+
+  // --- any thread ---
+
+  // Get the last published snapshot.
+  LIBP265_API void get_snapshot(stream_stats_snapshot* out) const;
+
+ private:
+  int64_t pts_per_second;
+  int64_t bitrate_window;
+  int64_t snapshot_interval;
+
+  stream_stats_snapshot stats;
+
+  // current access unit
+  bool     au_has_vcl;
+  bool     au_irap;
+  int64_t  au_bytes;
+  P265_PTS au_pts;
+
+  bool     have_prev_au;
+  P265_PTS prev_au_pts;
+  bool     have_irap;
+  P265_PTS last_irap_pts;
+  int64_t  aus_since_irap;
+
+  P265_PTS next_snapshot_pts;
+  bool     have_snapshot_pts;
+
+  // AUs in the bitrate window, preallocated ring
+  struct window_entry { P265_PTS pts; int64_t bytes; };
+  std::vector<window_entry> window;
+  int      window_start, window_size;
+  int64_t  window_bytes;
+
+  void finish_access_unit();
+
+  // seqlock protected copy of 'stats', stored as 64-bit words
+  static const int SNAPSHOT_WORDS = sizeof(stream_stats_snapshot) / sizeof(int64_t);
+  std::atomic<uint64_t> published_seq;
+  std::atomic<int64_t>  published[SNAPSHOT_WORDS];
+};
+
+END_NAMESPACE_LIBP265
+
+#endif
@@ -34,6 +34,9 @@
 #include <deque>
 #include <string>
 #include <atomic>
+#include <vector>
+#include <thread>
+#include <limits.h>
 
 #ifndef _WIN32
 #include <pthread.h>
@@ -77,6 +80,16 @@ void P265_cond_wait(P265_cond* c,P265_mutex* m);
 void P265_cond_signal(P265_cond* c);
 
 
+/* Progress counter that threads can wait on.
+
+   The counter is an atomic integer, updating it does not take a lock. A waiter first spins
+   for a short time and then parks (futex on Linux, condition variable elsewhere). Parked
+   waiters register the progress they wait for, and updates only wake them (and take the
+   registry lock) when the new progress reaches the lowest registered value.
+ */
+
+#define P265_PROGRESS_SPIN_COUNT 2000
+
 class P265_progress_lock
 {
 public:
@@ -86,66 +99,277 @@ public:
   void wait_for_progress(int progress);
   void set_progress(int progress);
   void increase_progress(int progress);
-  int  get_progress() const;
-  void reset(int value=0) { mProgress=value; }
+  int  get_progress() const { return mProgress.load(std::memory_order_acquire); }
+  void reset(int value=0) { mProgress.store(value, std::memory_order_release); }
 
 private:
-  int mProgress;
+  std::atomic<int> mProgress;
+
+  // lowest progress a parked thread waits for, INT_MAX if none is parked
+  std::atomic<int> mMinWaiting;
+
+  std::vector<int> mWaiting; // progress each parked thread waits for (under 'mutex')
+
+  void wake_waiters(int progress);
+  void update_min_waiting(int progress);
 
   // private data
 
   P265_mutex mutex;
+#ifndef __linux__
   P265_cond  cond;
+#endif
 };
 
 
 
+enum thread_task_priority {
+  thread_task_priority_high   = 0,
+  thread_task_priority_normal = 1,
+  thread_task_priority_low    = 2
+};
+
+#define P265_NUM_TASK_PRIORITIES 3
+
+
 class thread_task
 {
 public:
-  thread_task() : state(Queued) { }
+  thread_task() : state(Queued), priority(thread_task_priority_normal) { }
   virtual ~thread_task() { }
 
   enum { Queued, Running, Blocked, Finished } state;
 
+  enum thread_task_priority priority;
+
+  /* The pool does not access the task anymore once work() has been called,
+     so the task may delete itself (or be destroyed by another thread) at its end. */
   virtual void work() = 0;
 
   virtual std::string name() const { return "noname"; }
 };
 
 
-#define MAX_THREADS 32
+/* Chase-Lev work-stealing deque of tasks.
+   Only the owning thread may push() and pop() (at the bottom end), any thread may steal()
+   (from the top end). The buffer grows as needed, old buffers are kept until destruction
+   because concurrent thieves may still read from them.
+ */
 
-/* TODO NOTE: When unblocking a task, we have to check first
-   if there are threads waiting because of the run-count limit.
-   If there are higher-priority tasks, those should be run instead
-   of the just unblocked task.
+class task_deque
+{
+ public:
+  task_deque();
+  ~task_deque();
+
+  void push(thread_task* task);  // owner only
+  thread_task* pop();            // owner only, NULL if empty
+  thread_task* steal();          // NULL if empty or lost a race against another thread
+
+  bool empty() const {
+    return bottom.load(std::memory_order_relaxed) <= top.load(std::memory_order_relaxed);
+  }
+
+ private:
+  struct buffer {
+    int64_t size; // power of two
+    std::atomic<thread_task*>* tasks;
+
+    thread_task* get(int64_t i) const { return tasks[i & (size-1)].load(std::memory_order_relaxed); }
+    void put(int64_t i, thread_task* t) { tasks[i & (size-1)].store(t, std::memory_order_relaxed); }
+  };
+
+  // top and bottom in separate cache lines (padding instead of alignas, because the
+  // workers are allocated with operator new)
+  std::atomic<int64_t> top;
+  char pad0[64];
+  std::atomic<int64_t> bottom;
+  char pad1[64];
+  std::atomic<buffer*> array;
+
+  std::vector<buffer*> retired; // owner only
+
+  task_deque(const task_deque&) = delete;
+  task_deque& operator=(const task_deque&) = delete;
+};
+
+
+/* Work-stealing thread pool.
+
+   Each worker has its own deque for each priority. Tasks added from within a task go to
+   the deque of the executing worker, tasks added from other threads go to a shared inbox.
+   An idle worker takes the highest-priority task it can find, in this order: own deque,
+   inbox, other workers' deques (stealing, starting at a random victim).
+   Hence, a task of lower priority is only started when no higher-priority task is visible.
  */
 
+struct thread_pool_worker
+{
+  task_deque deques[P265_NUM_TASK_PRIORITIES];
+
+  P265_thread thread;
+  class thread_pool* pool;
+  int index;
+  uint32_t random_state; // for victim selection
+};
+
+
 class thread_pool
 {
  public:
-  bool stopped;
+  thread_pool();
+  ~thread_pool();
 
-  std::deque<thread_task*> tasks;  // we are not the owner
+  bool stopped;
 
-  P265_thread thread[MAX_THREADS];
+  std::vector<thread_pool_worker*> workers;
   int num_threads;
 
-  int num_threads_working;
+  std::atomic<int> num_threads_working;
+
+  // tasks from threads outside of the pool
 
-  int ctbx[MAX_THREADS]; // the CTB the thread is working on
-  int ctby[MAX_THREADS];
+  std::deque<thread_task*> inbox[P265_NUM_TASK_PRIORITIES];  // we are not the owner
+  std::atomic<int> inbox_size;
+
+  // sleeping workers
+
+  std::atomic<int> num_tasks_queued;
+  std::atomic<int> num_threads_sleeping;
 
   P265_mutex  mutex;
   P265_cond   cond_var;
+
+  // CPUs the workers are bound to (empty: no binding)
+
+  std::vector<int> cpus;
+  int numa_node; // -1 if not bound to a node
+
+ private:
+  thread_pool(const thread_pool&) = delete;
+  thread_pool& operator=(const thread_pool&) = delete;
 };
 
 
-P265_error start_thread_pool(thread_pool* pool, int num_threads);
-void        stop_thread_pool(thread_pool* pool); // do not process remaining tasks
+LIBP265_API P265_error start_thread_pool(thread_pool* pool, int num_threads);
+
+/* Start a pool whose workers may only run on the given CPUs. On systems without thread
+   affinity support, the CPU list is ignored. */
+LIBP265_API P265_error start_thread_pool(thread_pool* pool, int num_threads,
+                                         const std::vector<int>& cpus);
+LIBP265_API void       stop_thread_pool(thread_pool* pool); // do not process remaining tasks
+
+/* Returns false if the pool has been stopped, the task is not queued then.
+   Tasks added from a worker of the same pool go to its own deque and are usually run
+   next by that worker (LIFO). */
+LIBP265_API bool       add_task(thread_pool* pool, thread_task* task); // TOCO: can make thread_task const
+
+/* Queue the task behind the tasks that are already pending in the pool, also when called
+   from a worker. For tasks that requeue themselves to let other tasks run first. */
+LIBP265_API bool       add_task_fifo(thread_pool* pool, thread_task* task);
+
+/* Execute one queued task in the calling thread, if there is one.
+   Returns false when no task was found. */
+LIBP265_API bool       run_pending_task(thread_pool* pool);
+
+// True when called from one of the pool's worker threads.
+LIBP265_API bool       is_worker_of(const thread_pool* pool);
+
+/* Pool with one worker per CPU core, started at the first call and shared by the whole
+   library (e.g. for picture hash computation). */
+LIBP265_API thread_pool* get_shared_thread_pool();
+
+
+// --- NUMA ---
+
+/* Number of NUMA nodes (from /sys/devices/system/node on Linux). Returns 1 when the
+   topology is not known. */
+LIBP265_API int  get_numa_node_count();
+
+// CPUs of a NUMA node. Returns false if the node does not exist.
+LIBP265_API bool get_numa_node_cpus(int node, std::vector<int>* cpus);
+
+
+/* One thread pool per NUMA node, with the workers bound to the node's CPUs.
+
+   Memory is placed by the kernel's first-touch policy, hence data that is allocated and
+   first written by a task of a node's pool stays on that node. The stream multiplexer
+   uses this to keep a stream's parser state and NAL buffers local.
+ */
 
-void        add_task(thread_pool* pool, thread_task* task); // TOCO: can make thread_task const
+class numa_thread_pools
+{
+ public:
+  numa_thread_pools() { }
+  ~numa_thread_pools() { stop(); }
+
+  // 'threads_per_node' = 0 starts one worker per CPU of the node.
+  LIBP265_API P265_error start(int threads_per_node = 0);
+  LIBP265_API void stop();
+
+  int num_nodes() const { return static_cast<int>(pools.size()); }
+  thread_pool* get_pool(int node) { return pools[node]; }
+
+ private:
+  std::vector<thread_pool*> pools;
+
+  numa_thread_pools(const numa_thread_pools&) = delete;
+  numa_thread_pools& operator=(const numa_thread_pools&) = delete;
+};
+
+
+/* Run f(i) for i in [0,n) on the pool and return when all calls have finished.
+   The calling thread takes part in the work, hence this may also be called from within
+   a task without deadlocking. */
+
+template <class F> class parallel_for_task : public thread_task
+{
+public:
+  F* f;
+  int i;
+  std::atomic<int>* remaining;
+
+  virtual void work() {
+    (*f)(i);
+    remaining->fetch_sub(1, std::memory_order_release);
+  }
+};
+
+template <class F> void parallel_for(thread_pool* pool, int n, F f,
+                                     enum thread_task_priority priority = thread_task_priority_normal)
+{
+  if (n<=0) {
+    return;
+  }
+
+  if (pool==NULL || pool->num_threads==0 || n<=1) {
+    for (int i=0;i<n;i++) { f(i); }
+    return;
+  }
+
+  std::atomic<int> remaining(n-1);
+  std::vector<parallel_for_task<F> > tasks(n-1);
+
+  for (int i=1;i<n;i++) {
+    parallel_for_task<F>& t = tasks[i-1];
+    t.f = &f;
+    t.i = i;
+    t.remaining = &remaining;
+    t.priority = priority;
+
+    if (!add_task(pool, &t)) {
+      t.work(); // pool has been stopped
+    }
+  }
+
+  f(0);
+
+  while (remaining.load(std::memory_order_acquire) > 0) {
+    if (!run_pending_task(pool)) {
+      std::this_thread::yield();
+    }
+  }
+}
 
 END_NAMESPACE_LIBP265
 
@@ -92,7 +92,7 @@ public:
   //bool sub_layer_profile_present[MAX_TEMPORAL_SUBLAYERS];
   //bool sub_layer_level_present[MAX_TEMPORAL_SUBLAYERS];
 
-  profile_data sub_layer[MAX_TEMPORAL_SUBLAYERS];
+  std::vector<profile_data> sub_layer; // [max_sub_layers-1]
 };
 
 
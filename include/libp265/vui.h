@@ -25,6 +25,7 @@
 #include "libp265/bitstream.h"
 
 #include <vector>
+#include <memory>
 
 BEGIN_NAMESPACE_LIBP265
 
@@ -44,12 +45,84 @@ enum VideoFormat {
 const char* get_video_format_name(enum VideoFormat);
 
 
+#define MAX_HRD_CPB_CNT 32
+
+
+/* Common part of hrd_parameters() (E.2.2). This is always decoded, as the
+   length fields are needed to parse the buffering period and picture timing SEIs.
+ */
+struct hrd_common_info
+{
+  bool     nal_hrd_parameters_present_flag;
+  bool     vcl_hrd_parameters_present_flag;
+  bool     sub_pic_hrd_params_present_flag;
+  uint8_t  tick_divisor_minus2;
+  uint8_t  du_cpb_removal_delay_increment_length_minus1;
+  bool     sub_pic_cpb_params_in_pic_timing_sei_flag;
+  uint8_t  dpb_output_delay_du_length_minus1;
+  uint8_t  bit_rate_scale;
+  uint8_t  cpb_size_scale;
+  uint8_t  cpb_size_du_scale;
+  uint8_t  initial_cpb_removal_delay_length_minus1;
+  uint8_t  au_cpb_removal_delay_length_minus1;
+  uint8_t  dpb_output_delay_length_minus1;
+};
+
+
+/* sub_layer_hrd_parameters() for one CPB specification (E.2.3) */
+struct hrd_cpb_spec
+{
+  uint32_t bit_rate_value_minus1;
+  uint32_t cpb_size_value_minus1;
+  uint32_t cpb_size_du_value_minus1;
+  uint32_t bit_rate_du_value_minus1;
+  bool     cbr_flag;
+};
+
+
+struct hrd_sub_layer
+{
+  bool     fixed_pic_rate_general_flag;
+  bool     fixed_pic_rate_within_cvs_flag;
+  bool     low_delay_hrd_flag;
+  uint32_t elemental_duration_in_tc_minus1;
+  uint32_t cpb_cnt_minus1;
+
+  // Only contain the entries that are coded: empty if the NAL (VCL) HRD is not present,
+  // otherwise cpb_cnt_minus1+1 entries.
+  std::vector<hrd_cpb_spec> nal_cpb;
+  std::vector<hrd_cpb_spec> vcl_cpb;
+
+  const std::vector<hrd_cpb_spec>& cpb(int nalOrVcl) const { return nalOrVcl==0 ? nal_cpb : vcl_cpb; }
+};
+
+
+class hrd_parameters
+{
+ public:
+  LIBP265_API hrd_parameters();
+
+  LIBP265_API P265_error read(error_queue*, bitreader*, bool commonInfPresentFlag, int maxNumSubLayers);
+  LIBP265_API void dump(int fd) const;
+
+  // BitRate[i] and CpbSize[i] (E.3.3) in bits/s and bits
+  int64_t get_bit_rate(int subLayer, int cpb, int nalOrVcl) const {
+    return ((int64_t)sub_layers[subLayer].cpb(nalOrVcl)[cpb].bit_rate_value_minus1+1) << (6+common.bit_rate_scale);
+  }
+  int64_t get_cpb_size(int subLayer, int cpb, int nalOrVcl) const {
+    return ((int64_t)sub_layers[subLayer].cpb(nalOrVcl)[cpb].cpb_size_value_minus1+1) << (4+common.cpb_size_scale);
+  }
+
+  hrd_common_info common;
+  std::vector<hrd_sub_layer> sub_layers;
+};
+
+
 class video_usability_information
 {
  public:
   LIBP265_API video_usability_information();
-  
-  LIBP265_API P265_error hrd_parameters(error_queue*, bitreader*, const seq_parameter_set*);
+
   LIBP265_API P265_error read(error_queue*, bitreader*, const seq_parameter_set*);
   LIBP265_API void dump(int fd) const;
 
@@ -109,30 +182,21 @@ class video_usability_information
   // --- hrd parameters ---
 
   bool     vui_hrd_parameters_present_flag;
-  bool     nal_hrd_parameters_present_flag;
-  bool     vcl_hrd_parameters_present_flag;
-  bool     sub_pic_hrd_params_present_flag;
-  uint32_t tick_divisor_minus2;
-  uint32_t du_cpb_removal_delay_increment_length_minus1;
-  bool     sub_pic_cpb_params_in_pic_timing_sei_flag;
-  uint32_t dpb_output_delay_du_length_minus1;
-  uint32_t bit_rate_scale;
-  uint32_t cpb_size_scale;
-  uint32_t cpb_size_du_scale;
-  uint32_t initial_cpb_removal_delay_length_minus1;
-  uint32_t au_cpb_removal_delay_length_minus1;
-  uint32_t dpb_output_delay_length_minus1;
-  bool     fixed_pic_rate_general_flag[7];
-  bool     fixed_pic_rate_within_cvs_flag[7];
-  bool     low_delay_hrd_flag[7];
-  uint32_t cpb_cnt_minus1[7];
-  uint32_t elemental_duration_in_tc_minus1[7];
-  uint32_t bit_rate_value_minus1[7][32][2];
-  uint32_t cpb_size_value_minus1[7][32][2];
-  uint32_t cpb_size_du_value_minus1[7][32][2];
-  uint32_t bit_rate_du_value_minus1[7][32][2];
-  bool     cbr_flag[7][32][2];
-  
+  hrd_common_info hrd_common;
+
+  /* When set (the default), read() only walks over the sub-layer HRD parameters
+     and keeps a copy of their raw bits. They are decoded on the first call to
+     get_hrd_parameters(). This keeps an SPS small, as the HRD parameters are
+     rarely needed. Set to false before read() to decode them immediately.
+   */
+  bool     lazy_hrd_parsing;
+
+  // Returns NULL if there are no HRD parameters. Thread-safe.
+  LIBP265_API std::shared_ptr<const hrd_parameters> get_hrd_parameters() const;
+
+  // Decode the HRD parameters into 'out' without caching them in this object.
+  LIBP265_API bool decode_hrd_parameters(hrd_parameters* out) const;
+
   // --- bitstream restriction ---
 
   bool bitstream_restriction_flag;
@@ -144,6 +208,14 @@ class video_usability_information
   uint8_t  max_bits_per_min_cu_denom;
   uint8_t  log2_max_mv_length_horizontal;
   uint8_t  log2_max_mv_length_vertical;
+
+ private:
+  mutable std::shared_ptr<const hrd_parameters> hrd; // only accessed atomically
+
+  // raw bits of hrd_parameters() for lazy decoding
+  std::vector<uint8_t> hrd_raw;
+  uint8_t hrd_raw_bit_offset;
+  uint8_t hrd_max_sub_layers;
 };
 
 END_NAMESPACE_LIBP265
@@ -19,65 +19,425 @@
  */
 
 #include "libp265/context.h"
+#include "libp265/nal-parser.h"
+#include "libp265/snapshot.h"
 
-#include <cstring>
 
 BEGIN_NAMESPACE_LIBP265
 
+/* Map an error code to a slot in the per-code tables.
+   Errors 0-99 -> 0-99, errors 500-599 -> 100-199, warnings 1000-1182 -> 200-382,
+   all other codes share the last slot. */
+static int error_code_slot(P265_error code)
+{
+  int c = code;
+  if (c >= 0 && c < 100)        { return c; }
+  if (c >= 500 && c < 600)      { return 100 + c - 500; }
+  if (c >= 1000 && c < 1000+P265_ERROR_CODE_SLOTS-201) { return 200 + c - 1000; }
+  return P265_ERROR_CODE_SLOTS-1;
+}
+
+
+error_queue::error_queue()
+{
+  for (int i=0;i<MAX_WARNINGS;i++) {
+    warnings[i].sequence.store(i, std::memory_order_relaxed);
+    warnings[i].code = P265_OK;
+  }
+
+  enqueue_pos.store(0, std::memory_order_relaxed);
+  dequeue_pos.store(0, std::memory_order_relaxed);
+  overflow.store(false, std::memory_order_relaxed);
+  dropped.store(0, std::memory_order_relaxed);
+
+  for (int i=0;i<P265_ERROR_CODE_SLOTS/64;i++) {
+    shown[i].store(0, std::memory_order_relaxed);
+  }
+
+  for (int i=0;i<P265_ERROR_CODE_SLOTS;i++) {
+    counts[i].store(0, std::memory_order_relaxed);
+  }
+
+  for (int i=0;i<64;i++) {
+    nal_type_counts[i].store(0, std::memory_order_relaxed);
+  }
+
+  for (int i=0;i<MAX_DIAGNOSTICS;i++) {
+    diagnostics[i].sequence.store(0, std::memory_order_relaxed);
+    for (int k=0;k<4;k++) {
+      diagnostics[i].words[k].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  diag_write_pos.store(0, std::memory_order_relaxed);
+
+  clear_location();
+}
+
+
+void error_queue::set_location(int64_t stream_offset, int64_t nal_index, int nal_unit_type)
+{
+  loc_stream_offset.store(stream_offset, std::memory_order_relaxed);
+  loc_nal_index.store(nal_index, std::memory_order_relaxed);
+  loc_nal_unit_type.store(nal_unit_type, std::memory_order_relaxed);
+}
+
+
+void error_queue::set_location(const NAL_unit* nal)
+{
+  int type = (nal->fragment > 1 ? nal->header.nal_unit_type :
+              nal->size() > 0 ? (nal->data()[0] >> 1) & 0x3F : -1);
+  set_location(nal->stream_offset, nal->nal_index, type);
+}
+
+
 void error_queue::add_warning(P265_error warning, bool once)
 {
-  // check if warning was already shown
-  bool add=true;
+  add_diagnostic(warning, NULL, -1, once);
+}
+
+
+void error_queue::add_diagnostic(P265_error code, const char* syntax_element,
+                                 int parameter_set_id, bool once)
+{
+  int slot = error_code_slot(code);
+  counts[slot].fetch_add(1, std::memory_order_relaxed);
+
+
+  // --- store diagnostic event ---
+
+  diagnostic_event ev;
+  ev.code = code;
+  ev.stream_offset = loc_stream_offset.load(std::memory_order_relaxed);
+  ev.nal_index     = loc_nal_index.load(std::memory_order_relaxed);
+  ev.nal_unit_type = loc_nal_unit_type.load(std::memory_order_relaxed);
+  ev.parameter_set_id = parameter_set_id;
+  ev.syntax_element   = syntax_element;
+
+  if (ev.nal_unit_type >= 0) {
+    nal_type_counts[ev.nal_unit_type & 63].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  uint64_t n = diag_write_pos.fetch_add(1, std::memory_order_relaxed);
+  diag_slot& ds = diagnostics[n & (MAX_DIAGNOSTICS-1)];
+
+  ds.sequence.store(2*n+1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  ds.words[0].store(((uint64_t)(uint32_t)ev.code) |
+                    ((uint64_t)(uint16_t)ev.nal_unit_type << 32) |
+                    ((uint64_t)(uint16_t)ev.parameter_set_id << 48), std::memory_order_relaxed);
+  ds.words[1].store((uint64_t)ev.stream_offset, std::memory_order_relaxed);
+  ds.words[2].store((uint64_t)ev.nal_index, std::memory_order_relaxed);
+  ds.words[3].store((uint64_t)(uintptr_t)ev.syntax_element, std::memory_order_relaxed);
+
+  ds.sequence.store(2*n+2, std::memory_order_release);
+
+
+  // check if warning was already shown, and remember that it is shown now
+
   if (once) {
-    for (int i=0;i<nWarningsShown;i++) {
-      if (warnings_shown[i] == warning) {
-        add=false;
+    uint64_t bit = UINT64_C(1) << (slot & 63);
+    if (shown[slot>>6].fetch_or(bit, std::memory_order_relaxed) & bit) {
+      return;
+    }
+  }
+
+  queue_warning(code);
+}
+
+
+int error_queue::get_diagnostics(diagnostic_event* out, int maxEvents, uint64_t* cursor) const
+{
+  uint64_t end = diag_write_pos.load(std::memory_order_acquire);
+  uint64_t n = *cursor;
+
+  if (end - n > MAX_DIAGNOSTICS) {
+    n = end - MAX_DIAGNOSTICS;
+  }
+
+  int nOut = 0;
+
+  for ( ; n < end && nOut < maxEvents ; n++) {
+    const diag_slot& ds = diagnostics[n & (MAX_DIAGNOSTICS-1)];
+
+    uint64_t seq = ds.sequence.load(std::memory_order_acquire);
+    if (seq < 2*n+2) {
+      break;     // still being written
+    }
+    if (seq != 2*n+2) {
+      continue;  // already overwritten
+    }
+
+    uint64_t w[4];
+    for (int k=0;k<4;k++) {
+      w[k] = ds.words[k].load(std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (ds.sequence.load(std::memory_order_relaxed) != seq) {
+      continue;  // overwritten while reading
+    }
+
+    diagnostic_event& ev = out[nOut++];
+    ev.code             = (P265_error)(int32_t)(uint32_t)w[0];
+    ev.nal_unit_type    = (int16_t)(uint16_t)(w[0] >> 32);
+    ev.parameter_set_id = (int16_t)(uint16_t)(w[0] >> 48);
+    ev.stream_offset    = (int64_t)w[1];
+    ev.nal_index        = (int64_t)w[2];
+    ev.syntax_element   = (const char*)(uintptr_t)w[3];
+  }
+
+  *cursor = n;
+  return nOut;
+}
+
+
+void error_queue::queue_warning(P265_error warning)
+{
+  // add warning to output queue (bounded MPMC ring, D. Vyukov)
+
+  uint32_t pos = enqueue_pos.load(std::memory_order_relaxed);
+  cell* c;
+
+  for (;;) {
+    c = &warnings[pos & (MAX_WARNINGS-1)];
+    uint32_t seq = c->sequence.load(std::memory_order_acquire);
+    int32_t diff = (int32_t)(seq - pos);
+
+    if (diff == 0) {
+      if (enqueue_pos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
         break;
       }
     }
+    else if (diff < 0) {
+      // queue is full
+      overflow.store(true, std::memory_order_relaxed);
+      dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    else {
+      pos = enqueue_pos.load(std::memory_order_relaxed);
+    }
   }
 
-  if (!add) {
-    return;
-  }
+  c->code = warning;
+  c->sequence.store(pos+1, std::memory_order_release);
+}
+
 
+P265_error error_queue::get_warning()
+{
+  uint32_t pos = dequeue_pos.load(std::memory_order_relaxed);
+  cell* c;
 
-  // if this is a one-time warning, remember that it was shown
+  for (;;) {
+    c = &warnings[pos & (MAX_WARNINGS-1)];
+    uint32_t seq = c->sequence.load(std::memory_order_acquire);
+    int32_t diff = (int32_t)(seq - (pos+1));
 
-  if (once) {
-    if (nWarningsShown < MAX_WARNINGS) {
-      warnings_shown[nWarningsShown++] = warning;
+    if (diff == 0) {
+      if (dequeue_pos.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) {
+        break;
+      }
+    }
+    else if (diff < 0) {
+      // queue is empty, report lost warnings
+      if (overflow.exchange(false, std::memory_order_relaxed)) {
+        return P265_WARNING_WARNING_BUFFER_FULL;
+      }
+
+      return P265_OK;
+    }
+    else {
+      pos = dequeue_pos.load(std::memory_order_relaxed);
     }
   }
 
+  P265_error warn = c->code;
+  c->sequence.store(pos + MAX_WARNINGS, std::memory_order_release);
+
+  return warn;
+}
+
+
+uint32_t error_queue::get_warning_count(P265_error code) const
+{
+  return counts[error_code_slot(code)].load(std::memory_order_relaxed);
+}
 
-  // add warning to output queue
 
-  if (nWarnings == MAX_WARNINGS) {
-    warnings[MAX_WARNINGS-1] = P265_WARNING_WARNING_BUFFER_FULL;
-    return;
+
+parse_context::parse_context()
+{
+  current = std::make_shared<const parameter_set_snapshot>();
+}
+
+
+template <class Modifier> void parse_context::publish(Modifier modify)
+{
+  std::shared_ptr<const parameter_set_snapshot> expected = std::atomic_load(&current);
+
+  for (;;) {
+    std::shared_ptr<parameter_set_snapshot> next = std::make_shared<parameter_set_snapshot>(*expected);
+    next->epoch = expected->epoch + 1;
+    modify(*next);
+
+    // If another thread published in between, 'expected' is reloaded and we retry on top of it.
+
+    std::shared_ptr<const parameter_set_snapshot> desired = next;
+    if (std::atomic_compare_exchange_weak(&current, &expected, desired)) {
+      break;
+    }
   }
+}
+
 
-  warnings[nWarnings++] = warning;
+void parse_context::set_vps(int id, std::shared_ptr<video_parameter_set> vps)
+{
+  publish([&](parameter_set_snapshot& s) { s.vps[id] = vps; s.vps_NAL[id].reset(); });
 }
 
-error_queue::error_queue()
+void parse_context::set_sps(int id, std::shared_ptr<seq_parameter_set> sps)
 {
-  nWarnings = 0;
-  nWarningsShown = 0;
+  publish([&](parameter_set_snapshot& s) { s.sps[id] = sps; s.sps_NAL[id].reset(); });
 }
 
-P265_error error_queue::get_warning()
+void parse_context::set_pps(int id, std::shared_ptr<pic_parameter_set> pps)
 {
-  if (nWarnings==0) {
+  publish([&](parameter_set_snapshot& s) { s.pps[id] = pps; s.pps_NAL[id].reset(); });
+}
+
+
+P265_error parse_context::read_parameter_set_NAL(const NAL_unit* nal)
+{
+  // continuation fragments of VCL NALs have no NAL header
+  if (nal->size() < 2 || nal->fragment > 1) {
     return P265_OK;
   }
 
-  P265_error warn = warnings[0];
-  nWarnings--;
-  memmove(warnings, &warnings[1], nWarnings*sizeof(P265_error));
+  int nal_unit_type = (nal->data()[0] >> 1) & 0x3F;
 
-  return warn;
+  if (nal_unit_type != NAL_UNIT_VPS_NUT &&
+      nal_unit_type != NAL_UNIT_SPS_NUT &&
+      nal_unit_type != NAL_UNIT_PPS_NUT) {
+    return P265_OK;
+  }
+
+  set_location(nal);
+
+  P265_error err = P265_OK;
+
+  bitreader br;
+  bitreader_init(&br, const_cast<unsigned char*>(nal->data()) + 2, (int)nal->size() - 2);
+
+  std::shared_ptr<const std::vector<unsigned char> > raw =
+    std::make_shared<const std::vector<unsigned char> >(nal->data(), nal->data() + nal->size());
+
+  switch (nal_unit_type) {
+  case NAL_UNIT_VPS_NUT:
+    {
+      std::shared_ptr<video_parameter_set> vps = std::make_shared<video_parameter_set>();
+      err = vps->read(this, &br);
+      if (err != P265_OK) {
+        break;
+      }
+
+      int id = vps->video_parameter_set_id;
+      publish([&](parameter_set_snapshot& s) { s.vps[id] = vps; s.vps_NAL[id] = raw; });
+    }
+    break;
+
+  case NAL_UNIT_SPS_NUT:
+    {
+      std::shared_ptr<seq_parameter_set> sps = std::make_shared<seq_parameter_set>();
+      err = sps->read(this, &br);
+      if (err != P265_OK) {
+        break;
+      }
+
+      int id = sps->seq_parameter_set_id;
+      publish([&](parameter_set_snapshot& s) { s.sps[id] = sps; s.sps_NAL[id] = raw; });
+    }
+    break;
+
+  case NAL_UNIT_PPS_NUT:
+    {
+      std::shared_ptr<pic_parameter_set> pps = std::make_shared<pic_parameter_set>();
+      if (!pps->read(&br, this)) {
+        err = P265_WARNING_PPS_HEADER_INVALID;
+        break;
+      }
+
+      int id = pps->pic_parameter_set_id;
+      publish([&](parameter_set_snapshot& s) { s.pps[id] = pps; s.pps_NAL[id] = raw; });
+    }
+    break;
+  }
+
+  // later warnings of the caller must not be attributed to this NAL
+  clear_location();
+
+  return err;
 }
 
+
+P265_error parse_context::save_state(snapshot_writer& w) const
+{
+  std::shared_ptr<const parameter_set_snapshot> s = get_snapshot();
+
+  // Parameter sets that were set without their NAL cannot be stored.
+
+  for (int i=0;i<P265_MAX_VPS_SETS;i++) { if (s->vps[i] && !s->vps_NAL[i]) return P265_ERROR_SNAPSHOT_INCOMPLETE; }
+  for (int i=0;i<P265_MAX_SPS_SETS;i++) { if (s->sps[i] && !s->sps_NAL[i]) return P265_ERROR_SNAPSHOT_INCOMPLETE; }
+  for (int i=0;i<P265_MAX_PPS_SETS;i++) { if (s->pps[i] && !s->pps_NAL[i]) return P265_ERROR_SNAPSHOT_INCOMPLETE; }
+
+  // in the order in which they have to be parsed again
+
+  std::vector<const std::vector<unsigned char>*> nals;
+
+  for (int i=0;i<P265_MAX_VPS_SETS;i++) { if (s->vps_NAL[i]) nals.push_back(s->vps_NAL[i].get()); }
+  for (int i=0;i<P265_MAX_SPS_SETS;i++) { if (s->sps_NAL[i]) nals.push_back(s->sps_NAL[i].get()); }
+  for (int i=0;i<P265_MAX_PPS_SETS;i++) { if (s->pps_NAL[i]) nals.push_back(s->pps_NAL[i].get()); }
+
+  w.put_u32(static_cast<uint32_t>(nals.size()));
+
+  for (const std::vector<unsigned char>* nal : nals) {
+    w.put_u32(static_cast<uint32_t>(nal->size()));
+    w.put_bytes(nal->data(), nal->size());
+  }
+
+  return P265_OK;
+}
+
+
+P265_error parse_context::restore_state(snapshot_reader& r)
+{
+  uint32_t n = r.get_u32();
+
+  NAL_unit nal;
+
+  for (uint32_t i=0; i<n && r.ok(); i++) {
+    uint32_t size = r.get_u32();
+    const unsigned char* data = r.get_bytes(size);
+    if (data == NULL) {
+      break;
+    }
+
+    if (!nal.set_data(data, size)) {
+      return P265_ERROR_OUT_OF_MEMORY;
+    }
+
+    P265_error err = read_parameter_set_NAL(&nal);
+    if (err != P265_OK) {
+      return err;
+    }
+  }
+
+  clear_location();
+
+  return r.ok() ? P265_OK : P265_ERROR_PARAMETER_PARSING;
+}
+
+
 END_NAMESPACE_LIBP265
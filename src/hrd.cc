@@ -0,0 +1,470 @@
+/*
+ * H.265 video codec parser.
+ * Copyright (c) 2023 John Willard <john.willard@shotover.com>
+ *
+ * This file is part of libp265.
+ *
+ * libp265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libp265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libp265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libp265/hrd.h"
+#include "libp265/vui.h"
+
+#include <math.h>
+#include <algorithm>
+
+BEGIN_NAMESPACE_LIBP265
+
+#define HRD_CLOCK 90000.0
+
+// tolerance for comparing times that are computed with different rounding
+#define HRD_TIME_EPSILON 1e-9
+
+
+hrd_simulator::hrd_simulator(int _nalOrVcl, int _schedSelIdx)
+  : nalOrVcl(_nalOrVcl),
+    schedSelIdx(_schedSelIdx)
+{
+  reset();
+}
+
+
+void hrd_simulator::reset()
+{
+  initialized = false;
+  tc = 0;
+  bit_rate = 0;
+  cpb_size = 0;
+  cbr = false;
+  low_delay = false;
+  dpb_size = 0;
+
+  au_count = 0;
+  num_underflows = 0;
+  num_overflows = 0;
+  num_dpb_overflows = 0;
+
+  prev_final_arrival = 0;
+  prev_nominal_removal = 0;
+  prev_non_discardable_removal = 0;
+  bp_nominal_removal = 0;
+  prev_au_cpb_removal_delay_minus1 = -1;
+  au_cpb_removal_delay_msb = 0;
+  init_cpb_removal_delay = 0;
+  init_cpb_removal_offset = 0;
+
+  cpb.clear();
+  cpb_bits = 0;
+  dpb_output_times.clear();
+
+  active_sps.reset();
+  start_access_unit();
+}
+
+
+bool hrd_simulator::configure(const seq_parameter_set* sps)
+{
+  if (sps==NULL) {
+    return false;
+  }
+
+  const video_usability_information& vui = sps->get_vui();
+  if (!vui.vui_hrd_parameters_present_flag ||
+      !vui.vui_timing_info_present_flag ||
+      vui.vui_time_scale == 0) {
+    return false;
+  }
+
+  std::shared_ptr<const hrd_parameters> params = vui.get_hrd_parameters();
+  if (!params || params->sub_layers.empty()) {
+    return false;
+  }
+
+  int tid = std::min<int>(sps->sps_max_sub_layers, params->sub_layers.size()) - 1;
+  const hrd_sub_layer& layer = params->sub_layers[tid];
+  if (schedSelIdx >= (int)layer.cpb(nalOrVcl).size()) {
+    return false;
+  }
+
+  tc        = vui.vui_num_units_in_tick / (double)vui.vui_time_scale;
+  bit_rate  = (double)params->get_bit_rate(tid, schedSelIdx, nalOrVcl);
+  cpb_size  = params->get_cpb_size(tid, schedSelIdx, nalOrVcl);
+  cbr       = layer.cpb(nalOrVcl)[schedSelIdx].cbr_flag;
+  low_delay = layer.low_delay_hrd_flag;
+  dpb_size  = sps->sps_max_dec_pic_buffering[sps->sps_max_sub_layers-1];
+
+  return true;
+}
+
+
+P265_error hrd_simulator::add_access_unit(const hrd_access_unit& au, const seq_parameter_set* sps,
+                                          hrd_au_result* result)
+{
+  *result = hrd_au_result();
+  result->au_index  = au_count++;
+  result->size_bits = au.size_bits;
+
+
+  // --- buffering period: (re)load the HRD parameters ---
+
+  bool init_hrd = false;
+
+  if (au.has_buffering_period) {
+    const sei_buffering_period& bp = au.buffering_period;
+    bool present = (nalOrVcl==0 ? bp.NalHrdBpPresentFlag : bp.VclHrdBpPresentFlag);
+
+    if (!present || schedSelIdx >= bp.CpbCnt || !configure(sps)) {
+      result->status = P265_ERROR_CANNOT_PROCESS_SEI;
+      return result->status;
+    }
+
+    const sei_initial_cpb_removal& e = (nalOrVcl==0 ? bp.nal : bp.vcl)[schedSelIdx];
+    init_cpb_removal_delay  = e.initial_cpb_removal_delay;
+    init_cpb_removal_offset = e.initial_cpb_removal_offset;
+
+    init_hrd = !initialized;
+    initialized = true;
+  }
+
+  if (!initialized || !au.has_pic_timing || !au.pic_timing.CpbDpbDelaysPresentFlag) {
+    result->status = P265_ERROR_CANNOT_PROCESS_SEI;
+    return result->status;
+  }
+
+
+  // --- nominal removal time (C.3.3) ---
+
+  const sei_pic_timing& pt = au.pic_timing;
+
+  /* The delay of the first AU in a buffering period refers to the previous buffering
+     period. The following AUs count from the start of this buffering period and may
+     wrap around. */
+
+  if (au.has_buffering_period) {
+    au_cpb_removal_delay_msb = 0;
+    prev_au_cpb_removal_delay_minus1 = -1;
+  }
+  else {
+    if ((int64_t)pt.au_cpb_removal_delay_minus1 <= prev_au_cpb_removal_delay_minus1) {
+      au_cpb_removal_delay_msb += INT64_C(1) << (sps->get_vui().hrd_common.au_cpb_removal_delay_length_minus1+1);
+    }
+    prev_au_cpb_removal_delay_minus1 = pt.au_cpb_removal_delay_minus1;
+  }
+
+  int64_t AuCpbRemovalDelayVal = au_cpb_removal_delay_msb + pt.au_cpb_removal_delay_minus1 + 1;
+
+  double t_rn;
+
+  if (init_hrd) {
+    t_rn = init_cpb_removal_delay / HRD_CLOCK;
+    bp_nominal_removal = t_rn;
+  }
+  else if (au.has_buffering_period) {
+    const sei_buffering_period& bp = au.buffering_period;
+
+    if (!bp.concatenation_flag) {
+      t_rn = bp_nominal_removal + tc * AuCpbRemovalDelayVal;
+    }
+    else {
+      double tmpDelay = std::max((double)bp.au_cpb_removal_delay_delta_minus1+1,
+                                 ceil((init_cpb_removal_delay / HRD_CLOCK + prev_final_arrival
+                                       - prev_nominal_removal) / tc - HRD_TIME_EPSILON));
+      t_rn = prev_non_discardable_removal + tc * tmpDelay;
+    }
+
+    bp_nominal_removal = t_rn;
+  }
+  else {
+    t_rn = bp_nominal_removal + tc * AuCpbRemovalDelayVal;
+  }
+
+
+  // --- arrival times (C.3.2) ---
+
+  double t_ai;
+
+  if (init_hrd) {
+    t_ai = 0;
+  }
+  else if (cbr) {
+    t_ai = prev_final_arrival;
+  }
+  else {
+    double earliest;
+    if (au.has_buffering_period) {
+      earliest = t_rn - init_cpb_removal_delay / HRD_CLOCK;
+    }
+    else {
+      earliest = t_rn - (init_cpb_removal_delay + (double)init_cpb_removal_offset) / HRD_CLOCK;
+    }
+
+    t_ai = std::max(prev_final_arrival, earliest);
+  }
+
+  double t_af = t_ai + au.size_bits / bit_rate;
+
+
+  // --- removal time ---
+
+  double t_r = t_rn;
+  if (low_delay && t_rn < t_af) {
+    // big picture in low-delay mode: removed at the next clock tick after it arrived
+    t_r = t_rn + tc * ceil((t_af - t_rn) / tc - HRD_TIME_EPSILON);
+  }
+
+  result->cpb_underflow = (t_af > t_r + HRD_TIME_EPSILON);
+
+
+  // --- CPB fullness ---
+
+  // AUs that were removed before this AU starts to arrive
+  while (!cpb.empty() && cpb.front().removal_time <= t_ai + HRD_TIME_EPSILON) {
+    cpb_bits -= cpb.front().bits;
+    cpb.pop_front();
+  }
+
+  int64_t max_fullness = cpb_bits;
+
+  // AUs that are removed while this AU is arriving, the fullness peaks just before each removal
+  while (!cpb.empty() && cpb.front().removal_time <= t_af + HRD_TIME_EPSILON) {
+    int64_t arrived = (int64_t)llround((cpb.front().removal_time - t_ai) * bit_rate);
+    arrived = std::min(std::max(arrived, (int64_t)0), au.size_bits);
+
+    max_fullness = std::max(max_fullness, cpb_bits + arrived);
+
+    cpb_bits -= cpb.front().bits;
+    cpb.pop_front();
+  }
+
+  max_fullness = std::max(max_fullness, cpb_bits + au.size_bits);
+
+  if (!result->cpb_underflow) {
+    cpb.push_back(cpb_entry { t_r, au.size_bits });
+    cpb_bits += au.size_bits;
+  }
+
+  result->cpb_overflow = (max_fullness > cpb_size);
+
+
+  // --- DPB output ---
+
+  double t_o = t_r + tc * pt.pic_dpb_output_delay;
+
+  while (!dpb_output_times.empty() && dpb_output_times.front() <= t_r + HRD_TIME_EPSILON) {
+    dpb_output_times.pop_front();
+  }
+
+  if (t_o > t_r + HRD_TIME_EPSILON) {
+    dpb_output_times.insert(std::upper_bound(dpb_output_times.begin(), dpb_output_times.end(), t_o),
+                            t_o);
+  }
+
+  result->dpb_fullness = static_cast<int>(dpb_output_times.size());
+  result->dpb_overflow = (result->dpb_fullness > dpb_size);
+
+
+  // --- store state for the next AU ---
+
+  prev_final_arrival   = t_af;
+  prev_nominal_removal = t_rn;
+
+  if (!au.discardable) {
+    prev_non_discardable_removal = t_rn;
+  }
+
+  result->status = P265_OK;
+  result->initial_arrival_time = t_ai;
+  result->final_arrival_time   = t_af;
+  result->nominal_removal_time = t_rn;
+  result->removal_time         = t_r;
+  result->dpb_output_time      = t_o;
+  result->max_cpb_fullness     = max_fullness;
+
+  if (result->cpb_underflow) { num_underflows++; }
+  if (result->cpb_overflow)  { num_overflows++; }
+  if (result->dpb_overflow)  { num_dpb_overflows++; }
+
+  return P265_OK;
+}
+
+
+// --- NAL level ---
+
+void hrd_simulator::start_access_unit()
+{
+  au_has_vcl = false;
+  au_irap = false;
+  au_discardable = false;
+  au_bits = 0;
+  au_has_bp = false;
+  au_has_pt = false;
+}
+
+
+bool hrd_simulator::finish_access_unit(parse_context* ctx, hrd_au_result* result)
+{
+  if (!au_has_vcl) {
+    start_access_unit();
+    return false;
+  }
+
+  hrd_access_unit au;
+  au.size_bits = au_bits;
+  au.irap = au_irap;
+  au.discardable = au_discardable;
+  au.has_buffering_period = false;
+  au.has_pic_timing = false;
+
+  const seq_parameter_set* sps = active_sps.get();
+
+  if (au_has_bp) {
+    sei_payload payload;
+    payload.payload_type = sei_payload_type_buffering_period;
+    payload.payload_size = static_cast<int>(bp_payload.size());
+    payload.payload      = bp_payload.data();
+
+    int sps_id = peek_sei_buffering_period_sps_id(payload);
+    if (sps_id >= 0) {
+      const seq_parameter_set* bp_sps = sps;
+      if (bp_sps==NULL || bp_sps->seq_parameter_set_id != sps_id) {
+        bp_sps = ctx->get_sps(sps_id);
+      }
+
+      au.has_buffering_period = (parse_sei_buffering_period(payload, &au.buffering_period,
+                                                            bp_sps) == P265_OK);
+    }
+  }
+
+  if (au_has_pt) {
+    sei_payload payload;
+    payload.payload_type = sei_payload_type_pic_timing;
+    payload.payload_size = static_cast<int>(pt_payload.size());
+    payload.payload      = pt_payload.data();
+
+    au.has_pic_timing = (parse_sei_pic_timing(payload, &au.pic_timing, sps) == P265_OK);
+  }
+
+  add_access_unit(au, sps, result);
+
+  start_access_unit();
+  return true;
+}
+
+
+
+bool hrd_simulator::push_NAL(const NAL_unit* nal, parse_context* ctx, hrd_au_result* result)
+{
+  // continuation fragment of a VCL NAL (no NAL header and no start code)
+  if (nal->fragment > 1) {
+    au_bits += 8 * (nal->size() + nal->num_skipped_bytes());
+    return false;
+  }
+
+  if (nal->size() < 2) {
+    return false;
+  }
+
+  const unsigned char* data = nal->data();
+  int nal_unit_type = (data[0] >> 1) & 0x3F;
+  bool vcl = (nal_unit_type < 32);
+
+  bool completed = false;
+
+  if (vcl) {
+    bool first_slice_segment_in_pic_flag = (nal->size() > 2 && (data[2] & 0x80));
+
+    if (first_slice_segment_in_pic_flag) {
+      if (au_has_vcl) {
+        completed = finish_access_unit(ctx, result);
+      }
+
+      // activate the SPS of this picture
+
+      bitreader br;
+      bitreader_init(&br, const_cast<unsigned char*>(data+2), static_cast<int>(nal->size()-2));
+      skip_bits(&br,1);
+      if (isIRAP(nal_unit_type)) {
+        skip_bits(&br,1); // no_output_of_prior_pics_flag
+      }
+
+      int pps_id = get_uvlc(&br);
+      if (pps_id >= 0 && pps_id < P265_MAX_PPS_SETS) {
+        std::shared_ptr<pic_parameter_set> pps = ctx->get_shared_pps(pps_id);
+        if (pps) {
+          active_sps = ctx->get_shared_sps(pps->seq_parameter_set_id);
+        }
+      }
+    }
+
+    if (!au_has_vcl) {
+      int temporal_id = (data[1] & 7) - 1;
+      au_discardable = (temporal_id > 0 ||
+                        isRASL(nal_unit_type) || isRADL(nal_unit_type) ||
+                        isSublayerNonReference(nal_unit_type));
+    }
+
+    au_has_vcl = true;
+    au_irap |= isIRAP(nal_unit_type);
+  }
+  else if (au_has_vcl && startsNewAccessUnit(nal_unit_type)) {
+    completed = finish_access_unit(ctx, result);
+  }
+
+
+  // --- size of the NAL in the bitstream ---
+
+  int64_t nal_bytes = nal->size() + nal->num_skipped_bytes();
+
+  if (nalOrVcl==0) {
+    // zero_byte + start code prefix for parameter sets and the first NAL in the AU
+    bool long_start_code = (au_bits == 0 ||
+                            nal_unit_type == NAL_UNIT_VPS_NUT ||
+                            nal_unit_type == NAL_UNIT_SPS_NUT ||
+                            nal_unit_type == NAL_UNIT_PPS_NUT);
+
+    au_bits += 8 * (nal_bytes + (long_start_code ? 4 : 3));
+  }
+  else if (vcl || nal_unit_type == NAL_UNIT_FD_NUT) {
+    au_bits += 8 * nal_bytes;
+  }
+
+
+  // --- collect buffering period and picture timing SEIs ---
+
+  if (nal_unit_type == NAL_UNIT_PREFIX_SEI_NUT) {
+    sei_message_iterator iter(nal);
+    sei_payload payload;
+
+    while (iter.next(&payload)) {
+      if (payload.payload_type == sei_payload_type_buffering_period) {
+        bp_payload.assign(payload.payload, payload.payload + payload.payload_size);
+        au_has_bp = true;
+      }
+      else if (payload.payload_type == sei_payload_type_pic_timing) {
+        pt_payload.assign(payload.payload, payload.payload + payload.payload_size);
+        au_has_pt = true;
+      }
+    }
+  }
+
+  return completed;
+}
+
+
+bool hrd_simulator::flush(parse_context* ctx, hrd_au_result* result)
+{
+  return finish_access_unit(ctx, result);
+}
+
+END_NAMESPACE_LIBP265
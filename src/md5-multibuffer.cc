@@ -0,0 +1,563 @@
+/*
+ * H.265 video codec parser.
+ * Copyright (c) 2023 John Willard <john.willard@shotover.com>
+ *
+ * This file is part of libp265.
+ *
+ * libp265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libp265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libp265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libp265/md5-multibuffer.h"
+#include "libp265/md5.h"
+#include "libp265/util.h"
+
+#include <assert.h>
+#include <string.h>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_MD5_SIMD 1
+#include <immintrin.h>
+#endif
+
+BEGIN_NAMESPACE_LIBP265
+
+#define MD5_MAX_LANES 16
+
+
+static inline bool host_is_little_endian()
+{
+  const uint16_t one = 1;
+  return *reinterpret_cast<const uint8_t*>(&one) == 1;
+}
+
+
+// --- reading the messages in 64-byte blocks ---
+
+struct md5_lane
+{
+  md5_job* job;
+  int      row, pos;    // read position
+  uint64_t length;      // number of bytes processed so far
+  bool     swap;        // swap the bytes of 16-bit samples
+
+  uint8_t  staging[64]; // for blocks that span several rows or have to be swapped
+};
+
+
+static void start_lane(md5_lane* lane, md5_job* job)
+{
+  lane->job = job;
+  lane->row = 0;
+  lane->pos = 0;
+  lane->length = 0;
+  lane->swap = job->samples16 && !host_is_little_endian();
+}
+
+
+static inline int64_t remaining_bytes(const md5_lane* lane)
+{
+  const md5_job* job = lane->job;
+  if (job->row_bytes <= 0 || lane->row >= job->rows) {
+    return 0;
+  }
+
+  return (int64_t)(job->rows - lane->row) * job->row_bytes - lane->pos;
+}
+
+
+static inline void advance(md5_lane* lane, int len)
+{
+  lane->pos += len;
+  if (lane->pos == lane->job->row_bytes) {
+    lane->row++;
+    lane->pos = 0;
+  }
+}
+
+
+static void copy_bytes(uint8_t* dst, const uint8_t* src, int len, bool swap)
+{
+  if (!swap) {
+    memcpy(dst, src, len);
+  }
+  else {
+    for (int i=0;i<len;i+=2) {
+      dst[i+0] = src[i+1];
+      dst[i+1] = src[i+0];
+    }
+  }
+}
+
+
+// Returns NULL if less than 64 bytes are left.
+static const uint8_t* next_block(md5_lane* lane)
+{
+  const md5_job* job = lane->job;
+
+  if (remaining_bytes(lane) < 64) {
+    return NULL;
+  }
+
+  const uint8_t* rowptr = job->data + lane->row * job->stride;
+
+  // no copy needed if the block lies completely within the current row
+
+  if (!lane->swap && lane->pos + 64 <= job->row_bytes) {
+    const uint8_t* block = rowptr + lane->pos;
+    advance(lane, 64);
+    lane->length += 64;
+    return block;
+  }
+
+  int n=0;
+  while (n<64) {
+    rowptr = job->data + lane->row * job->stride;
+
+    int len = libP265_min(64-n, job->row_bytes - lane->pos);
+    copy_bytes(lane->staging+n, rowptr + lane->pos, len, lane->swap);
+    advance(lane, len);
+    n += len;
+  }
+
+  lane->length += 64;
+  return lane->staging;
+}
+
+
+/* Hash the rest of the message with the scalar implementation, starting with the
+   intermediate state (a,b,c,d), and write the digest. */
+static void finish_lane(md5_lane* lane, const uint32_t abcd[4])
+{
+  md5_job* job = lane->job;
+
+  MD5_CTX ctx;
+  MD5_Init(&ctx);
+  ctx.a = abcd[0];
+  ctx.b = abcd[1];
+  ctx.c = abcd[2];
+  ctx.d = abcd[3];
+  ctx.lo = (MD5_u32plus)(lane->length & 0x1fffffff);
+  ctx.hi = (MD5_u32plus)(lane->length >> 29);
+
+  while (remaining_bytes(lane) > 0) {
+    const uint8_t* rowptr = job->data + lane->row * job->stride;
+    int len = job->row_bytes - lane->pos;
+
+    if (!lane->swap) {
+      MD5_Update(&ctx, (void*)(rowptr + lane->pos), len);
+    }
+    else {
+      len = libP265_min(len, 64);
+      copy_bytes(lane->staging, rowptr + lane->pos, len, true);
+      MD5_Update(&ctx, lane->staging, len);
+    }
+
+    advance(lane, len);
+  }
+
+  MD5_Final(job->digest, &ctx);
+
+  lane->job = NULL;
+}
+
+
+static const uint32_t md5_iv[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+
+
+#ifdef HAVE_MD5_SIMD
+
+/*
+ * The 64 MD5 steps on vectors of message words, one lane per message.
+ * Requires the V_* operations to be defined for the vector type.
+ */
+
+#define V_F(x, y, z)  V_XOR((z), V_AND((x), V_XOR((y), (z))))
+#define V_G(x, y, z)  V_XOR((y), V_AND((z), V_XOR((x), (y))))
+#define V_H(x, y, z)  V_XOR(V_XOR((x), (y)), (z))
+#define V_I(x, y, z)  V_XOR((y), V_OR((x), V_NOT(z)))
+
+#define V_STEP(f, a, b, c, d, x, t, s) \
+  (a) = V_ADD((a), V_ADD(V_ADD(f((b), (c), (d)), (x)), V_SET1((int)(t)))); \
+  (a) = V_ADD(V_ROTL((a), (s)), (b));
+
+#define MD5_VECTOR_ROUNDS(a,b,c,d,M) \
+  V_STEP(V_F, a, b, c, d, M[0], 0xd76aa478, 7) \
+  V_STEP(V_F, d, a, b, c, M[1], 0xe8c7b756, 12) \
+  V_STEP(V_F, c, d, a, b, M[2], 0x242070db, 17) \
+  V_STEP(V_F, b, c, d, a, M[3], 0xc1bdceee, 22) \
+  V_STEP(V_F, a, b, c, d, M[4], 0xf57c0faf, 7) \
+  V_STEP(V_F, d, a, b, c, M[5], 0x4787c62a, 12) \
+  V_STEP(V_F, c, d, a, b, M[6], 0xa8304613, 17) \
+  V_STEP(V_F, b, c, d, a, M[7], 0xfd469501, 22) \
+  V_STEP(V_F, a, b, c, d, M[8], 0x698098d8, 7) \
+  V_STEP(V_F, d, a, b, c, M[9], 0x8b44f7af, 12) \
+  V_STEP(V_F, c, d, a, b, M[10], 0xffff5bb1, 17) \
+  V_STEP(V_F, b, c, d, a, M[11], 0x895cd7be, 22) \
+  V_STEP(V_F, a, b, c, d, M[12], 0x6b901122, 7) \
+  V_STEP(V_F, d, a, b, c, M[13], 0xfd987193, 12) \
+  V_STEP(V_F, c, d, a, b, M[14], 0xa679438e, 17) \
+  V_STEP(V_F, b, c, d, a, M[15], 0x49b40821, 22) \
+                                                 \
+  V_STEP(V_G, a, b, c, d, M[1], 0xf61e2562, 5) \
+  V_STEP(V_G, d, a, b, c, M[6], 0xc040b340, 9) \
+  V_STEP(V_G, c, d, a, b, M[11], 0x265e5a51, 14) \
+  V_STEP(V_G, b, c, d, a, M[0], 0xe9b6c7aa, 20) \
+  V_STEP(V_G, a, b, c, d, M[5], 0xd62f105d, 5) \
+  V_STEP(V_G, d, a, b, c, M[10], 0x02441453, 9) \
+  V_STEP(V_G, c, d, a, b, M[15], 0xd8a1e681, 14) \
+  V_STEP(V_G, b, c, d, a, M[4], 0xe7d3fbc8, 20) \
+  V_STEP(V_G, a, b, c, d, M[9], 0x21e1cde6, 5) \
+  V_STEP(V_G, d, a, b, c, M[14], 0xc33707d6, 9) \
+  V_STEP(V_G, c, d, a, b, M[3], 0xf4d50d87, 14) \
+  V_STEP(V_G, b, c, d, a, M[8], 0x455a14ed, 20) \
+  V_STEP(V_G, a, b, c, d, M[13], 0xa9e3e905, 5) \
+  V_STEP(V_G, d, a, b, c, M[2], 0xfcefa3f8, 9) \
+  V_STEP(V_G, c, d, a, b, M[7], 0x676f02d9, 14) \
+  V_STEP(V_G, b, c, d, a, M[12], 0x8d2a4c8a, 20) \
+                                                 \
+  V_STEP(V_H, a, b, c, d, M[5], 0xfffa3942, 4) \
+  V_STEP(V_H, d, a, b, c, M[8], 0x8771f681, 11) \
+  V_STEP(V_H, c, d, a, b, M[11], 0x6d9d6122, 16) \
+  V_STEP(V_H, b, c, d, a, M[14], 0xfde5380c, 23) \
+  V_STEP(V_H, a, b, c, d, M[1], 0xa4beea44, 4) \
+  V_STEP(V_H, d, a, b, c, M[4], 0x4bdecfa9, 11) \
+  V_STEP(V_H, c, d, a, b, M[7], 0xf6bb4b60, 16) \
+  V_STEP(V_H, b, c, d, a, M[10], 0xbebfbc70, 23) \
+  V_STEP(V_H, a, b, c, d, M[13], 0x289b7ec6, 4) \
+  V_STEP(V_H, d, a, b, c, M[0], 0xeaa127fa, 11) \
+  V_STEP(V_H, c, d, a, b, M[3], 0xd4ef3085, 16) \
+  V_STEP(V_H, b, c, d, a, M[6], 0x04881d05, 23) \
+  V_STEP(V_H, a, b, c, d, M[9], 0xd9d4d039, 4) \
+  V_STEP(V_H, d, a, b, c, M[12], 0xe6db99e5, 11) \
+  V_STEP(V_H, c, d, a, b, M[15], 0x1fa27cf8, 16) \
+  V_STEP(V_H, b, c, d, a, M[2], 0xc4ac5665, 23) \
+                                                 \
+  V_STEP(V_I, a, b, c, d, M[0], 0xf4292244, 6) \
+  V_STEP(V_I, d, a, b, c, M[7], 0x432aff97, 10) \
+  V_STEP(V_I, c, d, a, b, M[14], 0xab9423a7, 15) \
+  V_STEP(V_I, b, c, d, a, M[5], 0xfc93a039, 21) \
+  V_STEP(V_I, a, b, c, d, M[12], 0x655b59c3, 6) \
+  V_STEP(V_I, d, a, b, c, M[3], 0x8f0ccc92, 10) \
+  V_STEP(V_I, c, d, a, b, M[10], 0xffeff47d, 15) \
+  V_STEP(V_I, b, c, d, a, M[1], 0x85845dd1, 21) \
+  V_STEP(V_I, a, b, c, d, M[8], 0x6fa87e4f, 6) \
+  V_STEP(V_I, d, a, b, c, M[15], 0xfe2ce6e0, 10) \
+  V_STEP(V_I, c, d, a, b, M[6], 0xa3014314, 15) \
+  V_STEP(V_I, b, c, d, a, M[13], 0x4e0811a1, 21) \
+  V_STEP(V_I, a, b, c, d, M[4], 0xf7537e82, 6) \
+  V_STEP(V_I, d, a, b, c, M[11], 0xbd3af235, 10) \
+  V_STEP(V_I, c, d, a, b, M[2], 0x2ad7d2bb, 15) \
+  V_STEP(V_I, b, c, d, a, M[9], 0xeb86d391, 21)
+
+
+/* Transpose 16 bytes (4 message words) of 4 lanes, such that out[k] contains
+   word 4*q+k of the four lanes. */
+static inline void transpose_4x4(const uint8_t* const* blocks, int q, __m128i out[4])
+{
+  __m128i r0 = _mm_loadu_si128((const __m128i*)(blocks[0] + 16*q));
+  __m128i r1 = _mm_loadu_si128((const __m128i*)(blocks[1] + 16*q));
+  __m128i r2 = _mm_loadu_si128((const __m128i*)(blocks[2] + 16*q));
+  __m128i r3 = _mm_loadu_si128((const __m128i*)(blocks[3] + 16*q));
+
+  __m128i t0 = _mm_unpacklo_epi32(r0,r1);
+  __m128i t1 = _mm_unpacklo_epi32(r2,r3);
+  __m128i t2 = _mm_unpackhi_epi32(r0,r1);
+  __m128i t3 = _mm_unpackhi_epi32(r2,r3);
+
+  out[0] = _mm_unpacklo_epi64(t0,t1);
+  out[1] = _mm_unpackhi_epi64(t0,t1);
+  out[2] = _mm_unpacklo_epi64(t2,t3);
+  out[3] = _mm_unpackhi_epi64(t2,t3);
+}
+
+
+// --- SSE2, 4 lanes ---
+
+#define V_ADD(a,b)   _mm_add_epi32((a),(b))
+#define V_AND(a,b)   _mm_and_si128((a),(b))
+#define V_OR(a,b)    _mm_or_si128((a),(b))
+#define V_XOR(a,b)   _mm_xor_si128((a),(b))
+#define V_NOT(a)     _mm_xor_si128((a), _mm_set1_epi32(-1))
+#define V_SET1(t)    _mm_set1_epi32(t)
+#define V_ROTL(a,s)  _mm_or_si128(_mm_slli_epi32((a),(s)), _mm_srli_epi32((a),32-(s)))
+
+static void md5_block_sse2(uint32_t* state, const uint8_t* const* blocks)
+{
+  __m128i M[16];
+  for (int q=0;q<4;q++) {
+    transpose_4x4(blocks, q, &M[4*q]);
+  }
+
+  __m128i a = _mm_loadu_si128((const __m128i*)(state + 0*MD5_MAX_LANES));
+  __m128i b = _mm_loadu_si128((const __m128i*)(state + 1*MD5_MAX_LANES));
+  __m128i c = _mm_loadu_si128((const __m128i*)(state + 2*MD5_MAX_LANES));
+  __m128i d = _mm_loadu_si128((const __m128i*)(state + 3*MD5_MAX_LANES));
+
+  __m128i saved_a = a, saved_b = b, saved_c = c, saved_d = d;
+
+  MD5_VECTOR_ROUNDS(a,b,c,d,M)
+
+  _mm_storeu_si128((__m128i*)(state + 0*MD5_MAX_LANES), V_ADD(a, saved_a));
+  _mm_storeu_si128((__m128i*)(state + 1*MD5_MAX_LANES), V_ADD(b, saved_b));
+  _mm_storeu_si128((__m128i*)(state + 2*MD5_MAX_LANES), V_ADD(c, saved_c));
+  _mm_storeu_si128((__m128i*)(state + 3*MD5_MAX_LANES), V_ADD(d, saved_d));
+}
+
+#undef V_ADD
+#undef V_AND
+#undef V_OR
+#undef V_XOR
+#undef V_NOT
+#undef V_SET1
+#undef V_ROTL
+
+
+// --- AVX2, 8 lanes ---
+
+#define V_ADD(a,b)   _mm256_add_epi32((a),(b))
+#define V_AND(a,b)   _mm256_and_si256((a),(b))
+#define V_OR(a,b)    _mm256_or_si256((a),(b))
+#define V_XOR(a,b)   _mm256_xor_si256((a),(b))
+#define V_NOT(a)     _mm256_xor_si256((a), _mm256_set1_epi32(-1))
+#define V_SET1(t)    _mm256_set1_epi32(t)
+#define V_ROTL(a,s)  _mm256_or_si256(_mm256_slli_epi32((a),(s)), _mm256_srli_epi32((a),32-(s)))
+
+__attribute__((target("avx2")))
+static void md5_block_avx2(uint32_t* state, const uint8_t* const* blocks)
+{
+  __m256i M[16];
+  for (int q=0;q<4;q++) {
+    __m128i lo[4], hi[4];
+    transpose_4x4(blocks+0, q, lo);
+    transpose_4x4(blocks+4, q, hi);
+
+    for (int k=0;k<4;k++) {
+      M[4*q+k] = _mm256_inserti128_si256(_mm256_castsi128_si256(lo[k]), hi[k], 1);
+    }
+  }
+
+  __m256i a = _mm256_loadu_si256((const __m256i*)(state + 0*MD5_MAX_LANES));
+  __m256i b = _mm256_loadu_si256((const __m256i*)(state + 1*MD5_MAX_LANES));
+  __m256i c = _mm256_loadu_si256((const __m256i*)(state + 2*MD5_MAX_LANES));
+  __m256i d = _mm256_loadu_si256((const __m256i*)(state + 3*MD5_MAX_LANES));
+
+  __m256i saved_a = a, saved_b = b, saved_c = c, saved_d = d;
+
+  MD5_VECTOR_ROUNDS(a,b,c,d,M)
+
+  _mm256_storeu_si256((__m256i*)(state + 0*MD5_MAX_LANES), V_ADD(a, saved_a));
+  _mm256_storeu_si256((__m256i*)(state + 1*MD5_MAX_LANES), V_ADD(b, saved_b));
+  _mm256_storeu_si256((__m256i*)(state + 2*MD5_MAX_LANES), V_ADD(c, saved_c));
+  _mm256_storeu_si256((__m256i*)(state + 3*MD5_MAX_LANES), V_ADD(d, saved_d));
+}
+
+#undef V_ADD
+#undef V_AND
+#undef V_OR
+#undef V_XOR
+#undef V_NOT
+#undef V_SET1
+#undef V_ROTL
+
+
+// --- AVX-512, 16 lanes ---
+
+#define V_ADD(a,b)   _mm512_add_epi32((a),(b))
+#define V_AND(a,b)   _mm512_and_si512((a),(b))
+#define V_OR(a,b)    _mm512_or_si512((a),(b))
+#define V_XOR(a,b)   _mm512_xor_si512((a),(b))
+#define V_NOT(a)     _mm512_xor_si512((a), _mm512_set1_epi32(-1))
+#define V_SET1(t)    _mm512_set1_epi32(t)
+// masked form: the unmasked intrinsics use _mm512_undefined_epi32(), which GCC warns about
+#define V_ROTL(a,s)  _mm512_maskz_rol_epi32(0xFFFF, (a), (s))
+
+__attribute__((target("avx512f")))
+static void md5_block_avx512(uint32_t* state, const uint8_t* const* blocks)
+{
+  __m512i M[16];
+  for (int q=0;q<4;q++) {
+    __m128i g[4][4];
+    for (int i=0;i<4;i++) {
+      transpose_4x4(blocks+4*i, q, g[i]);
+    }
+
+    for (int k=0;k<4;k++) {
+      __m512i v = _mm512_castsi128_si512(g[0][k]);
+      v = _mm512_inserti32x4(v, g[1][k], 1);
+      v = _mm512_inserti32x4(v, g[2][k], 2);
+      v = _mm512_inserti32x4(v, g[3][k], 3);
+      M[4*q+k] = v;
+    }
+  }
+
+  __m512i a = _mm512_loadu_si512(state + 0*MD5_MAX_LANES);
+  __m512i b = _mm512_loadu_si512(state + 1*MD5_MAX_LANES);
+  __m512i c = _mm512_loadu_si512(state + 2*MD5_MAX_LANES);
+  __m512i d = _mm512_loadu_si512(state + 3*MD5_MAX_LANES);
+
+  __m512i saved_a = a, saved_b = b, saved_c = c, saved_d = d;
+
+  MD5_VECTOR_ROUNDS(a,b,c,d,M)
+
+  _mm512_storeu_si512(state + 0*MD5_MAX_LANES, V_ADD(a, saved_a));
+  _mm512_storeu_si512(state + 1*MD5_MAX_LANES, V_ADD(b, saved_b));
+  _mm512_storeu_si512(state + 2*MD5_MAX_LANES, V_ADD(c, saved_c));
+  _mm512_storeu_si512(state + 3*MD5_MAX_LANES, V_ADD(d, saved_d));
+}
+
+#undef V_ADD
+#undef V_AND
+#undef V_OR
+#undef V_XOR
+#undef V_NOT
+#undef V_SET1
+#undef V_ROTL
+
+#endif // HAVE_MD5_SIMD
+
+
+enum md5_simd_level md5_get_simd_level()
+{
+#ifdef HAVE_MD5_SIMD
+  static const enum md5_simd_level level = [] {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return md5_simd_avx512;
+    if (__builtin_cpu_supports("avx2"))    return md5_simd_avx2;
+    return md5_simd_sse2;
+  }();
+
+  return level;
+#else
+  return md5_simd_none;
+#endif
+}
+
+
+void md5_multibuffer(md5_job* jobs, int nJobs, enum md5_simd_level level)
+{
+  enum md5_simd_level supported = md5_get_simd_level();
+  if (level == md5_simd_auto || level > supported) {
+    level = supported;
+  }
+
+  md5_lane lanes[MD5_MAX_LANES];
+
+
+  // --- scalar ---
+
+  if (level == md5_simd_none || nJobs == 1) {
+    for (int i=0;i<nJobs;i++) {
+      start_lane(&lanes[0], &jobs[i]);
+      finish_lane(&lanes[0], md5_iv);
+    }
+
+    return;
+  }
+
+#ifdef HAVE_MD5_SIMD
+
+  // --- SIMD ---
+
+  void (*md5_block)(uint32_t* state, const uint8_t* const* blocks);
+  int nLanes;
+
+  switch (level) {
+  case md5_simd_avx512: md5_block = md5_block_avx512; nLanes=16; break;
+  case md5_simd_avx2:   md5_block = md5_block_avx2;   nLanes=8;  break;
+  default:              md5_block = md5_block_sse2;   nLanes=4;  break;
+  }
+
+  uint32_t state[4*MD5_MAX_LANES];  // [a,b,c,d][lane]
+
+  static const uint8_t zero_block[64] = { 0 };
+  const uint8_t* blocks[MD5_MAX_LANES];
+
+  for (int l=0;l<nLanes;l++) {
+    lanes[l].job = NULL;
+  }
+
+  int nextJob = 0;
+
+  for (;;) {
+    // a single remaining job is finished with the scalar implementation
+
+    if (nextJob == nJobs) {
+      int nBusy = 0, last = 0;
+      for (int l=0;l<nLanes;l++) {
+        if (lanes[l].job) { nBusy++; last=l; }
+      }
+
+      if (nBusy <= 1) {
+        if (nBusy==1) {
+          uint32_t abcd[4];
+          for (int i=0;i<4;i++) {
+            abcd[i] = state[i*MD5_MAX_LANES + last];
+          }
+
+          finish_lane(&lanes[last], abcd);
+        }
+
+        break;
+      }
+    }
+
+
+    // collect the next block of each lane, start new jobs in free lanes
+
+    int nActive = 0;
+
+    for (int l=0;l<nLanes;l++) {
+      blocks[l] = NULL;
+
+      while (blocks[l]==NULL) {
+        if (lanes[l].job == NULL) {
+          if (nextJob == nJobs) {
+            break;
+          }
+
+          start_lane(&lanes[l], &jobs[nextJob++]);
+          for (int i=0;i<4;i++) {
+            state[i*MD5_MAX_LANES + l] = md5_iv[i];
+          }
+        }
+
+        blocks[l] = next_block(&lanes[l]);
+        if (blocks[l]==NULL) {
+          uint32_t abcd[4];
+          for (int i=0;i<4;i++) {
+            abcd[i] = state[i*MD5_MAX_LANES + l];
+          }
+
+          finish_lane(&lanes[l], abcd);
+        }
+      }
+
+      if (blocks[l]) {
+        nActive++;
+      }
+      else {
+        blocks[l] = zero_block; // idle lane
+      }
+    }
+
+    if (nActive==0) {
+      break;
+    }
+
+    md5_block(state, blocks);
+  }
+#endif
+}
+
+END_NAMESPACE_LIBP265
@@ -19,11 +19,14 @@
  */
 
 #include "libp265/nal-parser.h"
+#include "libp265/sei-metadata.h"
+#include "libp265/snapshot.h"
 
 #include <string.h>
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <limits.h>
 
 #ifdef HAVE_CONFIG_H
 #include "config.h"
@@ -32,10 +35,15 @@
 BEGIN_NAMESPACE_LIBP265
 
 NAL_unit::NAL_unit()
-  : skipped_bytes(P265_SKIPPED_BYTES_INITIAL_SIZE)
 {
+  skipped_bytes.reserve(P265_SKIPPED_BYTES_INITIAL_SIZE);
+
   pts=0;
   user_data = NULL;
+  stream_offset = -1;
+  nal_index = -1;
+  fragment = 0;
+  last_fragment = false;
 
   nal_data = NULL;
   data_size = 0;
@@ -52,6 +60,10 @@ void NAL_unit::clear()
   header = nal_header();
   pts = 0;
   user_data = NULL;
+  stream_offset = -1;
+  nal_index = -1;
+  fragment = 0;
+  last_fragment = false;
 
   // set size to zero but keep memory
   data_size = 0;
@@ -80,7 +92,9 @@ LIBP265_CHECK_RESULT bool NAL_unit::resize(int new_size)
 
 LIBP265_CHECK_RESULT bool NAL_unit::append(const unsigned char* in_data, int n)
 {
-  if (!resize(data_size + n)) {
+  // grow geometrically, NALs may be assembled from many small pieces
+  if (data_size + n > capacity &&
+      !resize(libP265_max(data_size + n, capacity + capacity/2))) {
     return false;
   }
   memcpy(nal_data + data_size, in_data, n);
@@ -103,6 +117,65 @@ void NAL_unit::insert_skipped_byte(int pos)
   skipped_bytes.push_back(pos);
 }
 
+void NAL_unit::save_state(snapshot_writer& w) const
+{
+  w.put_u8(static_cast<uint8_t>(header.nal_unit_type));
+  w.put_u8(static_cast<uint8_t>(header.nuh_layer_id));
+  w.put_u8(static_cast<uint8_t>(header.nuh_temporal_id));
+
+  w.put_i64(pts);
+  w.put_i64(stream_offset);
+  w.put_i64(nal_index);
+  w.put_u32(static_cast<uint32_t>(fragment));
+  w.put_u8(last_fragment);
+
+  w.put_u32(static_cast<uint32_t>(skipped_bytes.size()));
+  for (int pos : skipped_bytes) {
+    w.put_u32(static_cast<uint32_t>(pos));
+  }
+
+  w.put_u32(static_cast<uint32_t>(data_size));
+  w.put_bytes(nal_data, data_size);
+}
+
+
+LIBP265_CHECK_RESULT bool NAL_unit::restore_state(snapshot_reader& r)
+{
+  clear();
+
+  header.nal_unit_type   = r.get_u8();
+  header.nuh_layer_id    = r.get_u8();
+  header.nuh_temporal_id = r.get_u8();
+
+  pts           = r.get_i64();
+  stream_offset = r.get_i64();
+  nal_index     = r.get_i64();
+  fragment      = static_cast<int>(r.get_u32());
+  last_fragment = r.get_u8() != 0;
+
+  uint32_t nSkipped = r.get_u32();
+  for (uint32_t i=0; i<nSkipped && r.ok(); i++) {
+    skipped_bytes.push_back(static_cast<int>(r.get_u32()));
+  }
+
+  uint32_t size = r.get_u32();
+  const unsigned char* data = r.get_bytes(size);
+  if (data == NULL) {
+    return false;
+  }
+
+  // keep some room, the pending NAL is appended to
+  if (!resize(static_cast<int>(size) + 3)) {
+    return false;
+  }
+
+  memcpy(nal_data, data, size);
+  data_size = size;
+
+  return true;
+}
+
+
 int NAL_unit::num_skipped_bytes_before(int byte_position, int headerLength) const
 {
   for (int k=skipped_bytes.size()-1;k>=0;k--)
@@ -156,11 +229,11 @@ void NAL_unit::insert_emulation_prevention_bytes()
   if (!resize(new_size)) {
     return;
   }
-  set_size(new_size);
 
   for (int index : skipped_bytes) {
     memmove(nal_data+index+1, nal_data+index, data_size-index);
     nal_data[index] = 3;
+    data_size++;
   }
 
   skipped_bytes.clear();
@@ -173,8 +246,22 @@ NAL_Parser::NAL_Parser()
   end_of_stream = false;
   end_of_frame = false;
   input_push_state = 0;
+  input_offset = 0;
+  nal_counter = 0;
+  pending_NAL_flags = 0;
+  max_queue_bytes = 0;
+  max_queue_NALs = 0;
+  max_NAL_size = 0;
+  VCL_fragment_size = 0;
+  num_oversized_NALs = 0;
   pending_input_NAL = NULL;
   nBytes_in_NAL_queue = 0;
+  sei_extractor = NULL;
+
+  for (int i=0;i<64;i++) {
+    handlers[i] = NULL;
+    handler_flags[i] = 0;
+  }
 }
 
 
@@ -255,17 +342,210 @@ NAL_unit* NAL_Parser::pop_from_NAL_queue()
   }
 }
 
-void NAL_Parser::push_to_NAL_queue(NAL_unit* nal)
+void NAL_Parser::set_NAL_handler(int nal_unit_type, NAL_handler* handler, int flags)
 {
+  handlers[nal_unit_type & 63] = handler;
+  handler_flags[nal_unit_type & 63] = flags;
+}
+
+
+void NAL_Parser::set_NAL_handler(enum NAL_category category, NAL_handler* handler, int flags)
+{
+  for (int type=0; type<64; type++) {
+    enum NAL_category c;
+
+    if      (type < 32)                   { c = NAL_category_VCL; }
+    else if (type == NAL_UNIT_VPS_NUT)    { c = NAL_category_VPS; }
+    else if (type == NAL_UNIT_SPS_NUT)    { c = NAL_category_SPS; }
+    else if (type == NAL_UNIT_PPS_NUT)    { c = NAL_category_PPS; }
+    else if (type == NAL_UNIT_AUD_NUT)    { c = NAL_category_AUD; }
+    else if (type == NAL_UNIT_EOS_NUT ||
+             type == NAL_UNIT_EOB_NUT)    { c = NAL_category_EOS; }
+    else if (type == NAL_UNIT_PREFIX_SEI_NUT ||
+             type == NAL_UNIT_SUFFIX_SEI_NUT) { c = NAL_category_SEI; }
+    else                                  { c = NAL_category_other; }
+
+    if (c == category) {
+      set_NAL_handler(type, handler, flags);
+    }
+  }
+}
+
+
+void NAL_Parser::push_to_NAL_queue(NAL_unit* nal, bool unescaped)
+{
+  // the SEI extractor needs unescaped data
+  if (sei_extractor && unescaped) {
+    sei_extractor->process_NAL(nal);
+  }
+
   NAL_queue.push(nal);
   nBytes_in_NAL_queue += nal->size();
 }
 
+
+bool NAL_Parser::complete_NAL(NAL_unit* nal, int flags)
+{
+  nal->nal_index = (nal->fragment > 1 ? nal_counter-1 : nal_counter++);
+
+  // continuation fragments have no NAL header
+  bool continuation = (nal->fragment > 1);
+
+  int type = (continuation ? nal->header.nal_unit_type :
+              nal->size() > 0 ? (nal->data()[0] >> 1) & 0x3F : 0);
+  NAL_handler* handler = handlers[type];
+
+  if (handler == NULL && flags == 0) {
+    push_to_NAL_queue(nal);
+    return true;
+  }
+
+  if (handler) {
+    NAL_view view;
+    view.data = nal->data();
+    view.size = static_cast<int>(nal->size());
+    view.nal_unit_type = type;
+    if (continuation) {
+      view.nuh_layer_id  = nal->header.nuh_layer_id;
+      view.temporal_id   = nal->header.nuh_temporal_id;
+    }
+    else {
+      view.nuh_layer_id  = (view.size >= 2 ? ((nal->data()[0] & 1) << 5) | (nal->data()[1] >> 3) : 0);
+      view.temporal_id   = (view.size >= 2 ? (nal->data()[1] & 7) - 1 : 0);
+    }
+    view.escaped = (flags & (P265_NAL_HANDLER_NO_DEESCAPE | P265_NAL_HANDLER_DISCARD)) != 0;
+    view.payload_skipped = (flags & P265_NAL_HANDLER_DISCARD) != 0;
+    view.pts = nal->pts;
+    view.user_data = nal->user_data.get();
+    view.stream_offset = nal->stream_offset;
+    view.nal_index = nal->nal_index;
+    view.fragment = nal->fragment;
+    view.last_fragment = nal->last_fragment;
+
+    if (view.payload_skipped) {
+      view.size = libP265_min(view.size, 2);
+    }
+
+    if (handler->on_NAL(view)) {
+      return false;
+    }
+  }
+
+  if (flags & P265_NAL_HANDLER_DISCARD) {
+    return false;
+  }
+
+  push_to_NAL_queue(nal, !(flags & P265_NAL_HANDLER_NO_DEESCAPE));
+  return true;
+}
+
+void NAL_Parser::set_limits(int max_queue_bytes, int max_queue_NALs,
+                            int max_NAL_size, int VCL_fragment_size)
+{
+  this->max_queue_bytes   = max_queue_bytes;
+  this->max_queue_NALs    = max_queue_NALs;
+  this->max_NAL_size      = max_NAL_size;
+  this->VCL_fragment_size = VCL_fragment_size;
+}
+
+
+#define MIN_INPUT_SLICE_SIZE 4096
+
 P265_error NAL_Parser::push_data(const unsigned char* data, int len,
                                   P265_PTS pts, std::shared_ptr<void> user_data)
 {
   end_of_frame = false;
 
+  if (is_input_blocked()) {
+    return P265_ERROR_INPUT_BUFFER_FULL;
+  }
+
+  if (max_NAL_size==0 && VCL_fragment_size==0) {
+    return push_data_slice(data, len, pts, user_data);
+  }
+
+
+  // Parse the input in slices and check the size of the pending NAL in between.
+
+  int slice = INT_MAX;
+  if (max_NAL_size > 0)      { slice = libP265_min(slice, max_NAL_size); }
+  if (VCL_fragment_size > 0) { slice = libP265_min(slice, VCL_fragment_size); }
+  slice = libP265_max(slice/2, MIN_INPUT_SLICE_SIZE);
+
+  for (int pos=0; pos<len; pos+=slice) {
+    P265_error err = push_data_slice(data+pos, libP265_min(slice, len-pos), pts, user_data);
+    if (err != P265_OK) {
+      return err;
+    }
+
+    err = check_pending_NAL_size();
+    if (err != P265_OK) {
+      return err;
+    }
+  }
+
+  return P265_OK;
+}
+
+
+P265_error NAL_Parser::check_pending_NAL_size()
+{
+  NAL_unit* nal = pending_input_NAL;
+
+  if (nal == NULL || input_push_state < 5) {
+    return P265_OK;
+  }
+
+  bool vcl = (nal->fragment > 0 || ((nal->data()[0] >> 1) & 0x3F) < 32);
+
+  if (VCL_fragment_size > 0 && vcl) {
+    if (static_cast<int>(nal->size()) < VCL_fragment_size) {
+      return P265_OK;
+    }
+
+    // emit what we have as a fragment and continue with the next one
+
+    NAL_unit* next = alloc_NAL_unit(VCL_fragment_size + MIN_INPUT_SLICE_SIZE + 3);
+    if (next == NULL) {
+      return P265_ERROR_OUT_OF_MEMORY;
+    }
+
+    if (nal->fragment == 0) {
+      nal->fragment = 1;
+
+      // continuation fragments have no NAL header, keep it for them
+      const unsigned char* h = nal->data();
+      nal->header.set((h[0] >> 1) & 0x3F, ((h[0] & 1) << 5) | (h[1] >> 3), (h[1] & 7) - 1);
+    }
+
+    next->header = nal->header;
+    next->pts = nal->pts;
+    next->user_data = nal->user_data;
+    next->stream_offset = nal->stream_offset;
+    next->fragment = nal->fragment + 1;
+
+    if (!complete_NAL(nal, pending_NAL_flags)) {
+      free_NAL_unit(nal);
+    }
+
+    pending_input_NAL = next;
+  }
+  else if (max_NAL_size > 0 && static_cast<int>(nal->size()) > max_NAL_size) {
+
+    // drop the payload, keep only the header for the handler
+
+    pending_NAL_flags |= P265_NAL_HANDLER_DISCARD;
+    nal->set_size(2);
+    num_oversized_NALs++;
+  }
+
+  return P265_OK;
+}
+
+
+P265_error NAL_Parser::push_data_slice(const unsigned char* data, int len,
+                                        P265_PTS pts, const std::shared_ptr<void>& user_data)
+{
   if (pending_input_NAL == NULL) {
     pending_input_NAL = alloc_NAL_unit(len+3);
     if (pending_input_NAL == NULL) {
@@ -298,12 +578,16 @@ P265_error NAL_Parser::push_data(const unsigned char* data, int len,
       else { input_push_state=0; }
       break;
     case 2:
-      if      (*data == 1) { input_push_state=3; } // nal->clear_skipped_bytes(); }
+      if      (*data == 1) {
+        input_push_state=3;
+        nal->stream_offset = input_offset + i + 1;
+      }
       else if (*data == 0) { } // *out++ = 0; }
       else { input_push_state=0; }
       break;
     case 3:
       *out++ = *data;
+      pending_NAL_flags = handler_flags[(*data >> 1) & 0x3F];
       input_push_state = 4;
       break;
     case 4:
@@ -313,25 +597,46 @@ P265_error NAL_Parser::push_data(const unsigned char* data, int len,
 
     case 5:
       if (*data==0) { input_push_state=6; }
-      else { *out++ = *data; }
+      else if (!(pending_NAL_flags & P265_NAL_HANDLER_DISCARD)) { *out++ = *data; }
+      else {
+        // payload is not stored, skip to the next zero byte (the loop advances one more byte)
+        const unsigned char* zero = (const unsigned char*)memchr(data, 0, len-i);
+        int n = (zero ? (int)(zero-data) : len-i) - 1;
+        data += n;
+        i += n;
+      }
       break;
 
+    // In discard mode, only the zeros for start code detection are counted (in the state).
+
     case 6:
       if (*data==0) { input_push_state=7; }
       else {
-        *out++ = 0;
-        *out++ = *data;
+        if (!(pending_NAL_flags & P265_NAL_HANDLER_DISCARD)) {
+          *out++ = 0;
+          *out++ = *data;
+        }
         input_push_state=5;
       }
       break;
 
     case 7:
-      if      (*data==0) { *out++ = 0; }
+      if      (*data==0) {
+        if (!(pending_NAL_flags & P265_NAL_HANDLER_DISCARD)) { *out++ = 0; }
+      }
+      else if ((pending_NAL_flags & P265_NAL_HANDLER_DISCARD) && *data != 1) {
+        input_push_state=5;
+      }
       else if (*data==3) {
         *out++ = 0; *out++ = 0; input_push_state=5;
 
-        // remember which byte we removed
-        nal->insert_skipped_byte((out - nal->data()) + nal->num_skipped_bytes());
+        if (pending_NAL_flags & P265_NAL_HANDLER_NO_DEESCAPE) {
+          *out++ = 3;
+        }
+        else {
+          // remember which byte we removed
+          nal->insert_skipped_byte((out - nal->data()) + nal->num_skipped_bytes());
+        }
       }
       else if (*data==1) {
 
@@ -346,20 +651,32 @@ P265_error NAL_Parser::push_data(const unsigned char* data, int len,
 #endif
 
         nal->set_size(out - nal->data());;
+        nal->last_fragment = (nal->fragment != 0);
+
+        // push this NAL decoder queue (or pass it to its handler)
 
-        // push this NAL decoder queue
-        push_to_NAL_queue(nal);
+        if (complete_NAL(nal, pending_NAL_flags)) {
 
+          // initialize new, empty NAL unit
 
-        // initialize new, empty NAL unit
+          pending_input_NAL = alloc_NAL_unit(len+3);
+          if (pending_input_NAL == NULL) {
+            return P265_ERROR_OUT_OF_MEMORY;
+          }
+        }
+        else {
+          // NAL was consumed, reuse it
 
-        pending_input_NAL = alloc_NAL_unit(len+3);
-        if (pending_input_NAL == NULL) {
-          return P265_ERROR_OUT_OF_MEMORY;
+          nal->clear();
+          if (!nal->resize(len+3)) {
+            return P265_ERROR_OUT_OF_MEMORY;
+          }
         }
+
         pending_input_NAL->pts = pts;
         pending_input_NAL->user_data = user_data;
         nal = pending_input_NAL;
+        nal->stream_offset = input_offset + i + 1;
         out = nal->data();
 
         input_push_state=3;
@@ -379,10 +696,76 @@ P265_error NAL_Parser::push_data(const unsigned char* data, int len,
   }
 
   nal->set_size(out - nal->data());
+  input_offset += len;
   return P265_OK;
 }
 
 
+bool NAL_Parser::deliver_unqueued_NAL(const unsigned char* data, int len,
+                                      P265_PTS pts, void* user_data)
+{
+  if (max_NAL_size > 0 && len > max_NAL_size) {
+    num_oversized_NALs++;
+    input_offset += len;
+    nal_counter++;
+    return true;
+  }
+
+  // zero-copy delivery to a handler that does not need unescaped data
+
+  int type = (len > 0 ? (data[0] >> 1) & 0x3F : 0);
+  int flags = handler_flags[type];
+
+  if (handlers[type] && (flags & (P265_NAL_HANDLER_NO_DEESCAPE | P265_NAL_HANDLER_DISCARD))) {
+    NAL_view view;
+    view.data = data;
+    view.size = ((flags & P265_NAL_HANDLER_DISCARD) ? libP265_min(len, 2) : len);
+    view.nal_unit_type = type;
+    view.nuh_layer_id  = (len >= 2 ? ((data[0] & 1) << 5) | (data[1] >> 3) : 0);
+    view.temporal_id   = (len >= 2 ? (data[1] & 7) - 1 : 0);
+    view.escaped = true;
+    view.payload_skipped = (flags & P265_NAL_HANDLER_DISCARD) != 0;
+    view.pts = pts;
+    view.user_data = user_data;
+    view.stream_offset = input_offset;
+    view.nal_index = nal_counter;
+    view.fragment = 0;
+    view.last_fragment = false;
+
+    if (handlers[type]->on_NAL(view) || (flags & P265_NAL_HANDLER_DISCARD)) {
+      input_offset += len;
+      nal_counter++;
+      return true;
+    }
+  }
+  else if (flags & P265_NAL_HANDLER_DISCARD) {
+    input_offset += len;
+    nal_counter++;
+    return true;
+  }
+
+  return false;
+}
+
+
+void NAL_Parser::queue_escaped_NAL(NAL_unit* nal)
+{
+  int type = (nal->size() > 0 ? (nal->data()[0] >> 1) & 0x3F : 0);
+  int flags = handler_flags[type];
+
+  nal->stream_offset = input_offset;
+  input_offset += nal->size();
+
+  if (!(flags & P265_NAL_HANDLER_NO_DEESCAPE)) {
+    nal->remove_stuffing_bytes();
+  }
+
+  if (!complete_NAL(nal, flags)) {
+    free_NAL_unit(nal);
+  }
+}
+
+
 P265_error NAL_Parser::push_NAL(const unsigned char* data, int len,
                                  P265_PTS pts, std::shared_ptr<void> user_data)
 {
@@ -392,6 +775,14 @@ P265_error NAL_Parser::push_NAL(const unsigned char* data, int len,
 
   end_of_frame = false;
 
+  if (is_input_blocked()) {
+    return P265_ERROR_INPUT_BUFFER_FULL;
+  }
+
+  if (deliver_unqueued_NAL(data, len, pts, user_data.get())) {
+    return P265_OK;
+  }
+
   NAL_unit* nal = alloc_NAL_unit(len);
   if (nal == NULL || !nal->set_data(data, len)) {
     free_NAL_unit(nal);
@@ -400,14 +791,28 @@ P265_error NAL_Parser::push_NAL(const unsigned char* data, int len,
   nal->pts = pts;
   nal->user_data = user_data;
 
-  nal->remove_stuffing_bytes();
-
-  push_to_NAL_queue(nal);
+  queue_escaped_NAL(nal);
 
   return P265_OK;
 }
 
 
+void NAL_Parser::push_NAL(NAL_unit* nal)
+{
+  assert(pending_input_NAL == NULL);
+
+  end_of_frame = false;
+
+  if (deliver_unqueued_NAL(nal->data(), static_cast<int>(nal->size()),
+                           nal->pts, nal->user_data.get())) {
+    free_NAL_unit(nal);
+    return;
+  }
+
+  queue_escaped_NAL(nal);
+}
+
+
 P265_error NAL_Parser::flush_data()
 {
   if (pending_input_NAL) {
@@ -416,12 +821,15 @@ P265_error NAL_Parser::flush_data()
 
     // append bytes that are implied by the push state
 
-    if (input_push_state==6) {
+    if (pending_NAL_flags & P265_NAL_HANDLER_DISCARD) {
+      // payload is not stored
+    }
+    else if (input_push_state==6) {
       if (!nal->append(null,1)) {
         return P265_ERROR_OUT_OF_MEMORY;
       }
     }
-    if (input_push_state==7) {
+    else if (input_push_state==7) {
       if (!nal->append(null,2)) {
         return P265_ERROR_OUT_OF_MEMORY;
       }
@@ -431,7 +839,11 @@ P265_error NAL_Parser::flush_data()
     // only push the NAL if it contains at least the NAL header
 
     if (input_push_state>=5) {
-      push_to_NAL_queue(nal);
+      nal->last_fragment = (nal->fragment != 0);
+
+      if (!complete_NAL(nal, pending_NAL_flags)) {
+        free_NAL_unit(nal);
+      }
       pending_input_NAL = NULL;
     }
 
@@ -461,4 +873,87 @@ void NAL_Parser::remove_pending_input_data()
   nBytes_in_NAL_queue = 0;
 }
 
+
+void NAL_Parser::save_state(snapshot_writer& w) const
+{
+  w.put_u8(end_of_stream);
+  w.put_u8(end_of_frame);
+  w.put_u8(static_cast<uint8_t>(input_push_state));
+  w.put_i64(input_offset);
+  w.put_i64(nal_counter);
+  w.put_u32(static_cast<uint32_t>(pending_NAL_flags));
+  w.put_i64(num_oversized_NALs);
+
+  w.put_u8(pending_input_NAL != NULL);
+  if (pending_input_NAL) {
+    pending_input_NAL->save_state(w);
+  }
+
+  std::queue<NAL_unit*> queue = NAL_queue;
+
+  w.put_u32(static_cast<uint32_t>(queue.size()));
+  while (!queue.empty()) {
+    queue.front()->save_state(w);
+    queue.pop();
+  }
+}
+
+
+P265_error NAL_Parser::restore_state(snapshot_reader& r)
+{
+  remove_pending_input_data();
+
+  end_of_stream      = r.get_u8() != 0;
+  end_of_frame       = r.get_u8() != 0;
+  input_push_state   = r.get_u8();
+  input_offset       = r.get_i64();
+  nal_counter        = r.get_i64();
+  pending_NAL_flags  = static_cast<int>(r.get_u32());
+  num_oversized_NALs = r.get_i64();
+
+  if (input_push_state > 7) {
+    return P265_ERROR_PARAMETER_PARSING;
+  }
+
+  if (r.get_u8()) {
+    pending_input_NAL = alloc_NAL_unit(0);
+    if (pending_input_NAL == NULL) {
+      return P265_ERROR_OUT_OF_MEMORY;
+    }
+
+    if (!pending_input_NAL->restore_state(r)) {
+      remove_pending_input_data();
+      return (r.ok() ? P265_ERROR_OUT_OF_MEMORY : P265_ERROR_PARAMETER_PARSING);
+    }
+  }
+
+  // The NALs already went through the handlers and the SEI extractor before the snapshot.
+
+  uint32_t nQueued = r.get_u32();
+  for (uint32_t i=0; i<nQueued && r.ok(); i++) {
+    NAL_unit* nal = alloc_NAL_unit(0);
+    if (nal == NULL) {
+      remove_pending_input_data();
+      return P265_ERROR_OUT_OF_MEMORY;
+    }
+
+    if (!nal->restore_state(r)) {
+      free_NAL_unit(nal);
+      remove_pending_input_data();
+      return (r.ok() ? P265_ERROR_OUT_OF_MEMORY : P265_ERROR_PARAMETER_PARSING);
+    }
+
+    NAL_queue.push(nal);
+    nBytes_in_NAL_queue += nal->size();
+  }
+
+  if (!r.ok()) {
+    remove_pending_input_data();
+    return P265_ERROR_PARAMETER_PARSING;
+  }
+
+  return P265_OK;
+}
+
+
 END_NAMESPACE_LIBP265
@@ -0,0 +1,391 @@
+/*
+ * H.265 video codec parser.
+ * Copyright (c) 2023 John Willard <john.willard@shotover.com>
+ *
+ * This file is part of libp265.
+ *
+ * libp265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libp265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libp265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libp265/nal-source.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <io.h>
+#endif
+
+BEGIN_NAMESPACE_LIBP265
+
+// --- memory ---
+
+memory_NAL_source::memory_NAL_source(const unsigned char* data, size_t size, int block_size)
+  : data(data), size(size), pos(0), block_size(block_size)
+{
+}
+
+
+int memory_NAL_source::next_block(const unsigned char** out)
+{
+  size_t n = libP265_min(size-pos, (size_t)block_size);
+
+  *out = data + pos;
+  pos += n;
+
+  return static_cast<int>(n);
+}
+
+
+
+// --- file descriptor ---
+
+fd_NAL_source::fd_NAL_source(int fd, bool close_fd, int block_size)
+  : fd(fd), close_fd(close_fd), buffer(block_size)
+{
+}
+
+
+fd_NAL_source::~fd_NAL_source()
+{
+  if (close_fd) {
+    close(fd);
+  }
+}
+
+
+int fd_NAL_source::next_block(const unsigned char** out)
+{
+  for (;;) {
+    int n = static_cast<int>(read(fd, buffer.data(), static_cast<unsigned int>(buffer.size())));
+
+    if (n >= 0) {
+      *out = buffer.data();
+      return n;
+    }
+
+    if (errno == EINTR) {
+      continue;
+    }
+
+#ifndef _WIN32
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      return P265_SOURCE_WOULD_BLOCK;
+    }
+#endif
+
+    return P265_SOURCE_ERROR;
+  }
+}
+
+
+
+// --- mapped file ---
+
+mmap_NAL_source::mmap_NAL_source(const char* filename, int block_size)
+  : data(NULL), size(0), pos(0), block_size(block_size), mapped(false), failed(true)
+{
+#ifndef _WIN32
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    return;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == 0) {
+    size = st.st_size;
+
+    if (size == 0) {
+      failed = false;
+    }
+    else {
+      void* p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        madvise(p, size, MADV_SEQUENTIAL);
+        data = (const unsigned char*)p;
+        mapped = true;
+        failed = false;
+      }
+    }
+  }
+
+  close(fd);
+#else
+  FILE* fh = fopen(filename, "rb");
+  if (fh == NULL) {
+    return;
+  }
+
+  fseek(fh, 0, SEEK_END);
+  long len = ftell(fh);
+  fseek(fh, 0, SEEK_SET);
+
+  if (len > 0) {
+    unsigned char* buf = new unsigned char[len];
+    if (fread(buf, 1, len, fh) == (size_t)len) {
+      data = buf;
+      size = len;
+      failed = false;
+    }
+    else {
+      delete[] buf;
+    }
+  }
+  else if (len == 0) {
+    failed = false;
+  }
+
+  fclose(fh);
+#endif
+}
+
+
+mmap_NAL_source::~mmap_NAL_source()
+{
+#ifndef _WIN32
+  if (mapped) {
+    munmap((void*)data, size);
+  }
+#else
+  delete[] data;
+#endif
+}
+
+
+int mmap_NAL_source::next_block(const unsigned char** out)
+{
+  if (failed) {
+    return P265_SOURCE_ERROR;
+  }
+
+  size_t n = libP265_min(size-pos, (size_t)block_size);
+
+  *out = data + pos;
+  pos += n;
+
+  return static_cast<int>(n);
+}
+
+
+
+// --- NAL range ---
+
+#define RANGE_RUNNING 1
+
+NAL_range::NAL_range(NAL_Parser* parser, NAL_source* source)
+  : parser(parser), source(source), current(NULL), status(RANGE_RUNNING)
+{
+}
+
+
+NAL_range::NAL_range(NAL_range&& r)
+  : parser(r.parser), source(r.source), current(r.current), status(r.status)
+{
+  r.current = NULL;
+}
+
+
+NAL_range::~NAL_range()
+{
+  parser->free_NAL_unit(current);
+}
+
+
+NAL_range::iterator NAL_range::begin()
+{
+  if (current || fetch()) {
+    return iterator(this);
+  }
+  else {
+    return end();
+  }
+}
+
+
+bool NAL_range::fetch()
+{
+  parser->free_NAL_unit(current);
+  current = next_NAL();
+
+  return current != NULL;
+}
+
+
+NAL_unit* NAL_range::next_NAL()
+{
+  for (;;) {
+    NAL_unit* nal = parser->pop_from_NAL_queue();
+    if (nal) {
+      return nal;
+    }
+
+    if (status == P265_SOURCE_END_OF_STREAM) {
+      return NULL;
+    }
+
+
+    // parser is empty, read more data
+
+    const unsigned char* data;
+    int n = source->next_block(&data);
+
+    if (n > 0) {
+      status = RANGE_RUNNING;
+
+      if (parser->push_data(data, n, 0) != P265_OK) {
+        status = P265_SOURCE_ERROR;
+        return NULL;
+      }
+    }
+    else if (n == P265_SOURCE_END_OF_STREAM) {
+      parser->flush_data();
+      parser->mark_end_of_stream();
+      status = P265_SOURCE_END_OF_STREAM;
+    }
+    else {
+      status = n;
+      return NULL;
+    }
+  }
+}
+
+
+NAL_range NAL_Parser::nals(NAL_source* source)
+{
+  return NAL_range(this, source);
+}
+
+
+
+// --- access unit range ---
+
+access_unit_range::access_unit_range(NAL_Parser* parser, NAL_source* source)
+  : nals(parser, source), next_index(0)
+{
+  building.has_VCL = false;
+  building.pts = 0;
+  building.index = 0;
+  current.has_VCL = false;
+  current.pts = 0;
+  current.index = 0;
+}
+
+
+access_unit_range::access_unit_range(access_unit_range&& r)
+  : nals(std::move(r.nals)),
+    current(std::move(r.current)),
+    building(std::move(r.building)),
+    next_index(r.next_index)
+{
+  r.current.nals.clear();
+  r.building.nals.clear();
+}
+
+
+access_unit_range::~access_unit_range()
+{
+  release(&current);
+  release(&building);
+}
+
+
+void access_unit_range::release(access_unit* au)
+{
+  for (NAL_unit* nal : au->nals) {
+    nals.parser->free_NAL_unit(nal);
+  }
+
+  au->nals.clear();
+  au->has_VCL = false;
+}
+
+
+access_unit_range::iterator access_unit_range::begin()
+{
+  if (!current.nals.empty() || fetch()) {
+    return iterator(this);
+  }
+  else {
+    return end();
+  }
+}
+
+
+bool access_unit_range::fetch()
+{
+  release(&current);
+
+  for (;;) {
+    NAL_unit* nal = nals.next_NAL();
+
+    if (nal == NULL) {
+      // The last access unit is complete at the end of the stream.
+      // When the source would block, the partial access unit is kept.
+
+      if (nals.at_end_of_stream() && !building.nals.empty()) {
+        std::swap(current, building);
+        return true;
+      }
+
+      return false;
+    }
+
+    bool complete = false;
+
+    // continuation fragments (no NAL header) belong to the current access unit
+    if (nal->size() >= 2 && building.has_VCL && nal->fragment <= 1) {
+      int nal_unit_type = (nal->data()[0] >> 1) & 0x3F;
+
+      if (nal_unit_type < 32) {
+        complete = (nal->size() > 2 && (nal->data()[2] & 0x80)); // first_slice_segment_in_pic_flag
+      }
+      else {
+        complete = startsNewAccessUnit(nal_unit_type);
+      }
+    }
+
+    if (complete) {
+      std::swap(current, building);
+    }
+
+    if (building.nals.empty()) {
+      building.index = next_index++;
+      building.pts = nal->pts;
+    }
+
+    building.nals.push_back(nal);
+
+    if (nal->fragment > 1 || (nal->size() >= 1 && ((nal->data()[0] >> 1) & 0x3F) < 32)) {
+      building.has_VCL = true;
+    }
+
+    if (complete) {
+      return true;
+    }
+  }
+}
+
+
+access_unit_range NAL_Parser::access_units(NAL_source* source)
+{
+  return access_unit_range(this, source);
+}
+
+END_NAMESPACE_LIBP265
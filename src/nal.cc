@@ -108,6 +108,18 @@ bool isSublayerNonReference(uint8_t unit_type)
   }
 }
 
+bool startsNewAccessUnit(uint8_t unit_type)
+{
+  // 7.4.2.4.4: these NAL units start a new access unit when they follow a VCL NAL unit
+  return (unit_type == NAL_UNIT_AUD_NUT ||
+          unit_type == NAL_UNIT_VPS_NUT ||
+          unit_type == NAL_UNIT_SPS_NUT ||
+          unit_type == NAL_UNIT_PPS_NUT ||
+          unit_type == NAL_UNIT_PREFIX_SEI_NUT ||
+          (unit_type >= NAL_UNIT_RESERVED_NVCL41 && unit_type <= NAL_UNIT_RESERVED_NVCL44) ||
+          (unit_type >= 48 && unit_type <= 55));
+}
+
 static const char* NAL_unit_name[] = {
   "TRAIL_N", // 0
   "TRAIL_R",
@@ -69,20 +69,20 @@ bool pps_range_extension::read(bitreader* br, parse_context* ctx, const pic_para
   cross_component_prediction_enabled_flag = get_bits(br,1);
   if (sps->ChromaArrayType != CHROMA_444 &&
       cross_component_prediction_enabled_flag) {
-      ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+      ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "cross_component_prediction_enabled_flag", pps->pic_parameter_set_id);
   }
 
   chroma_qp_offset_list_enabled_flag = get_bits(br,1);
   if (sps->ChromaArrayType == CHROMA_MONO &&
       chroma_qp_offset_list_enabled_flag) {
-      ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+      ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "chroma_qp_offset_list_enabled_flag", pps->pic_parameter_set_id);
   }
 
   if (chroma_qp_offset_list_enabled_flag) {
     uvlc = get_uvlc(br);
     if (uvlc == UVLC_ERROR ||
         uvlc > sps->log2_diff_max_min_luma_coding_block_size) {
-      ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+      ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "diff_cu_chroma_qp_offset_depth", pps->pic_parameter_set_id);
       return false;
     }
 
@@ -92,7 +92,7 @@ bool pps_range_extension::read(bitreader* br, parse_context* ctx, const pic_para
     uvlc = get_uvlc(br);
     if (uvlc == UVLC_ERROR ||
         uvlc > 5) {
-      ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+      ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "chroma_qp_offset_list_len_minus1", pps->pic_parameter_set_id);
       return false;
     }
 
@@ -103,7 +103,7 @@ bool pps_range_extension::read(bitreader* br, parse_context* ctx, const pic_para
       svlc = get_svlc(br);
       if (svlc == UVLC_ERROR ||
           svlc < -12 || svlc > 12) {
-        ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+        ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "cb_qp_offset_list", pps->pic_parameter_set_id);
         return false;
       }
 
@@ -112,7 +112,7 @@ bool pps_range_extension::read(bitreader* br, parse_context* ctx, const pic_para
       svlc = get_svlc(br);
       if (svlc == UVLC_ERROR ||
           svlc < -12 || svlc > 12) {
-        ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+        ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "cr_qp_offset_list", pps->pic_parameter_set_id);
         return false;
       }
 
@@ -124,7 +124,7 @@ bool pps_range_extension::read(bitreader* br, parse_context* ctx, const pic_para
   uvlc = get_uvlc(br);
   if (uvlc == UVLC_ERROR ||
       uvlc > libP265_max(0, sps->BitDepth_Y-10)) {
-    ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+    ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "log2_sao_offset_scale_luma", pps->pic_parameter_set_id);
     return false;
   }
 
@@ -133,7 +133,7 @@ bool pps_range_extension::read(bitreader* br, parse_context* ctx, const pic_para
   uvlc = get_uvlc(br);
   if (uvlc == UVLC_ERROR ||
       uvlc > libP265_max(0, sps->BitDepth_C-10)) {
-    ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+    ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "log2_sao_offset_scale_chroma", pps->pic_parameter_set_id);
     return false;
   }
 
@@ -253,7 +253,7 @@ void pic_parameter_set::set_defaults(enum PresetSet)
   tc_offset   = 0;
 
   pic_scaling_list_data_present_flag = 0;
-  // TODO struct scaling_list_data scaling_list;
+  scaling_list = get_flat_scaling_lists();
 
   lists_modification_present_flag = 0;
   log2_parallel_merge_level = 2;
@@ -277,14 +277,14 @@ bool pic_parameter_set::read(bitreader* br, parse_context* ctx)
   pic_parameter_set_id = uvlc = get_uvlc(br);
   if (uvlc >= P265_MAX_PPS_SETS ||
       uvlc == UVLC_ERROR) {
-    ctx->add_warning(P265_WARNING_NONEXISTING_PPS_REFERENCED, false);
+    ctx->add_diagnostic(P265_WARNING_NONEXISTING_PPS_REFERENCED, "pps_pic_parameter_set_id", -1);
     return false;
   }
 
   seq_parameter_set_id = uvlc = get_uvlc(br);
   if (uvlc >= P265_MAX_SPS_SETS ||
       uvlc == UVLC_ERROR) {
-    ctx->add_warning(P265_WARNING_NONEXISTING_SPS_REFERENCED, false);
+    ctx->add_diagnostic(P265_WARNING_NONEXISTING_SPS_REFERENCED, "pps_seq_parameter_set_id", pic_parameter_set_id);
     return false;
   }
 
@@ -295,28 +295,28 @@ bool pic_parameter_set::read(bitreader* br, parse_context* ctx)
   cabac_init_present_flag = get_bits(br,1);
   num_ref_idx_l0_default_active = uvlc = get_uvlc(br);
   if (uvlc == UVLC_ERROR) {
-    ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+    ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "num_ref_idx_l0_default_active_minus1", pic_parameter_set_id);
     return false;
   }
   num_ref_idx_l0_default_active++;
 
   num_ref_idx_l1_default_active = uvlc = get_uvlc(br);
   if (uvlc == UVLC_ERROR) {
-    ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+    ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "num_ref_idx_l1_default_active_minus1", pic_parameter_set_id);
     return false;
   }
   num_ref_idx_l1_default_active++;
 
 
   if (!ctx->has_sps(seq_parameter_set_id)) {
-    ctx->add_warning(P265_WARNING_NONEXISTING_SPS_REFERENCED, false);
+    ctx->add_diagnostic(P265_WARNING_NONEXISTING_SPS_REFERENCED, "pps_seq_parameter_set_id", pic_parameter_set_id);
     return false;
   }
 
   sps = ctx->get_shared_sps(seq_parameter_set_id);
 
   if ((pic_init_qp = get_svlc(br)) == UVLC_ERROR) {
-    ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+    ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "init_qp_minus26", pic_parameter_set_id);
     return false;
   }
   pic_init_qp += 26;
@@ -327,7 +327,7 @@ bool pic_parameter_set::read(bitreader* br, parse_context* ctx)
 
   if (cu_qp_delta_enabled_flag) {
     if ((diff_cu_qp_delta_depth = get_uvlc(br)) == UVLC_ERROR) {
-      ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+      ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "diff_cu_qp_delta_depth", pic_parameter_set_id);
       return false;
     }
   } else {
@@ -335,12 +335,12 @@ bool pic_parameter_set::read(bitreader* br, parse_context* ctx)
   }
 
   if ((pic_cb_qp_offset = get_svlc(br)) == UVLC_ERROR) {
-    ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+    ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "pps_cb_qp_offset", pic_parameter_set_id);
     return false;
   }
 
   if ((pic_cr_qp_offset = get_svlc(br)) == UVLC_ERROR) {
-    ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+    ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "pps_cr_qp_offset", pic_parameter_set_id);
     return false;
   }
 
@@ -358,7 +358,7 @@ bool pic_parameter_set::read(bitreader* br, parse_context* ctx)
     num_tile_columns = get_uvlc(br);
     if (num_tile_columns == UVLC_ERROR ||
 	num_tile_columns+1 > P265_MAX_TILE_COLUMNS) {
-      ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+      ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "num_tile_columns_minus1", pic_parameter_set_id);
       return false;
     }
     num_tile_columns++;
@@ -366,7 +366,7 @@ bool pic_parameter_set::read(bitreader* br, parse_context* ctx)
     num_tile_rows = get_uvlc(br);
     if (num_tile_rows == UVLC_ERROR ||
 	num_tile_rows+1 > P265_MAX_TILE_ROWS) {
-      ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+      ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "num_tile_rows_minus1", pic_parameter_set_id);
       return false;
     }
     num_tile_rows++;
@@ -381,7 +381,7 @@ bool pic_parameter_set::read(bitreader* br, parse_context* ctx)
         {
           colWidth[i] = get_uvlc(br);
           if (colWidth[i] == UVLC_ERROR) {
-	    ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+	    ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "column_width_minus1", pic_parameter_set_id);
 	    return false;
 	  }
           colWidth[i]++;
@@ -399,7 +399,7 @@ bool pic_parameter_set::read(bitreader* br, parse_context* ctx)
         {
           rowHeight[i] = get_uvlc(br);
           if (rowHeight[i] == UVLC_ERROR) {
-	    ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+	    ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "row_height_minus1", pic_parameter_set_id);
 	    return false;
 	  }
           rowHeight[i]++;
@@ -416,6 +416,12 @@ bool pic_parameter_set::read(bitreader* br, parse_context* ctx)
 
     loop_filter_across_tiles_enabled_flag = get_bits(br,1);
 
+    if (sps->level_limits.level_known &&
+        (num_tile_columns > sps->level_limits.MaxTileCols ||
+         num_tile_rows    > sps->level_limits.MaxTileRows)) {
+      ctx->add_diagnostic(P265_WARNING_PPS_EXCEEDS_LEVEL_LIMITS, "num_tile_columns_minus1", pic_parameter_set_id);
+    }
+
   } else {
     num_tile_columns = 1;
     num_tile_rows    = 1;
@@ -440,14 +446,14 @@ bool pic_parameter_set::read(bitreader* br, parse_context* ctx)
     if (!pic_disable_deblocking_filter_flag) {
       beta_offset = get_svlc(br);
       if (beta_offset == UVLC_ERROR) {
-	ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+	ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "pps_beta_offset_div2", pic_parameter_set_id);
 	return false;
       }
       beta_offset *= 2;
 
       tc_offset   = get_svlc(br);
       if (tc_offset == UVLC_ERROR) {
-	ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+	ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "pps_tc_offset_div2", pic_parameter_set_id);
 	return false;
       }
       tc_offset   *= 2;
@@ -467,19 +473,23 @@ bool pic_parameter_set::read(bitreader* br, parse_context* ctx)
   // must be FALSE
   if (sps->scaling_list_enable_flag==0 &&
       pic_scaling_list_data_present_flag != 0) {
-    ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+    ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "pps_scaling_list_data_present_flag", pic_parameter_set_id);
     return false;
   }
 
   if (pic_scaling_list_data_present_flag) {
-    P265_error err = read_scaling_list(br, sps.get(), &scaling_list, true);
+    std::shared_ptr<scaling_list_data> sclist = std::make_shared<scaling_list_data>();
+
+    P265_error err = read_scaling_list(br, sps.get(), sclist.get(), true);
     if (err != P265_OK) {
-      ctx->add_warning(err, false);
+      ctx->add_diagnostic(err, "scaling_list_data", pic_parameter_set_id);
       return false;
     }
+
+    scaling_list = intern_scaling_lists(sclist);
   }
   else {
-    memcpy(&scaling_list, &sps->scaling_list, sizeof(scaling_list_data));
+    scaling_list = sps->scaling_list;
   }
 
 
@@ -488,7 +498,7 @@ bool pic_parameter_set::read(bitreader* br, parse_context* ctx)
   lists_modification_present_flag = get_bits(br,1);
   log2_parallel_merge_level = get_uvlc(br);
   if (log2_parallel_merge_level == UVLC_ERROR) {
-    ctx->add_warning(P265_WARNING_PPS_HEADER_INVALID, false);
+    ctx->add_diagnostic(P265_WARNING_PPS_HEADER_INVALID, "log2_parallel_merge_level_minus2", pic_parameter_set_id);
     return false;
   }
   log2_parallel_merge_level += 2;
@@ -0,0 +1,713 @@
+/*
+ * H.265 video codec parser.
+ * Copyright (c) 2023 John Willard <john.willard@shotover.com>
+ *
+ * This file is part of libp265.
+ *
+ * libp265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libp265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libp265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libp265/rtp.h"
+#include "libp265/util.h"
+
+#include <algorithm>
+#include <assert.h>
+
+BEGIN_NAMESPACE_LIBP265
+
+static inline int read_u16(const unsigned char* p)
+{
+  return (p[0]<<8) | p[1];
+}
+
+static inline uint32_t read_u32(const unsigned char* p)
+{
+  return ((uint32_t)p[0]<<24) | ((uint32_t)p[1]<<16) | ((uint32_t)p[2]<<8) | p[3];
+}
+
+
+rtp_depacketizer::rtp_depacketizer(NAL_Parser* parser)
+  : parser(parser)
+{
+  max_don_diff = 0;
+  depack_buf_nalus = 0;
+
+  first_packet = true;
+  expected_seq = 0;
+  bad_seq = -1;
+  last_timestamp = 0;
+  ext_timestamp = 0;
+
+  fu_nal = NULL;
+  fu_don = 0;
+  fu_truncated = false;
+
+  first_don = true;
+  last_don = 0;
+  last_abs_don = 0;
+  max_abs_don = 0;
+
+  num_lost_packets = 0;
+  num_late_packets = 0;
+  num_malformed_packets = 0;
+  num_discarded_NALs = 0;
+}
+
+
+rtp_depacketizer::~rtp_depacketizer()
+{
+  if (fu_nal) {
+    parser->free_NAL_unit(fu_nal);
+  }
+
+  for (size_t i=0;i<reorder_buffer.size();i++) {
+    parser->free_NAL_unit(reorder_buffer[i].nal);
+  }
+}
+
+
+void rtp_depacketizer::set_sprop_max_don_diff(int max_don_diff, int depack_buf_nalus)
+{
+  this->max_don_diff = max_don_diff;
+  this->depack_buf_nalus = (depack_buf_nalus > 0 ? depack_buf_nalus : max_don_diff);
+}
+
+
+P265_error rtp_depacketizer::push_packet(const unsigned char* packet, int len,
+                                         std::shared_ptr<void> user_data)
+{
+  if (len < P265_RTP_HEADER_SIZE || (packet[0] >> 6) != 2) {
+    num_malformed_packets++;
+    return P265_OK;
+  }
+
+  bool padding   = (packet[0] & 0x20) != 0;
+  bool extension = (packet[0] & 0x10) != 0;
+  int  csrc_count = packet[0] & 0x0F;
+  bool marker = (packet[1] & 0x80) != 0;
+  uint16_t seq = static_cast<uint16_t>(read_u16(packet+2));
+  uint32_t timestamp = read_u32(packet+4);
+
+  int pos = P265_RTP_HEADER_SIZE + 4*csrc_count;
+  int end = len;
+
+  if (extension) {
+    if (pos+4 > len) {
+      num_malformed_packets++;
+      return P265_OK;
+    }
+
+    pos += 4 + 4*read_u16(packet+pos+2);
+  }
+
+  if (padding) {
+    end -= packet[len-1];
+  }
+
+  if (end < pos) {
+    num_malformed_packets++;
+    return P265_OK;
+  }
+
+  return push_payload(packet+pos, end-pos, seq, timestamp, marker, user_data);
+}
+
+
+P265_error rtp_depacketizer::push_payload(const unsigned char* payload, int len,
+                                          uint16_t sequence_number, uint32_t timestamp,
+                                          bool marker, std::shared_ptr<void> user_data)
+{
+  if (parser->is_input_blocked()) {
+    return P265_ERROR_INPUT_BUFFER_FULL;
+  }
+
+
+  // --- sequence numbers and timestamp ---
+
+  if (first_packet) {
+    first_packet = false;
+    ext_timestamp = timestamp;
+  }
+  else {
+    uint16_t gap = static_cast<uint16_t>(sequence_number - expected_seq);
+
+    if (gap >= 0x8000) {
+      if (sequence_number != bad_seq) {
+        // Late, or a large jump. Resync if the next packet continues from here.
+        if (gap < 0x10000 - P265_RTP_MAX_MISORDER) {
+          bad_seq = static_cast<uint16_t>(sequence_number + 1);
+        }
+
+        num_late_packets++;
+        return P265_OK;
+      }
+
+      // second packet in sequence after the jump: new sequence base
+      // (the packet before it was counted as late)
+      gap--;
+    }
+
+    bad_seq = -1;
+
+    if (gap != 0) {
+      num_lost_packets += gap;
+      discard_FU();
+    }
+
+    ext_timestamp += static_cast<int32_t>(timestamp - last_timestamp);
+  }
+
+  expected_seq = static_cast<uint16_t>(sequence_number + 1);
+  last_timestamp = timestamp;
+
+
+  // --- payload ---
+
+  if (len < 2) {
+    num_malformed_packets++;
+    return P265_OK;
+  }
+
+  int type = (payload[0] >> 1) & 0x3F;
+  P265_error err = P265_OK;
+
+  if (type == P265_RTP_NAL_TYPE_FU) {
+    err = push_FU(payload, len, user_data);
+  }
+  else {
+    // FUs of one NAL must not be interleaved with other packets
+    discard_FU();
+
+    if (type == P265_RTP_NAL_TYPE_AP) {
+      err = push_AP(payload, len, user_data);
+    }
+    else if (type >= P265_RTP_NAL_TYPE_PACI) {
+      // PACI and unspecified types are ignored (RFC 7798, 4.4.4)
+    }
+    else if (uses_DON()) {
+      if (len < 4) {
+        num_malformed_packets++;
+        return P265_OK;
+      }
+
+      err = output_NAL(payload, payload+4, len-4, static_cast<uint16_t>(read_u16(payload+2)),
+                       user_data);
+    }
+    else {
+      err = output_NAL(payload, payload+2, len-2, 0, user_data);
+    }
+  }
+
+  if (marker && reorder_buffer.empty()) {
+    parser->mark_end_of_frame();
+  }
+
+  return err;
+}
+
+
+P265_error rtp_depacketizer::push_AP(const unsigned char* payload, int len,
+                                     const std::shared_ptr<void>& user_data)
+{
+  int pos = 2;
+  uint16_t don = 0;
+  bool first = true;
+
+  while (pos < len) {
+    if (uses_DON()) {
+      if (first) {
+        if (pos+2 > len) { break; }
+        don = static_cast<uint16_t>(read_u16(payload+pos));
+        pos += 2;
+      }
+      else {
+        if (pos+1 > len) { break; }
+        don = static_cast<uint16_t>(don + payload[pos] + 1);
+        pos += 1;
+      }
+    }
+
+    if (pos+2 > len) { break; }
+    int size = read_u16(payload+pos);
+    pos += 2;
+
+    if (size < 2 || pos+size > len) { break; }
+
+    P265_error err = output_NAL(payload+pos, payload+pos+2, size-2, don, user_data);
+    if (err != P265_OK) {
+      return err;
+    }
+
+    pos += size;
+    first = false;
+  }
+
+  if (pos != len) {
+    num_malformed_packets++;
+  }
+
+  return P265_OK;
+}
+
+
+P265_error rtp_depacketizer::push_FU(const unsigned char* payload, int len,
+                                     const std::shared_ptr<void>& user_data)
+{
+  if (len < 3) {
+    num_malformed_packets++;
+    return P265_OK;
+  }
+
+  bool start = (payload[2] & 0x80) != 0;
+  bool end   = (payload[2] & 0x40) != 0;
+  int  type  =  payload[2] & 0x3F;
+  int  pos = 3;
+
+  if (start && end) {
+    num_malformed_packets++;
+    discard_FU();
+    return P265_OK;
+  }
+
+  if (start) {
+    discard_FU();
+
+    if (uses_DON()) {
+      if (len < 5) {
+        num_malformed_packets++;
+        return P265_OK;
+      }
+
+      fu_don = static_cast<uint16_t>(read_u16(payload+3));
+      pos = 5;
+    }
+
+    // NAL header from the payload header, with the type from the FU header
+
+    unsigned char header[2];
+    header[0] = static_cast<unsigned char>((payload[0] & 0x81) | (type << 1));
+    header[1] = payload[1];
+
+    fu_nal = parser->alloc_NAL_unit(2 + 8*(len-pos));
+    if (fu_nal == NULL || !fu_nal->set_data(header, 2)) {
+      parser->free_NAL_unit(fu_nal);
+      fu_nal = NULL;
+      return P265_ERROR_OUT_OF_MEMORY;
+    }
+
+    fu_nal->pts = ext_timestamp;
+    fu_nal->user_data = user_data;
+    fu_truncated = false;
+  }
+  else if (fu_nal == NULL) {
+    // the start of the NAL was lost
+    return P265_OK;
+  }
+
+
+  // append the fragment, but not more than is needed to detect an oversized NAL
+
+  int n = len-pos;
+  int max_NAL_size = parser->get_max_NAL_size();
+
+  if (max_NAL_size > 0 && static_cast<int>(fu_nal->size()) + n > max_NAL_size) {
+    n = libP265_max(0, max_NAL_size + 1 - static_cast<int>(fu_nal->size()));
+    fu_truncated = true;
+  }
+
+  if (n > 0 && !fu_nal->append(payload+pos, n)) {
+    discard_FU();
+    return P265_ERROR_OUT_OF_MEMORY;
+  }
+
+  if (end) {
+    NAL_unit* nal = fu_nal;
+    fu_nal = NULL;
+    output_NAL(nal, fu_don);  // a truncated NAL is counted as oversized by the parser
+  }
+
+  return P265_OK;
+}
+
+
+void rtp_depacketizer::discard_FU()
+{
+  if (fu_nal) {
+    parser->free_NAL_unit(fu_nal);
+    fu_nal = NULL;
+    num_discarded_NALs++;
+  }
+}
+
+
+P265_error rtp_depacketizer::output_NAL(const unsigned char* header,
+                                        const unsigned char* data, int len, uint16_t don,
+                                        const std::shared_ptr<void>& user_data)
+{
+  NAL_unit* nal = parser->alloc_NAL_unit(len+2);
+  if (nal == NULL || !nal->set_data(header, 2) || !nal->append(data, len)) {
+    parser->free_NAL_unit(nal);
+    return P265_ERROR_OUT_OF_MEMORY;
+  }
+
+  nal->pts = ext_timestamp;
+  nal->user_data = user_data;
+
+  output_NAL(nal, don);
+
+  return P265_OK;
+}
+
+
+void rtp_depacketizer::output_NAL(NAL_unit* nal, uint16_t don)
+{
+  if (!uses_DON()) {
+    parser->push_NAL(nal);
+    return;
+  }
+
+  // extend the 16-bit DON, assuming that consecutive NALs are less than 2^15 apart
+
+  int64_t abs_don;
+  if (first_don) {
+    first_don = false;
+    abs_don = don;
+    max_abs_don = abs_don;
+  }
+  else {
+    abs_don = last_abs_don + static_cast<int16_t>(static_cast<uint16_t>(don - last_don));
+  }
+
+  last_don = don;
+  last_abs_don = abs_don;
+  max_abs_don = libP265_max(max_abs_don, abs_don);
+
+  reorder_entry entry;
+  entry.abs_don = abs_don;
+  entry.nal = nal;
+
+  std::vector<reorder_entry>::iterator pos =
+    std::upper_bound(reorder_buffer.begin(), reorder_buffer.end(), entry,
+                     [](const reorder_entry& a, const reorder_entry& b) {
+                       return a.abs_don < b.abs_don;
+                     });
+  reorder_buffer.insert(pos, entry);
+
+  release_reordered_NALs(false);
+}
+
+
+void rtp_depacketizer::release_reordered_NALs(bool all)
+{
+  /* A NAL can be output when the buffer is full, or when no NAL can arrive anymore that
+     precedes it in decoding order. */
+
+  size_t n = 0;
+  while (n < reorder_buffer.size() &&
+         (all ||
+          reorder_buffer.size() - n > static_cast<size_t>(depack_buf_nalus) ||
+          reorder_buffer[n].abs_don + max_don_diff < max_abs_don)) {
+    parser->push_NAL(reorder_buffer[n].nal);
+    n++;
+  }
+
+  reorder_buffer.erase(reorder_buffer.begin(), reorder_buffer.begin() + n);
+}
+
+
+void rtp_depacketizer::flush()
+{
+  discard_FU();
+  release_reordered_NALs(true);
+}
+
+
+// --- packetizer ---
+
+static const unsigned char emulation_prevention_byte = 3;
+
+static inline int escaped_size(const NAL_unit* nal)
+{
+  return static_cast<int>(nal->size()) + nal->num_skipped_bytes();
+}
+
+/* Segments for the bytes [e0,e1) of the escaped NAL. Stops when max_segments are used.
+   With segments==NULL, the segments are only counted. Returns the number of segments
+   and the escaped position that was reached in *e_end. */
+static int escaped_segments(const NAL_unit* nal, int e0, int e1,
+                            rtp_segment* segments, int max_segments, int* e_end)
+{
+  const std::vector<int>& skipped = nal->get_skipped_bytes();
+
+  int k = static_cast<int>(std::lower_bound(skipped.begin(), skipped.end(), e0) - skipped.begin());
+  int e = e0;
+  int n = 0;
+
+  while (e < e1 && n < max_segments) {
+    int next = (k < static_cast<int>(skipped.size()) && skipped[k] < e1) ? skipped[k] : e1;
+
+    if (next > e) {
+      if (segments) {
+        segments[n].data = nal->data() + e - k;
+        segments[n].size = next - e;
+      }
+      n++;
+      e = next;
+    }
+    else {
+      // e is the position of a removed emulation prevention byte
+      if (segments) {
+        segments[n].data = &emulation_prevention_byte;
+        segments[n].size = 1;
+      }
+      n++;
+      e++;
+      k++;
+    }
+  }
+
+  *e_end = e;
+  return n;
+}
+
+
+rtp_packetizer::rtp_packetizer(int max_payload_size)
+  : max_payload_size(max_payload_size)
+{
+  assert(max_payload_size >= P265_RTP_SCRATCH_SIZE);
+
+  max_don_diff = 0;
+  fu_pos = 0;
+  don = 0;
+}
+
+
+void rtp_packetizer::set_sprop_max_don_diff(int max_don_diff)
+{
+  this->max_don_diff = max_don_diff;
+}
+
+
+void rtp_packetizer::push_NAL(const NAL_unit* nal, bool last_in_access_unit)
+{
+  queued_NAL q;
+  q.nal = nal;
+  q.last_in_access_unit = last_in_access_unit;
+  queue.push_back(q);
+}
+
+
+int rtp_packetizer::next_payload(rtp_segment* segments, int max_segments,
+                                 unsigned char* scratch, bool* marker)
+{
+  assert(max_segments >= P265_RTP_MIN_SEGMENTS);
+
+  *marker = false;
+
+  if (queue.empty()) {
+    return 0;
+  }
+
+  if (fu_pos > 0) {
+    return next_FU(segments, max_segments, scratch, marker);
+  }
+
+  int n = next_AP(segments, max_segments, scratch, marker);
+  if (n > 0) {
+    return n;
+  }
+
+
+  // --- single NAL unit packet ---
+
+  const NAL_unit* nal = queue.front().nal;
+  int size = escaped_size(nal);
+
+  if (size + (uses_DON() ? 2 : 0) <= max_payload_size) {
+    int e_end;
+
+    if (uses_DON()) {
+      segments[0].data = nal->data();
+      segments[0].size = 2;
+
+      scratch[0] = static_cast<unsigned char>(don >> 8);
+      scratch[1] = static_cast<unsigned char>(don & 0xFF);
+      segments[1].data = scratch;
+      segments[1].size = 2;
+
+      n = 2 + escaped_segments(nal, 2, size, segments+2, max_segments-2, &e_end);
+    }
+    else {
+      n = escaped_segments(nal, 0, size, segments, max_segments, &e_end);
+    }
+
+    if (e_end == size) {
+      *marker = queue.front().last_in_access_unit;
+      queue.pop_front();
+      don++;
+      return n;
+    }
+
+    // too many emulation prevention bytes for the segment list, send as FUs
+  }
+
+  return next_FU(segments, max_segments, scratch, marker);
+}
+
+
+int rtp_packetizer::next_AP(rtp_segment* segments, int max_segments,
+                            unsigned char* scratch, bool* marker)
+{
+  if (queue.size() < 2 || queue.front().last_in_access_unit) {
+    return 0;
+  }
+
+  // scratch: payload header, [DONL], then before each NAL [DOND] and the NAL size
+
+  int size = 2;
+  int sp = 2;
+  int n = 1;
+  int count = 0;
+
+  int F = 0;
+  int layer_id = 63;
+  int tid_plus1 = 7;
+
+  segments[0].data = scratch;
+  segments[0].size = 2;
+
+  if (uses_DON()) {
+    scratch[sp++] = static_cast<unsigned char>(don >> 8);
+    scratch[sp++] = static_cast<unsigned char>(don & 0xFF);
+    segments[0].size += 2;
+    size += 2;
+  }
+
+  while (count < static_cast<int>(queue.size()) && count < P265_RTP_MAX_AP_NALS) {
+    const queued_NAL& q = queue[count];
+    int nal_size = escaped_size(q.nal);
+    int field_size = ((uses_DON() && count > 0) ? 1 : 0) + 2;
+
+    if (size + field_size + nal_size > max_payload_size) {
+      break;
+    }
+
+    int e_end;
+    int nSegs = escaped_segments(q.nal, 0, nal_size, NULL, max_segments, &e_end);
+    if (e_end != nal_size || n + 1 + nSegs > max_segments) {
+      break;
+    }
+
+    // size field (with the DOND before it), extends the previous scratch segment for the first NAL
+
+    if (count > 0) {
+      segments[n].data = scratch + sp;
+      segments[n].size = field_size;
+      n++;
+
+      if (uses_DON()) {
+        scratch[sp++] = 0; // DON difference minus 1, NALs are sent in decoding order
+      }
+    }
+    else {
+      segments[0].size += 2;
+    }
+
+    scratch[sp++] = static_cast<unsigned char>(nal_size >> 8);
+    scratch[sp++] = static_cast<unsigned char>(nal_size & 0xFF);
+
+    n += escaped_segments(q.nal, 0, nal_size, segments+n, max_segments-n, &e_end);
+    size += field_size + nal_size;
+
+    const unsigned char* h = q.nal->data();
+    F |= h[0] & 0x80;
+    layer_id  = libP265_min(layer_id, ((h[0] & 1) << 5) | (h[1] >> 3));
+    tid_plus1 = libP265_min(tid_plus1, h[1] & 7);
+
+    count++;
+
+    if (q.last_in_access_unit) {
+      break;
+    }
+  }
+
+  if (count < 2) {
+    return 0;
+  }
+
+  scratch[0] = static_cast<unsigned char>(F | (P265_RTP_NAL_TYPE_AP << 1) | (layer_id >> 5));
+  scratch[1] = static_cast<unsigned char>(((layer_id & 0x1F) << 3) | tid_plus1);
+
+  *marker = queue[count-1].last_in_access_unit;
+
+  queue.erase(queue.begin(), queue.begin() + count);
+  don = static_cast<uint16_t>(don + count);
+
+  return n;
+}
+
+
+int rtp_packetizer::next_FU(rtp_segment* segments, int max_segments,
+                            unsigned char* scratch, bool* marker)
+{
+  const NAL_unit* nal = queue.front().nal;
+  int size = escaped_size(nal);
+  bool start = (fu_pos == 0);
+
+  // payload header and FU header
+
+  const unsigned char* h = nal->data();
+  int type = (h[0] >> 1) & 0x3F;
+
+  scratch[0] = static_cast<unsigned char>((h[0] & 0x81) | (P265_RTP_NAL_TYPE_FU << 1));
+  scratch[1] = h[1];
+  scratch[2] = static_cast<unsigned char>(type | (start ? 0x80 : 0));
+
+  int header_size = 3;
+
+  if (start) {
+    fu_pos = 2; // the NAL header is not sent
+
+    if (uses_DON()) {
+      scratch[3] = static_cast<unsigned char>(don >> 8);
+      scratch[4] = static_cast<unsigned char>(don & 0xFF);
+      header_size = 5;
+    }
+  }
+
+  segments[0].data = scratch;
+  segments[0].size = header_size;
+
+  // the first FU must not contain the whole NAL
+  int e_max = libP265_min(size - (start ? 1 : 0), fu_pos + max_payload_size - header_size);
+
+  int e_end;
+  int n = 1 + escaped_segments(nal, fu_pos, e_max, segments+1, max_segments-1, &e_end);
+
+  fu_pos = e_end;
+
+  if (fu_pos == size) {
+    scratch[2] |= 0x40;
+    *marker = queue.front().last_in_access_unit;
+
+    queue.pop_front();
+    fu_pos = 0;
+    don++;
+  }
+
+  return n;
+}
+
+
+END_NAMESPACE_LIBP265
@@ -20,6 +20,8 @@
 
 #include "libp265/scan.h"
 
+#include <mutex>
+
 BEGIN_NAMESPACE_LIBP265
 
 static position scan0 = { 0,0 };
@@ -134,7 +136,7 @@ static void fill_scan_pos(scan_position* pos, int x,int y,int scanIdx, int log2T
 }
 
 
-void init_scan_orders()
+static void build_scan_orders()
 {
   for (int log2size=1;log2size<=5;log2size++)
     {
@@ -153,4 +155,11 @@ void init_scan_orders()
           }
 }
 
+
+void init_scan_orders()
+{
+  static std::once_flag once;
+  std::call_once(once, build_scan_orders);
+}
+
 END_NAMESPACE_LIBP265
@@ -0,0 +1,201 @@
+/*
+ * H.265 video codec parser.
+ * Copyright (c) 2023 John Willard <john.willard@shotover.com>
+ *
+ * This file is part of libp265.
+ *
+ * libp265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libp265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libp265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libp265/sei-metadata.h"
+
+#include <string.h>
+
+BEGIN_NAMESPACE_LIBP265
+
+#define T35_PROVIDER_CODE_SAMSUNG  0x003C  // HDR10+
+#define T35_PROVIDER_ORIENTED_CODE_HDR10PLUS 0x0001
+#define T35_APPLICATION_ID_ST2094_40 4
+
+#define ATSC_USER_IDENTIFIER_GA94  0x47413934
+#define ATSC_USER_DATA_TYPE_CC_DATA     0x03
+#define ATSC_USER_DATA_TYPE_ST2094_10   0x09
+
+
+sei_metadata_extractor::sei_metadata_extractor(int capacity, unsigned int _types)
+  : types(_types), head(0), tail(0), dropped(0)
+{
+  uint32_t n = 1;
+  while (n < (uint32_t)capacity) { n <<= 1; }
+
+  ring.resize(n);
+  mask = n-1;
+}
+
+
+sei_metadata_record* sei_metadata_extractor::begin_record(enum sei_metadata_type type,
+                                                          const NAL_unit* nal)
+{
+  uint64_t h = head.load(std::memory_order_relaxed);
+  if (h - tail.load(std::memory_order_acquire) > mask) {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return NULL;
+  }
+
+  sei_metadata_record* rec = &ring[h & mask];
+  rec->type = type;
+  rec->pts  = nal->pts;
+  rec->nal_unit_type = (nal->data()[0] >> 1) & 0x3F;
+  rec->size = 0;
+  rec->truncated = false;
+  rec->cc_count = 0;
+  rec->em_data = 0;
+  rec->process_cc_data_flag = false;
+
+  return rec;
+}
+
+
+void sei_metadata_extractor::store_raw(enum sei_metadata_type type, const NAL_unit* nal,
+                                       const uint8_t* data, int size)
+{
+  sei_metadata_record* rec = begin_record(type, nal);
+  if (rec==NULL) {
+    return;
+  }
+
+  if (size > P265_SEI_METADATA_MAX_SIZE) {
+    size = P265_SEI_METADATA_MAX_SIZE;
+    rec->truncated = true;
+  }
+
+  memcpy(rec->data, data, size);
+  rec->size = size;
+
+  commit_record();
+}
+
+
+void sei_metadata_extractor::process_user_data_registered(const sei_payload& payload,
+                                                          const NAL_unit* nal)
+{
+  sei_user_data_registered ud;
+  if (parse_sei_user_data_registered(payload, &ud) != P265_OK ||
+      ud.itu_t_t35_country_code != ITU_T_T35_COUNTRY_CODE_US ||
+      ud.size < 2) {
+    return;
+  }
+
+  const uint8_t* p = ud.data;
+  int provider_code = (p[0]<<8) | p[1];
+
+  if (provider_code == T35_PROVIDER_CODE_SAMSUNG) {
+    if ((types & sei_metadata_hdr10plus) &&
+        ud.size >= 5 &&
+        ((p[2]<<8) | p[3]) == T35_PROVIDER_ORIENTED_CODE_HDR10PLUS &&
+        p[4] == T35_APPLICATION_ID_ST2094_40) {
+      store_raw(sei_metadata_hdr10plus, nal, ud.data, ud.size);
+    }
+  }
+  else if (provider_code == ITU_T_T35_PROVIDER_CODE_ATSC && ud.size >= 7) {
+    uint32_t user_identifier = ((uint32_t)p[2]<<24) | (p[3]<<16) | (p[4]<<8) | p[5];
+    if (user_identifier != ATSC_USER_IDENTIFIER_GA94) {
+      return;
+    }
+
+    if (p[6] == ATSC_USER_DATA_TYPE_CC_DATA && (types & sei_metadata_cea708_captions)) {
+      sei_cc_data cc;
+      if (parse_cea708_cc_data(&ud, &cc) != P265_OK) {
+        return;
+      }
+
+      sei_metadata_record* rec = begin_record(sei_metadata_cea708_captions, nal);
+      if (rec==NULL) {
+        return;
+      }
+
+      rec->cc_count = cc.cc_count;
+      rec->em_data  = cc.em_data;
+      rec->process_cc_data_flag = cc.process_cc_data_flag;
+      rec->size = 3*cc.cc_count;  // at most 93 bytes
+      memcpy(rec->data, cc.cc_data, rec->size);
+
+      commit_record();
+    }
+    else if (p[6] == ATSC_USER_DATA_TYPE_ST2094_10 && (types & sei_metadata_st2094_10)) {
+      store_raw(sei_metadata_st2094_10, nal, ud.data, ud.size);
+    }
+  }
+}
+
+
+void sei_metadata_extractor::process_NAL(const NAL_unit* nal)
+{
+  // continuation fragments of VCL NALs have no NAL header
+  if (nal->size() < 3 || nal->fragment > 1) {
+    return;
+  }
+
+  int nal_unit_type = (nal->data()[0] >> 1) & 0x3F;
+  if (nal_unit_type != NAL_UNIT_PREFIX_SEI_NUT &&
+      nal_unit_type != NAL_UNIT_SUFFIX_SEI_NUT) {
+    return;
+  }
+
+  sei_message_iterator iter(nal);
+  sei_payload payload;
+
+  while (iter.next(&payload)) {
+    switch (payload.payload_type) {
+    case sei_payload_type_user_data_registered_itu_t_t35:
+      if (types & (sei_metadata_cea708_captions | sei_metadata_hdr10plus | sei_metadata_st2094_10)) {
+        process_user_data_registered(payload, nal);
+      }
+      break;
+
+    case sei_payload_type_mastering_display_colour_volume:
+      if (types & sei_metadata_mastering_display) {
+        sei_mastering_display_colour_volume mdcv;
+        if (parse_sei_mastering_display_colour_volume(payload, &mdcv) == P265_OK) {
+          sei_metadata_record* rec = begin_record(sei_metadata_mastering_display, nal);
+          if (rec) {
+            rec->mastering_display = mdcv;
+            rec->size = sizeof(mdcv);
+            commit_record();
+          }
+        }
+      }
+      break;
+
+    case sei_payload_type_content_light_level_info:
+      if (types & sei_metadata_content_light_level) {
+        sei_content_light_level_info cll;
+        if (parse_sei_content_light_level_info(payload, &cll) == P265_OK) {
+          sei_metadata_record* rec = begin_record(sei_metadata_content_light_level, nal);
+          if (rec) {
+            rec->content_light_level = cll;
+            rec->size = sizeof(cll);
+            commit_record();
+          }
+        }
+      }
+      break;
+
+    default:
+      break;
+    }
+  }
+}
+
+END_NAMESPACE_LIBP265
@@ -20,11 +20,21 @@
 
 #include "libp265/sei.h"
 #include "libp265/util.h"
-#include "libp265/md5.h"
+#include "libp265/md5-multibuffer.h"
 #include "libp265/sps.h"
 #include "libp265/context.h"
+#include "libp265/nal-parser.h"
+#include "libp265/threads.h"
 
 #include <assert.h>
+#include <string.h>
+#include <vector>
+#include <thread>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_X86_SIMD 1
+#include <immintrin.h>
+#endif
 
 BEGIN_NAMESPACE_LIBP265
 
@@ -95,6 +105,509 @@ static void dump_sei_decoded_picture_hash(const sei_message* sei,
 }
 
 
+// --- SEI payload parsing ---
+
+static void init_payload_reader(bitreader* br, const sei_payload& payload)
+{
+  bitreader_init(br, const_cast<unsigned char*>(payload.payload), payload.payload_size);
+}
+
+// The reader ran past the end of the payload.
+static inline bool payload_overrun(const bitreader* br)
+{
+  return br->nextbits_cnt < 0;
+}
+
+static inline uint32_t get_bits_u32(bitreader* br, int n)
+{
+  return (uint32_t)get_bits(br,n);
+}
+
+/* payload_extension_present() (D.2.1): there are more bits in front of the
+   payload_bit_equal_to_one that terminates the payload. */
+static bool payload_extension_present(const bitreader* br, const sei_payload& payload)
+{
+  int64_t pos = (int64_t)payload.payload_size*8 - ((int64_t)br->bytes_remaining*8 + br->nextbits_cnt);
+
+  int last = payload.payload_size-1;
+  while (last>=0 && payload.payload[last]==0) { last--; }
+  if (last<0) { return false; }
+
+  int bit = 7;
+  uint8_t v = payload.payload[last];
+  while ((v&1)==0) { v>>=1; bit--; }
+
+  return pos < (int64_t)last*8 + bit;
+}
+
+static inline uint16_t read_u16(const uint8_t* p) { return (uint16_t)((p[0]<<8) | p[1]); }
+static inline uint32_t read_u32(const uint8_t* p) {
+  return ((uint32_t)p[0]<<24) | ((uint32_t)p[1]<<16) | ((uint32_t)p[2]<<8) | p[3];
+}
+
+
+int peek_sei_buffering_period_sps_id(const sei_payload& payload)
+{
+  bitreader br;
+  init_payload_reader(&br, payload);
+
+  int id = get_uvlc(&br);
+  if (id==UVLC_ERROR || id >= P265_MAX_SPS_SETS || payload_overrun(&br)) {
+    return -1;
+  }
+
+  return id;
+}
+
+
+static void read_initial_cpb_removal(bitreader* br, sei_initial_cpb_removal* entries, int n,
+                                     const hrd_common_info& hrd, bool alt)
+{
+  int len = hrd.initial_cpb_removal_delay_length_minus1+1;
+
+  for (int i=0;i<n;i++) {
+    entries[i].initial_cpb_removal_delay  = get_bits_u32(br,len);
+    entries[i].initial_cpb_removal_offset = get_bits_u32(br,len);
+
+    if (alt) {
+      entries[i].initial_alt_cpb_removal_delay  = get_bits_u32(br,len);
+      entries[i].initial_alt_cpb_removal_offset = get_bits_u32(br,len);
+    }
+  }
+}
+
+
+P265_error parse_sei_buffering_period(const sei_payload& payload, sei_buffering_period* bp,
+                                      const seq_parameter_set* sps)
+{
+  *bp = sei_buffering_period();
+
+  bitreader br;
+  init_payload_reader(&br, payload);
+
+  int id = get_uvlc(&br);
+  if (id==UVLC_ERROR || id >= P265_MAX_SPS_SETS) {
+    return P265_ERROR_PARAMETER_PARSING;
+  }
+  bp->bp_seq_parameter_set_id = id;
+
+  if (sps==NULL) {
+    return P265_WARNING_SPS_MISSING_CANNOT_DECODE_SEI;
+  }
+
+  const video_usability_information& vui = sps->get_vui();
+  if (!vui.vui_hrd_parameters_present_flag) {
+    return P265_ERROR_CANNOT_PROCESS_SEI;
+  }
+
+  const hrd_common_info& hrd = vui.hrd_common;
+  int au_len  = hrd.au_cpb_removal_delay_length_minus1+1;
+  int dpb_len = hrd.dpb_output_delay_length_minus1+1;
+
+  if (!hrd.sub_pic_hrd_params_present_flag) {
+    bp->irap_cpb_params_present_flag = get_bits(&br,1);
+  }
+
+  if (bp->irap_cpb_params_present_flag) {
+    bp->cpb_delay_offset = get_bits_u32(&br,au_len);
+    bp->dpb_delay_offset = get_bits_u32(&br,dpb_len);
+  }
+
+  bp->concatenation_flag = get_bits(&br,1);
+  bp->au_cpb_removal_delay_delta_minus1 = get_bits_u32(&br,au_len);
+
+  bp->NalHrdBpPresentFlag = hrd.nal_hrd_parameters_present_flag;
+  bp->VclHrdBpPresentFlag = hrd.vcl_hrd_parameters_present_flag;
+
+  if (bp->NalHrdBpPresentFlag || bp->VclHrdBpPresentFlag) {
+    std::shared_ptr<const hrd_parameters> params = vui.get_hrd_parameters();
+    if (!params || params->sub_layers.empty()) {
+      return P265_ERROR_CANNOT_PROCESS_SEI;
+    }
+
+    bp->CpbCnt = params->sub_layers[0].cpb_cnt_minus1+1;
+  }
+
+  bool alt = hrd.sub_pic_hrd_params_present_flag || bp->irap_cpb_params_present_flag;
+
+  if (bp->NalHrdBpPresentFlag) {
+    read_initial_cpb_removal(&br, bp->nal, bp->CpbCnt, hrd, alt);
+  }
+
+  if (bp->VclHrdBpPresentFlag) {
+    read_initial_cpb_removal(&br, bp->vcl, bp->CpbCnt, hrd, alt);
+  }
+
+  if (payload_overrun(&br)) {
+    return P265_ERROR_PARAMETER_PARSING;
+  }
+
+  if (payload_extension_present(&br, payload)) {
+    bp->use_alt_cpb_params_flag = get_bits(&br,1);
+  }
+
+  return P265_OK;
+}
+
+
+P265_error parse_sei_pic_timing(const sei_payload& payload, sei_pic_timing* pt,
+                                const seq_parameter_set* sps)
+{
+  *pt = sei_pic_timing();
+
+  if (sps==NULL) {
+    return P265_WARNING_SPS_MISSING_CANNOT_DECODE_SEI;
+  }
+
+  bitreader br;
+  init_payload_reader(&br, payload);
+
+  const video_usability_information& vui = sps->get_vui();
+
+  if (vui.frame_field_info_present_flag) {
+    pt->frame_field_info_present = true;
+    pt->pic_struct       = get_bits(&br,4);
+    pt->source_scan_type = get_bits(&br,2);
+    pt->duplicate_flag   = get_bits(&br,1);
+  }
+
+  const hrd_common_info& hrd = vui.hrd_common;
+
+  pt->CpbDpbDelaysPresentFlag = (vui.vui_hrd_parameters_present_flag &&
+                                 (hrd.nal_hrd_parameters_present_flag ||
+                                  hrd.vcl_hrd_parameters_present_flag));
+
+  if (pt->CpbDpbDelaysPresentFlag) {
+    pt->au_cpb_removal_delay_minus1 = get_bits_u32(&br, hrd.au_cpb_removal_delay_length_minus1+1);
+    pt->pic_dpb_output_delay        = get_bits_u32(&br, hrd.dpb_output_delay_length_minus1+1);
+
+    if (hrd.sub_pic_hrd_params_present_flag) {
+      pt->pic_dpb_output_du_delay = get_bits_u32(&br, hrd.dpb_output_delay_du_length_minus1+1);
+    }
+
+    if (hrd.sub_pic_hrd_params_present_flag &&
+        hrd.sub_pic_cpb_params_in_pic_timing_sei_flag) {
+      pt->du_info_present = true;
+
+      int n = get_uvlc(&br);
+      if (n==UVLC_ERROR) {
+        return P265_ERROR_PARAMETER_PARSING;
+      }
+      pt->num_decoding_units_minus1 = n;
+
+      pt->du_common_cpb_removal_delay_flag = get_bits(&br,1);
+      if (pt->du_common_cpb_removal_delay_flag) {
+        pt->du_common_cpb_removal_delay_increment_minus1 =
+          get_bits_u32(&br, hrd.du_cpb_removal_delay_increment_length_minus1+1);
+      }
+    }
+  }
+
+  if (payload_overrun(&br)) {
+    return P265_ERROR_PARAMETER_PARSING;
+  }
+
+  return P265_OK;
+}
+
+
+P265_error parse_sei_recovery_point(const sei_payload& payload, sei_recovery_point* rp)
+{
+  bitreader br;
+  init_payload_reader(&br, payload);
+
+  int cnt = get_svlc(&br);
+  if (cnt==UVLC_ERROR) {
+    return P265_ERROR_PARAMETER_PARSING;
+  }
+
+  rp->recovery_poc_cnt = cnt;
+  rp->exact_match_flag = get_bits(&br,1);
+  rp->broken_link_flag = get_bits(&br,1);
+
+  if (payload_overrun(&br)) {
+    return P265_ERROR_PARAMETER_PARSING;
+  }
+
+  return P265_OK;
+}
+
+
+P265_error parse_sei_mastering_display_colour_volume(const sei_payload& payload,
+                                                     sei_mastering_display_colour_volume* mdcv)
+{
+  if (payload.payload_size < 24) {
+    return P265_ERROR_PARAMETER_PARSING;
+  }
+
+  const uint8_t* p = payload.payload;
+
+  for (int c=0;c<3;c++) {
+    mdcv->display_primaries_x[c] = read_u16(p+4*c);
+    mdcv->display_primaries_y[c] = read_u16(p+4*c+2);
+  }
+
+  mdcv->white_point_x = read_u16(p+12);
+  mdcv->white_point_y = read_u16(p+14);
+  mdcv->max_display_mastering_luminance = read_u32(p+16);
+  mdcv->min_display_mastering_luminance = read_u32(p+20);
+
+  return P265_OK;
+}
+
+
+P265_error parse_sei_content_light_level_info(const sei_payload& payload,
+                                              sei_content_light_level_info* cll)
+{
+  if (payload.payload_size < 4) {
+    return P265_ERROR_PARAMETER_PARSING;
+  }
+
+  cll->max_content_light_level     = read_u16(payload.payload);
+  cll->max_pic_average_light_level = read_u16(payload.payload+2);
+
+  return P265_OK;
+}
+
+
+P265_error parse_sei_user_data_registered(const sei_payload& payload, sei_user_data_registered* ud)
+{
+  const uint8_t* p = payload.payload;
+  int size = payload.payload_size;
+
+  if (size < 1) {
+    return P265_ERROR_PARAMETER_PARSING;
+  }
+
+  ud->itu_t_t35_country_code = p[0];
+  ud->itu_t_t35_country_code_extension_byte = 0;
+  int hdr = 1;
+
+  if (p[0] == 0xFF) {
+    if (size < 2) {
+      return P265_ERROR_PARAMETER_PARSING;
+    }
+
+    ud->itu_t_t35_country_code_extension_byte = p[1];
+    hdr = 2;
+  }
+
+  ud->data = p + hdr;
+  ud->size = size - hdr;
+
+  return P265_OK;
+}
+
+
+P265_error parse_cea708_cc_data(const sei_user_data_registered* ud, sei_cc_data* cc)
+{
+  /* ATSC A/53 Part 4:
+     itu_t_t35_provider_code (0x0031), user_identifier ('GA94'),
+     user_data_type_code (0x03), cc_data()
+  */
+
+  const uint8_t* p = ud->data;
+
+  if (ud->itu_t_t35_country_code != ITU_T_T35_COUNTRY_CODE_US ||
+      ud->size < 7 ||
+      read_u16(p) != ITU_T_T35_PROVIDER_CODE_ATSC ||
+      read_u32(p+2) != 0x47413934 || // 'GA94'
+      p[6] != 0x03) {
+    return P265_ERROR_CANNOT_PROCESS_SEI;
+  }
+
+  if (ud->size < 9) {
+    return P265_ERROR_PARAMETER_PARSING;
+  }
+
+  cc->process_em_data_flag = (p[7] & 0x80);
+  cc->process_cc_data_flag = (p[7] & 0x40);
+  cc->additional_data_flag = (p[7] & 0x20);
+  cc->cc_count = p[7] & 0x1F;
+  cc->em_data  = p[8];
+  cc->cc_data  = p + 9;
+
+  // the final marker_bits are not required
+  if (ud->size < 9 + 3*cc->cc_count) {
+    return P265_ERROR_PARAMETER_PARSING;
+  }
+
+  return P265_OK;
+}
+
+
+P265_error parse_sei_time_code(const sei_payload& payload, sei_time_code* tc)
+{
+  bitreader br;
+  init_payload_reader(&br, payload);
+
+  tc->num_clock_ts = get_bits(&br,2);
+
+  for (int i=0;i<tc->num_clock_ts;i++) {
+    sei_clock_timestamp& ts = tc->clock_ts[i];
+    ts = sei_clock_timestamp();
+
+    ts.clock_timestamp_flag = get_bits(&br,1);
+    if (!ts.clock_timestamp_flag) {
+      continue;
+    }
+
+    ts.units_field_based_flag = get_bits(&br,1);
+    ts.counting_type          = get_bits(&br,5);
+    ts.full_timestamp_flag    = get_bits(&br,1);
+    ts.discontinuity_flag     = get_bits(&br,1);
+    ts.cnt_dropped_flag       = get_bits(&br,1);
+    ts.n_frames               = get_bits(&br,9);
+
+    ts.seconds_value = ts.minutes_value = ts.hours_value = -1;
+
+    if (ts.full_timestamp_flag) {
+      ts.seconds_value = get_bits(&br,6);
+      ts.minutes_value = get_bits(&br,6);
+      ts.hours_value   = get_bits(&br,5);
+    }
+    else if (get_bits(&br,1)) {   // seconds_flag
+      ts.seconds_value = get_bits(&br,6);
+      if (get_bits(&br,1)) {      // minutes_flag
+        ts.minutes_value = get_bits(&br,6);
+        if (get_bits(&br,1)) {    // hours_flag
+          ts.hours_value = get_bits(&br,5);
+        }
+      }
+    }
+
+    ts.time_offset_length = get_bits(&br,5);
+    if (ts.time_offset_length > 0) {
+      int n = ts.time_offset_length;
+      int64_t v = get_bits_u32(&br,n);
+      if (v & (INT64_C(1)<<(n-1))) { v -= INT64_C(1)<<n; }
+      ts.time_offset_value = (int32_t)v;
+    }
+  }
+
+  if (payload_overrun(&br)) {
+    return P265_ERROR_PARAMETER_PARSING;
+  }
+
+  return P265_OK;
+}
+
+
+P265_error parse_sei_payload(const sei_payload& payload, sei_message* sei,
+                             const seq_parameter_set* sps)
+{
+  sei->payload_type = payload.payload_type;
+  sei->payload_size = payload.payload_size;
+  sei->payload      = payload.payload;
+
+  switch (payload.payload_type) {
+  case sei_payload_type_decoded_picture_hash:
+    {
+      bitreader br;
+      init_payload_reader(&br, payload);
+      P265_error err = read_sei_decoded_picture_hash(&br,sei,sps);
+      if (err==P265_OK && payload_overrun(&br)) {
+        err = P265_ERROR_PARAMETER_PARSING;
+      }
+      return err;
+    }
+
+  case sei_payload_type_buffering_period:
+    return parse_sei_buffering_period(payload, &sei->data.buffering_period, sps);
+
+  case sei_payload_type_pic_timing:
+    return parse_sei_pic_timing(payload, &sei->data.pic_timing, sps);
+
+  case sei_payload_type_recovery_point:
+    return parse_sei_recovery_point(payload, &sei->data.recovery_point);
+
+  case sei_payload_type_mastering_display_colour_volume:
+    return parse_sei_mastering_display_colour_volume(payload,
+                                                     &sei->data.mastering_display_colour_volume);
+
+  case sei_payload_type_content_light_level_info:
+    return parse_sei_content_light_level_info(payload, &sei->data.content_light_level_info);
+
+  case sei_payload_type_user_data_registered_itu_t_t35:
+    return parse_sei_user_data_registered(payload, &sei->data.user_data_registered);
+
+  case sei_payload_type_time_code:
+    return parse_sei_time_code(payload, &sei->data.time_code);
+
+  default:
+    // TODO: unknown SEI messages are ignored
+    return P265_OK;
+  }
+}
+
+
+// --- SEI message iterator ---
+
+sei_message_iterator::sei_message_iterator(const NAL_unit* nal)
+  : ptr(NULL), end(NULL), err(P265_OK)
+{
+  // skip NAL header
+  if (nal->size() > 2) {
+    ptr = nal->data() + 2;
+    end = nal->data() + nal->size();
+  }
+}
+
+
+bool sei_message_iterator::next(sei_payload* msg)
+{
+  if (ptr >= end) {
+    return false;
+  }
+
+  // Check for rbsp_trailing_bits (the NAL may also end with trailing zero bytes).
+  // Note that 0x80 is also a valid payloadType (structure_of_pictures_info).
+
+  if (*ptr == 0x80) {
+    const uint8_t* p = ptr+1;
+    while (p<end && *p==0) { p++; }
+
+    if (p==end) {
+      ptr = end;
+      return false;
+    }
+  }
+
+  int payload_type = 0;
+  for (;;) {
+    if (ptr==end) { goto truncated; }
+    int byte = *ptr++;
+    payload_type += byte;
+    if (byte != 0xFF) { break; }
+  }
+
+  int payload_size;
+  payload_size = 0;
+  for (;;) {
+    if (ptr==end) { goto truncated; }
+    int byte = *ptr++;
+    payload_size += byte;
+    if (byte != 0xFF) { break; }
+  }
+
+  if (payload_size > end-ptr) {
+    goto truncated;
+  }
+
+  msg->payload_type = (enum sei_payload_type)payload_type;
+  msg->payload_size = payload_size;
+  msg->payload      = ptr;
+
+  ptr += payload_size;
+  return true;
+
+ truncated:
+  err = P265_ERROR_PARAMETER_PARSING;
+  ptr = end;
+  return false;
+}
+
+
 class raw_hash_data
 {
 public:
@@ -156,27 +669,108 @@ raw_hash_data::data_chunk raw_hash_data::prepare_16bit(const uint8_t* data,int y
 }
 
 
-static uint32_t compute_checksum_8bit(uint8_t* data,int w,int h,int stride, int bit_depth)
+// --- checksum ---
+
+/* Sum of all bytes of 'row', each XORed with the position mask. The mask of a byte is
+   xmask[i] ^ ymask, where xmask contains the x-dependent part of the mask for each byte. */
+static uint64_t checksum_row_scalar(const uint8_t* row, const uint8_t* xmask, int n, uint8_t ymask)
 {
-  uint32_t sum = 0;
+  uint64_t sum = 0;
+  for (int i=0;i<n;i++) {
+    sum += row[i] ^ xmask[i] ^ ymask;
+  }
 
-  if (bit_depth<=8) {
-    for (int y=0; y<h; y++)
-      for(int x=0; x<w; x++) {
-        uint8_t xorMask = ( x & 0xFF ) ^ ( y & 0xFF ) ^ ( x  >>  8 ) ^ ( y  >>  8 );
-        sum += data[y*stride + x] ^ xorMask;
-      }
+  return sum;
+}
+
+
+#ifdef HAVE_X86_SIMD
+
+static uint64_t checksum_row_sse2(const uint8_t* row, const uint8_t* xmask, int n, uint8_t ymask)
+{
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i ym   = _mm_set1_epi8((char)ymask);
+  __m128i acc = _mm_setzero_si128();
+
+  int i=0;
+  for (; i+16<=n; i+=16) {
+    __m128i v = _mm_loadu_si128((const __m128i*)(row+i));
+    __m128i m = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(xmask+i)), ym);
+
+    // horizontal sum of the bytes into two 64-bit lanes
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_xor_si128(v,m), zero));
   }
-  else {
-    for (int y=0; y<h; y++)
-      for(int x=0; x<w; x++) {
-        uint8_t xorMask = ( x & 0xFF ) ^ ( y & 0xFF ) ^ ( x  >>  8 ) ^ ( y  >>  8 );
-        sum += (data[y*stride + x] & 0xFF) ^ xorMask;
-        sum += (data[y*stride + x] >> 8)   ^ xorMask;
-      }
+
+  uint64_t sum = (uint64_t)_mm_cvtsi128_si64(acc) + (uint64_t)_mm_cvtsi128_si64(_mm_unpackhi_epi64(acc,acc));
+
+  return sum + checksum_row_scalar(row+i, xmask+i, n-i, ymask);
+}
+
+__attribute__((target("avx2")))
+static uint64_t checksum_row_avx2(const uint8_t* row, const uint8_t* xmask, int n, uint8_t ymask)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i ym   = _mm256_set1_epi8((char)ymask);
+  __m256i acc = _mm256_setzero_si256();
+
+  int i=0;
+  for (; i+32<=n; i+=32) {
+    __m256i v = _mm256_loadu_si256((const __m256i*)(row+i));
+    __m256i m = _mm256_xor_si256(_mm256_loadu_si256((const __m256i*)(xmask+i)), ym);
+
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_xor_si256(v,m), zero));
   }
 
-  return sum & 0xFFFFFFFF;
+  __m128i acc128 = _mm_add_epi64(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc,1));
+  uint64_t sum = (uint64_t)_mm_cvtsi128_si64(acc128) + (uint64_t)_mm_extract_epi64(acc128,1);
+
+  return sum + checksum_row_scalar(row+i, xmask+i, n-i, ymask);
+}
+#endif
+
+
+/* D.3.19: sum over all samples of (sample ^ xorMask), where the high byte of >8-bit
+   samples is added separately with the same mask.
+   Both bytes of a 16-bit sample use the same mask, hence the byte order in memory
+   does not matter. */
+static uint64_t checksum_rows(const uint8_t* data,int w,int y0,int y1,int stride, int bit_depth)
+{
+  int bytesPerSample = (bit_depth>8 ? 2 : 1);
+  int rowBytes = w*bytesPerSample;
+
+  std::vector<uint8_t> xmask(rowBytes);
+  for (int x=0; x<w; x++) {
+    uint8_t m = ( x & 0xFF ) ^ ( x >> 8 );
+    for (int b=0;b<bytesPerSample;b++) {
+      xmask[x*bytesPerSample+b] = m;
+    }
+  }
+
+  uint64_t (*checksum_row)(const uint8_t*, const uint8_t*, int, uint8_t) = checksum_row_scalar;
+
+#ifdef HAVE_X86_SIMD
+  static const bool have_avx2 = [] {
+    __builtin_cpu_init();
+    return (bool)__builtin_cpu_supports("avx2");
+  }();
+
+  checksum_row = (have_avx2 ? checksum_row_avx2 : checksum_row_sse2);
+#endif
+
+  uint64_t sum = 0;
+
+  for (int y=y0; y<y1; y++) {
+    uint8_t ymask = ( y & 0xFF ) ^ ( y >> 8 );
+    sum += checksum_row(data + (size_t)y*stride*bytesPerSample, xmask.data(), rowBytes, ymask);
+  }
+
+  return sum;
+}
+
+
+static uint32_t compute_checksum_8bit(const uint8_t* data,int w,int h,int stride, int bit_depth)
+{
+  return checksum_rows(data,w,0,h,stride,bit_depth) & 0xFFFFFFFF;
 }
 
 static inline uint16_t crc_process_byte(uint16_t crc, uint8_t byte)
@@ -210,36 +804,211 @@ static uint16_t compute_CRC_8bit_old(const uint8_t* data,int w,int h,int stride)
 }
 */
 
-static inline uint16_t crc_process_byte_parallel(uint16_t crc, uint8_t byte)
+// --- CRC-16/CCITT (polynomial x^16+x^12+x^5+1), as used by the decoded picture hash ---
+
+#define CRC16_POLY 0x1021
+
+/* Tables for slicing-by-8: T[k][b] is the CRC of byte b followed by k zero bytes. */
+struct crc16_tables
 {
-  uint16_t s = byte ^ (crc >> 8);
-  uint16_t t = s ^ (s >> 4);
+  crc16_tables();
 
-  return  ((crc << 8) ^
-	   t ^
-	   (t <<  5) ^
-	   (t << 12)) & 0xFFFF;
+  uint16_t T[8][256];
+};
+
+crc16_tables::crc16_tables()
+{
+  for (int b=0;b<256;b++) {
+    uint16_t crc = b<<8;
+    for (int bit=0;bit<8;bit++) {
+      crc = (crc & 0x8000) ? ((crc<<1) ^ CRC16_POLY) : (crc<<1);
+    }
+    T[0][b] = crc;
+  }
+
+  for (int k=1;k<8;k++)
+    for (int b=0;b<256;b++) {
+      uint16_t prev = T[k-1][b];
+      T[k][b] = (uint16_t)((prev<<8) ^ T[0][prev>>8]);
+    }
 }
 
-static uint32_t compute_CRC_8bit_fast(const uint8_t* data,int w,int h,int stride, int bit_depth)
+static const crc16_tables& get_crc16_tables()
 {
-  raw_hash_data raw_data(w,stride);
+  static const crc16_tables tables;
+  return tables;
+}
 
-  uint16_t crc = 0xFFFF;
 
-  crc = crc_process_byte_parallel(crc, 0);
-  crc = crc_process_byte_parallel(crc, 0);
+static uint16_t crc16_update_table(uint16_t crc, const uint8_t* data, size_t len)
+{
+  const crc16_tables& t = get_crc16_tables();
+
+  while (len >= 8) {
+    crc = (t.T[7][data[0] ^ (crc>>8)] ^
+           t.T[6][data[1] ^ (crc&0xFF)] ^
+           t.T[5][data[2]] ^
+           t.T[4][data[3]] ^
+           t.T[3][data[4]] ^
+           t.T[2][data[5]] ^
+           t.T[1][data[6]] ^
+           t.T[0][data[7]]);
+
+    data += 8;
+    len  -= 8;
+  }
+
+  while (len--) {
+    crc = (uint16_t)((crc<<8) ^ t.T[0][(crc>>8) ^ *data++]);
+  }
+
+  return crc;
+}
 
-  for (int y=0; y<h; y++) {
-    raw_hash_data::data_chunk chunk;
 
-    if (bit_depth>8)
-      chunk = raw_data.prepare_16bit(data, y);
-    else
-      chunk = raw_data.prepare_8bit(data, y);
+// x^n mod P(x)
+static uint16_t crc16_xpow(int n)
+{
+  uint32_t r = 1;
+  while (n--) {
+    r <<= 1;
+    if (r & 0x10000) { r ^= 0x10000 | CRC16_POLY; }
+  }
+
+  return (uint16_t)r;
+}
 
-    for(int x=0; x<chunk.len; x++) {
-      crc = crc_process_byte_parallel(crc, chunk.data[x]);
+
+#ifdef HAVE_X86_SIMD
+
+/* Carry-less multiplication folding. The data is interpreted as one large polynomial
+   (first bit = highest power). 128-bit accumulators hold values that are congruent
+   (mod P) to the data processed so far, such that the final CRC can be computed from
+   the accumulator bytes with the table method.
+ */
+struct crc16_fold_constants
+{
+  crc16_fold_constants() {
+    fold1_hi = crc16_xpow(128+64);  fold1_lo = crc16_xpow(128);
+    fold4_hi = crc16_xpow(512+64);  fold4_lo = crc16_xpow(512);
+  }
+
+  uint64_t fold1_hi, fold1_lo;  // fold by 16 bytes
+  uint64_t fold4_hi, fold4_lo;  // fold by 64 bytes
+};
+
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i crc16_fold(__m128i acc, __m128i k)
+{
+  return _mm_xor_si128(_mm_clmulepi64_si128(acc, k, 0x01),   // acc.hi * k.lo
+                       _mm_clmulepi64_si128(acc, k, 0x10));  // acc.lo * k.hi
+}
+
+// requires len >= 64
+__attribute__((target("pclmul,ssse3")))
+static uint16_t crc16_update_clmul(uint16_t crc, const uint8_t* data, size_t len)
+{
+  static const crc16_fold_constants c;
+
+  const __m128i bswap = _mm_set_epi8(0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15);
+  const __m128i k1 = _mm_set_epi64x(c.fold1_lo, c.fold1_hi);
+  const __m128i k4 = _mm_set_epi64x(c.fold4_lo, c.fold4_hi);
+
+#define LOAD_BE(p) _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(p)), bswap)
+
+  __m128i x0 = LOAD_BE(data+ 0);
+  __m128i x1 = LOAD_BE(data+16);
+  __m128i x2 = LOAD_BE(data+32);
+  __m128i x3 = LOAD_BE(data+48);
+
+  // the initial CRC value is added to the first 16 message bits
+
+  x0 = _mm_xor_si128(x0, _mm_set_epi64x((uint64_t)crc << 48, 0));
+
+  data += 64;
+  len  -= 64;
+
+  while (len >= 64) {
+    x0 = _mm_xor_si128(crc16_fold(x0,k4), LOAD_BE(data+ 0));
+    x1 = _mm_xor_si128(crc16_fold(x1,k4), LOAD_BE(data+16));
+    x2 = _mm_xor_si128(crc16_fold(x2,k4), LOAD_BE(data+32));
+    x3 = _mm_xor_si128(crc16_fold(x3,k4), LOAD_BE(data+48));
+
+    data += 64;
+    len  -= 64;
+  }
+
+  __m128i x = _mm_xor_si128(crc16_fold(x0,k1), x1);
+  x = _mm_xor_si128(crc16_fold(x,k1), x2);
+  x = _mm_xor_si128(crc16_fold(x,k1), x3);
+
+  while (len >= 16) {
+    x = _mm_xor_si128(crc16_fold(x,k1), LOAD_BE(data));
+    data += 16;
+    len  -= 16;
+  }
+
+#undef LOAD_BE
+
+  uint8_t acc[16];
+  _mm_storeu_si128((__m128i*)acc, _mm_shuffle_epi8(x, bswap));
+
+  crc = crc16_update_table(0, acc, 16);
+  return crc16_update_table(crc, data, len);
+}
+
+static bool crc16_have_clmul()
+{
+  static const bool have = [] {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("ssse3");
+  }();
+
+  return have;
+}
+#endif
+
+
+static uint16_t crc16_update(uint16_t crc, const uint8_t* data, size_t len)
+{
+#ifdef HAVE_X86_SIMD
+  if (len >= 64 && crc16_have_clmul()) {
+    return crc16_update_clmul(crc, data, len);
+  }
+#endif
+
+  return crc16_update_table(crc, data, len);
+}
+
+
+static inline bool host_is_little_endian()
+{
+  const uint16_t one = 1;
+  return *reinterpret_cast<const uint8_t*>(&one) == 1;
+}
+
+
+/* CRC over rows [y0;y1) of a plane, continuing from 'crc'. */
+static uint16_t crc16_rows(uint16_t crc, const uint8_t* data,int w,int y0,int y1,int stride, int bit_depth)
+{
+  if (bit_depth<=8) {
+    for (int y=y0; y<y1; y++) {
+      crc = crc16_update(crc, data + (size_t)y*stride, w);
+    }
+  }
+  else if (host_is_little_endian()) {
+    // samples are hashed in little-endian byte order, which is the memory layout
+
+    for (int y=y0; y<y1; y++) {
+      crc = crc16_update(crc, data + 2*(size_t)y*stride, 2*w);
+    }
+  }
+  else {
+    raw_hash_data raw_data(w,stride);
+
+    for (int y=y0; y<y1; y++) {
+      raw_hash_data::data_chunk chunk = raw_data.prepare_16bit(data, y);
+      crc = crc16_update(crc, chunk.data, chunk.len);
     }
   }
 
@@ -247,116 +1016,224 @@ static uint32_t compute_CRC_8bit_fast(const uint8_t* data,int w,int h,int stride
 }
 
 
-static void compute_MD5(uint8_t* data,int w,int h,int stride, uint8_t* result, int bit_depth)
+// a*b mod P(x)
+static uint16_t crc16_mulmod(uint16_t a, uint16_t b)
 {
-  MD5_CTX md5;
-  MD5_Init(&md5);
+  uint32_t r = 0;
+  for (int i=15;i>=0;i--) {
+    r <<= 1;
+    if (r & 0x10000) { r ^= 0x10000 | CRC16_POLY; }
+    if ((b>>i) & 1)  { r ^= a; }
+  }
 
-  raw_hash_data raw_data(w,stride);
+  return (uint16_t)r;
+}
 
-  for (int y=0; y<h; y++) {
-    raw_hash_data::data_chunk chunk;
+/* CRC after appending n bytes to data with CRC 'crc', when the appended data
+   alone has a CRC (with zero start value) of zero: crc * x^(8n) mod P(x). */
+static uint16_t crc16_shift(uint16_t crc, uint64_t n)
+{
+  uint16_t power = 1;        // x^0
+  uint16_t base  = 0x100;    // x^8
 
-    if (bit_depth>8)
-      chunk = raw_data.prepare_16bit(data, y);
-    else
-      chunk = raw_data.prepare_8bit(data, y);
+  while (n) {
+    if (n & 1) { power = crc16_mulmod(power, base); }
+    base = crc16_mulmod(base, base);
+    n >>= 1;
+  }
 
-    MD5_Update(&md5, (void*)chunk.data, chunk.len);
+  return crc16_mulmod(crc, power);
+}
+
+
+static uint32_t compute_CRC_8bit_fast(const uint8_t* data,int w,int h,int stride, int bit_depth)
+{
+  static const uint8_t zeros[2] = { 0,0 };
+
+  uint16_t crc = crc16_update(0xFFFF, zeros, 2);
+
+  return crc16_rows(crc, data, w, 0, h, stride, bit_depth);
+}
+
+
+void compute_planes_MD5(const picture_plane* planes, int nPlanes, uint8_t (*md5)[16])
+{
+  std::vector<md5_job> jobs(nPlanes);
+
+  for (int i=0;i<nPlanes;i++) {
+    int bytesPerSample = (planes[i].bit_depth > 8 ? 2 : 1);
+
+    jobs[i].data      = planes[i].data;
+    jobs[i].stride    = (ptrdiff_t)planes[i].stride * bytesPerSample;
+    jobs[i].row_bytes = planes[i].width * bytesPerSample;
+    jobs[i].rows      = planes[i].height;
+    jobs[i].samples16 = (bytesPerSample==2);
   }
 
-  MD5_Final(result, &md5);
+  md5_multibuffer(jobs.data(), nPlanes);
+
+  for (int i=0;i<nPlanes;i++) {
+    memcpy(md5[i], jobs[i].digest, 16);
+  }
 }
 
 
-// static P265_error process_sei_decoded_picture_hash(const sei_message* sei, P265_image* img)
-// {
-//   const sei_decoded_picture_hash* seihash = &sei->data.decoded_picture_hash;
+// --- decoded picture hash verification ---
+
+// Planes smaller than this are not split across threads.
+#define MIN_BYTES_PER_HASH_THREAD (1<<20)
+
+
+/* Split the rows of a plane into 'nParts' ranges and call f(part, y0, y1) for each range,
+   in parallel on the shared thread pool. */
+template <class F> static void for_row_ranges(int h, int nParts, F f)
+{
+  parallel_for(get_shared_thread_pool(), nParts, [&](int p) {
+      f(p, (int)((int64_t)h*p/nParts), (int)((int64_t)h*(p+1)/nParts));
+    }, thread_task_priority_high);
+}
+
+
+static int number_of_hash_threads(const picture_plane& plane, int max_threads)
+{
+  int64_t bytes = (int64_t)plane.width * plane.height * (plane.bit_depth > 8 ? 2 : 1);
+  int64_t n = bytes / MIN_BYTES_PER_HASH_THREAD;
+
+  return (int)libP265_max((int64_t)1, libP265_min(n, (int64_t)max_threads));
+}
+
+
+static uint16_t compute_plane_CRC(const picture_plane& plane, int max_threads)
+{
+  static const uint8_t zeros[2] = { 0,0 };
+
+  int nParts = number_of_hash_threads(plane, max_threads);
+  if (nParts==1) {
+    return compute_CRC_8bit_fast(plane.data, plane.width, plane.height, plane.stride, plane.bit_depth);
+  }
+
+  // Compute the CRC of each range independently and combine them afterwards.
+
+  std::vector<uint16_t> crcs(nParts);
+  std::vector<int> rows(nParts);
+
+  for_row_ranges(plane.height, nParts, [&](int p, int y0, int y1) {
+      crcs[p] = crc16_rows(0, plane.data, plane.width, y0, y1, plane.stride, plane.bit_depth);
+      rows[p] = y1-y0;
+    });
+
+  uint64_t rowBytes = (uint64_t)plane.width * (plane.bit_depth > 8 ? 2 : 1);
+
+  uint16_t crc = crc16_update(0xFFFF, zeros, 2);
+  for (int p=0;p<nParts;p++) {
+    crc = crc16_shift(crc, rows[p]*rowBytes) ^ crcs[p];
+  }
+
+  return crc;
+}
+
+
+static uint32_t compute_plane_checksum(const picture_plane& plane, int max_threads)
+{
+  int nParts = number_of_hash_threads(plane, max_threads);
+  if (nParts==1) {
+    return compute_checksum_8bit(plane.data, plane.width, plane.height, plane.stride, plane.bit_depth);
+  }
+
+  std::vector<uint64_t> sums(nParts);
+
+  for_row_ranges(plane.height, nParts, [&](int p, int y0, int y1) {
+      sums[p] = checksum_rows(plane.data, plane.width, y0, y1, plane.stride, plane.bit_depth);
+    });
+
+  uint64_t sum = 0;
+  for (int p=0;p<nParts;p++) {
+    sum += sums[p];
+  }
+
+  return sum & 0xFFFFFFFF;
+}
+
+
+P265_error check_decoded_picture_hash(const sei_decoded_picture_hash* hash,
+                                      const uint8_t* const planes[3], const int strides[3],
+                                      int width, int height,
+                                      int bit_depth_luma, int bit_depth_chroma,
+                                      int chroma_format_idc,
+                                      bool plane_match[3],
+                                      int max_threads)
+{
+  if (max_threads <= 0) {
+    max_threads = libP265_max(1, (int)std::thread::hardware_concurrency());
+  }
+
+
+  // --- plane geometry ---
+
+  int nPlanes = (chroma_format_idc==0 ? 1 : 3);
+  int subWidth  = (chroma_format_idc==1 || chroma_format_idc==2) ? 2 : 1;
+  int subHeight = (chroma_format_idc==1) ? 2 : 1;
 
-//   /* Do not check SEI on pictures that are not output.
-//      Hash may be wrong, because of a broken link (BLA).
-//      This happens, for example in conformance stream RAP_B, where a EOS-NAL
-//      appears before a CRA (POC=32). */
-//   if (img->PicOutputFlag == false) {
-//     return P265_OK;
-//   }
+  picture_plane p[3];
+  for (int i=0;i<nPlanes;i++) {
+    p[i].data   = planes[i];
+    p[i].stride = strides[i];
+    p[i].width  = (i==0 ? width  : width /subWidth);
+    p[i].height = (i==0 ? height : height/subHeight);
+    p[i].bit_depth = (i==0 ? bit_depth_luma : bit_depth_chroma);
+  }
 
-//   //write_picture(img);
 
-//   int nHashes = img->get_sps().chroma_format_idc==0 ? 1 : 3;
-//   for (int i=0;i<nHashes;i++) {
-//     uint8_t* data;
-//     int w,h,stride;
+  // --- compute and compare the hashes ---
 
-//     w = img->get_width(i);
-//     h = img->get_height(i);
+  bool match[3] = { true, true, true };
 
-//     data = img->get_image_plane(i);
-//     stride = img->get_image_stride(i);
+  switch (hash->hash_type) {
+  case sei_decoded_picture_hash_type_MD5:
+    {
+      uint8_t md5[3][16];
 
-//     switch (seihash->hash_type) {
-//     case sei_decoded_picture_hash_type_MD5:
-//       {
-//         uint8_t md5[16];
-//         compute_MD5(data,w,h,stride,md5, img->get_bit_depth(i));
+      if (max_threads==1 || nPlanes==1) {
+        compute_planes_MD5(p, nPlanes, md5);
+      }
+      else {
+        // one task per plane
 
-// /*
-//         fprintf(stderr,"computed MD5: ");
-//         for (int b=0;b<16;b++) {
-//           fprintf(stderr,"%02x", md5[b]);
-//         }
-//         fprintf(stderr,"\n");
-// */
+        parallel_for(get_shared_thread_pool(), nPlanes, [&](int i) {
+            compute_planes_MD5(&p[i], 1, &md5[i]);
+          }, thread_task_priority_high);
+      }
 
-//         for (int b=0;b<16;b++) {
-//           if (md5[b] != seihash->md5[i][b]) {
-// /*
-//             fprintf(stderr,"SEI decoded picture MD5 mismatch (POC=%d)\n", img->PicOrderCntVal);
-// */
-//             return P265_ERROR_CHECKSUM_MISMATCH;
-//           }
-//         }
-//       }
-//       break;
+      for (int i=0;i<nPlanes;i++) {
+        match[i] = (memcmp(md5[i], hash->md5[i], 16)==0);
+      }
+    }
+    break;
 
-//     case sei_decoded_picture_hash_type_CRC:
-//       {
-//         uint16_t crc = compute_CRC_8bit_fast(data,w,h,stride, img->get_bit_depth(i));
+  case sei_decoded_picture_hash_type_CRC:
+    for (int i=0;i<nPlanes;i++) {
+      match[i] = (compute_plane_CRC(p[i], max_threads) == hash->crc[i]);
+    }
+    break;
 
-//         logtrace(LogSEI,"SEI decoded picture hash: %04x <-[%d]-> decoded picture: %04x\n",
-//                  seihash->crc[i], i, crc);
+  case sei_decoded_picture_hash_type_checksum:
+    for (int i=0;i<nPlanes;i++) {
+      match[i] = (compute_plane_checksum(p[i], max_threads) == hash->checksum[i]);
+    }
+    break;
 
-//         if (crc != seihash->crc[i]) {
-// /*
-//           fprintf(stderr,"SEI decoded picture hash: %04x, decoded picture: %04x (POC=%d)\n",
-//                   seihash->crc[i], crc, img->PicOrderCntVal);
-// */
-//           return P265_ERROR_CHECKSUM_MISMATCH;
-//         }
-//       }
-//       break;
+  default:
+    return P265_ERROR_CANNOT_PROCESS_SEI;
+  }
 
-//     case sei_decoded_picture_hash_type_checksum:
-//       {
-//         uint32_t chksum = compute_checksum_8bit(data,w,h,stride, img->get_bit_depth(i));
+  bool all_match = true;
+  for (int i=0;i<3;i++) {
+    if (plane_match) { plane_match[i] = match[i]; }
+    all_match &= match[i];
+  }
 
-//         if (chksum != seihash->checksum[i]) {
-// /*
-//           fprintf(stderr,"SEI decoded picture hash: %04x, decoded picture: %04x (POC=%d)\n",
-//                   seihash->checksum[i], chksum, img->PicOrderCntVal);
-// */
-//           return P265_ERROR_CHECKSUM_MISMATCH;
-//         }
-//       }
-//       break;
-//     }
-//   }
-
-//   loginfo(LogSEI,"decoded picture hash checked: OK\n");
-//   //printf("checked picture %d SEI: OK\n", img->PicOrderCntVal);
-
-//   return P265_OK;
-// }
+  return all_match ? P265_OK : P265_ERROR_CHECKSUM_MISMATCH;
+}
 
 
 P265_error read_sei(bitreader* reader, sei_message* sei, bool suffix, const seq_parameter_set* sps)
@@ -379,25 +1256,28 @@ P265_error read_sei(bitreader* reader, sei_message* sei, bool suffix, const seq_
       if (byte != 0xFF) { break; }
     }
 
-  sei->payload_type = (enum sei_payload_type)payload_type;
-  sei->payload_size = payload_size;
 
+  // The SEI message header is byte aligned. Hand the payload to the parser directly
+  // and continue reading after it.
 
-  // --- sei message dispatch
+  const uint8_t* payload = reader->data - reader->nextbits_cnt/8;
+  int available = reader->bytes_remaining + reader->nextbits_cnt/8;
 
-  P265_error err = P265_OK;
+  if (reader->nextbits_cnt < 0 || payload_size > available) {
+    return P265_ERROR_PARAMETER_PARSING;
+  }
 
-  switch (sei->payload_type) {
-  case sei_payload_type_decoded_picture_hash:
-    err = read_sei_decoded_picture_hash(reader,sei,sps);
-    break;
+  sei_payload msg;
+  msg.payload_type = (enum sei_payload_type)payload_type;
+  msg.payload_size = payload_size;
+  msg.payload      = payload;
 
-  default:
-    // TODO: unknown SEI messages are ignored
-    break;
-  }
+  bitreader_init(reader, const_cast<unsigned char*>(payload + payload_size), available - payload_size);
 
-  return err;
+
+  // --- sei message dispatch
+
+  return parse_sei_payload(msg, sei, sps);
 }
 
 void dump_sei(const sei_message* sei, const seq_parameter_set* sps)
@@ -409,35 +1289,90 @@ void dump_sei(const sei_message* sei, const seq_parameter_set* sps)
     dump_sei_decoded_picture_hash(sei, sps);
     break;
 
-  default:
-    // TODO: unknown SEI messages are ignored
+  case sei_payload_type_buffering_period:
+    {
+      const sei_buffering_period& bp = sei->data.buffering_period;
+      loginfo(LogSEI,"  bp_seq_parameter_set_id: %d\n", bp.bp_seq_parameter_set_id);
+      loginfo(LogSEI,"  irap_cpb_params_present_flag: %d\n", bp.irap_cpb_params_present_flag);
+      loginfo(LogSEI,"  concatenation_flag: %d\n", bp.concatenation_flag);
+      loginfo(LogSEI,"  au_cpb_removal_delay_delta_minus1: %u\n", bp.au_cpb_removal_delay_delta_minus1);
+      for (int i=0;i<bp.CpbCnt;i++) {
+        if (bp.NalHrdBpPresentFlag) {
+          loginfo(LogSEI,"  nal_initial_cpb_removal_delay[%d]: %u offset: %u\n", i,
+                  bp.nal[i].initial_cpb_removal_delay, bp.nal[i].initial_cpb_removal_offset);
+        }
+        if (bp.VclHrdBpPresentFlag) {
+          loginfo(LogSEI,"  vcl_initial_cpb_removal_delay[%d]: %u offset: %u\n", i,
+                  bp.vcl[i].initial_cpb_removal_delay, bp.vcl[i].initial_cpb_removal_offset);
+        }
+      }
+    }
+    break;
+
+  case sei_payload_type_pic_timing:
+    {
+      const sei_pic_timing& pt = sei->data.pic_timing;
+      if (pt.frame_field_info_present) {
+        loginfo(LogSEI,"  pic_struct: %d\n", pt.pic_struct);
+        loginfo(LogSEI,"  source_scan_type: %d\n", pt.source_scan_type);
+        loginfo(LogSEI,"  duplicate_flag: %d\n", pt.duplicate_flag);
+      }
+      if (pt.CpbDpbDelaysPresentFlag) {
+        loginfo(LogSEI,"  au_cpb_removal_delay_minus1: %u\n", pt.au_cpb_removal_delay_minus1);
+        loginfo(LogSEI,"  pic_dpb_output_delay: %u\n", pt.pic_dpb_output_delay);
+      }
+    }
     break;
-  }
-}
 
+  case sei_payload_type_recovery_point:
+    loginfo(LogSEI,"  recovery_poc_cnt: %d\n", sei->data.recovery_point.recovery_poc_cnt);
+    loginfo(LogSEI,"  exact_match_flag: %d\n", sei->data.recovery_point.exact_match_flag);
+    loginfo(LogSEI,"  broken_link_flag: %d\n", sei->data.recovery_point.broken_link_flag);
+    break;
 
-// P265_error process_sei(const sei_message* sei, P265_image* img)
-// {
-//   P265_error err = P265_OK;
+  case sei_payload_type_mastering_display_colour_volume:
+    for (int c=0;c<3;c++) {
+      loginfo(LogSEI,"  display_primaries[%d]: %d,%d\n", c,
+              sei->data.mastering_display_colour_volume.display_primaries_x[c],
+              sei->data.mastering_display_colour_volume.display_primaries_y[c]);
+    }
+    loginfo(LogSEI,"  white_point: %d,%d\n",
+            sei->data.mastering_display_colour_volume.white_point_x,
+            sei->data.mastering_display_colour_volume.white_point_y);
+    loginfo(LogSEI,"  max_display_mastering_luminance: %u\n",
+            sei->data.mastering_display_colour_volume.max_display_mastering_luminance);
+    loginfo(LogSEI,"  min_display_mastering_luminance: %u\n",
+            sei->data.mastering_display_colour_volume.min_display_mastering_luminance);
+    break;
 
-//   switch (sei->payload_type) {
-//   case sei_payload_type_decoded_picture_hash:
-//     if (img->decctx->param_sei_check_hash) {
-//       err = process_sei_decoded_picture_hash(sei, img);
-//       if (err==P265_OK) {
-//         //printf("SEI check ok\n");
-//       }
-//     }
+  case sei_payload_type_content_light_level_info:
+    loginfo(LogSEI,"  max_content_light_level: %d\n",
+            sei->data.content_light_level_info.max_content_light_level);
+    loginfo(LogSEI,"  max_pic_average_light_level: %d\n",
+            sei->data.content_light_level_info.max_pic_average_light_level);
+    break;
 
-//     break;
+  case sei_payload_type_user_data_registered_itu_t_t35:
+    loginfo(LogSEI,"  itu_t_t35_country_code: %d\n",
+            sei->data.user_data_registered.itu_t_t35_country_code);
+    loginfo(LogSEI,"  payload bytes: %d\n", sei->data.user_data_registered.size);
+    break;
 
-//   default:
-//     // TODO: unknown SEI messages are ignored
-//     break;
-//   }
+  case sei_payload_type_time_code:
+    for (int i=0;i<sei->data.time_code.num_clock_ts;i++) {
+      const sei_clock_timestamp& ts = sei->data.time_code.clock_ts[i];
+      if (ts.clock_timestamp_flag) {
+        loginfo(LogSEI,"  clock_ts[%d]: %02d:%02d:%02d.%d\n", i,
+                ts.hours_value, ts.minutes_value, ts.seconds_value, ts.n_frames);
+      }
+    }
+    break;
 
-//   return err;
-// }
+  default:
+    // TODO: unknown SEI messages are ignored
+    break;
+  }
+}
 
 
 const char* sei_type_name(enum sei_payload_type type)
@@ -491,8 +1426,24 @@ const char* sei_type_name(enum sei_payload_type type)
     return "region_refresh_info";
   case sei_payload_type_no_display:
     return "no_display";
+  case sei_payload_type_time_code:
+    return "time_code";
+  case sei_payload_type_mastering_display_colour_volume:
+    return "mastering_display_colour_volume";
+  case sei_payload_type_segmented_rect_frame_packing_arrangement:
+    return "segmented_rect_frame_packing_arrangement";
   case sei_payload_type_motion_constrained_tile_sets:
     return "motion_constrained_tile_sets";
+  case sei_payload_type_chroma_resampling_filter_hint:
+    return "chroma_resampling_filter_hint";
+  case sei_payload_type_knee_function_info:
+    return "knee_function_info";
+  case sei_payload_type_colour_remapping_info:
+    return "colour_remapping_info";
+  case sei_payload_type_content_light_level_info:
+    return "content_light_level_info";
+  case sei_payload_type_alternative_transfer_characteristics:
+    return "alternative_transfer_characteristics";
 
   default:
     return "unknown SEI message";
@@ -0,0 +1,73 @@
+/*
+ * H.265 video codec parser.
+ * Copyright (c) 2023 John Willard <john.willard@shotover.com>
+ *
+ * This file is part of libp265.
+ *
+ * libp265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libp265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libp265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libp265/snapshot.h"
+#include "libp265/nal-parser.h"
+#include "libp265/context.h"
+
+BEGIN_NAMESPACE_LIBP265
+
+P265_error save_stream_state(const NAL_Parser* parser, const parse_context* ctx,
+                             std::vector<unsigned char>* out)
+{
+  snapshot_writer w;
+  w.put_u32(P265_SNAPSHOT_MAGIC);
+  w.put_u32(P265_SNAPSHOT_VERSION);
+
+  P265_error err = ctx->save_state(w);
+  if (err != P265_OK) {
+    return err;
+  }
+
+  parser->save_state(w);
+
+  out->swap(w.buffer);
+  return P265_OK;
+}
+
+
+P265_error restore_stream_state(NAL_Parser* parser, parse_context* ctx,
+                                const unsigned char* data, size_t size)
+{
+  snapshot_reader r(data, size);
+
+  if (r.get_u32() != P265_SNAPSHOT_MAGIC ||
+      r.get_u32() != P265_SNAPSHOT_VERSION) {
+    return P265_ERROR_PARAMETER_PARSING;
+  }
+
+  P265_error err = ctx->restore_state(r);
+  if (err != P265_OK) {
+    return err;
+  }
+
+  err = parser->restore_state(r);
+  if (err != P265_OK) {
+    return err;
+  }
+
+  if (!r.at_end()) {
+    return P265_ERROR_PARAMETER_PARSING;
+  }
+
+  return P265_OK;
+}
+
+END_NAMESPACE_LIBP265
@@ -26,12 +26,14 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <mutex>
+#include <unordered_map>
 
 BEGIN_NAMESPACE_LIBP265
 
 #define READ_VLC_OFFSET(variable, vlctype, offset)   \
   if ((vlc = get_ ## vlctype(br)) == UVLC_ERROR) {   \
-    errqueue->add_warning(P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE, false);  \
+    errqueue->add_diagnostic(P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE, #variable); \
     return P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE; \
   } \
   variable = vlc + offset;
@@ -95,6 +97,19 @@ seq_parameter_set::~seq_parameter_set()
 }
 
 
+const video_usability_information& seq_parameter_set::get_vui() const
+{
+  static const video_usability_information default_vui;
+
+  if (vui) {
+    return *vui;
+  }
+  else {
+    return default_vui;
+  }
+}
+
+
 void seq_parameter_set::set_defaults(enum PresetSet)
 {
   video_parameter_set_id = 0;
@@ -135,7 +150,7 @@ void seq_parameter_set::set_defaults(enum PresetSet)
   scaling_list_enable_flag = 0;
   sps_scaling_list_data_present_flag = 0;
 
-  // TODO struct scaling_list_data scaling_list;
+  scaling_list = get_flat_scaling_lists();
 
   amp_enabled_flag = 0;
   sample_adaptive_offset_enabled_flag = 0;
@@ -163,11 +178,7 @@ void seq_parameter_set::set_defaults(enum PresetSet)
   sps_temporal_mvp_enabled_flag = 0;
   strong_intra_smoothing_enable_flag = 0;
   vui_parameters_present_flag = 0;
-
-  /*
-    if( vui_parameters_present_flag )
-      vui_parameters()
-  */
+  vui.reset();
 
   sps_extension_present_flag = 0;
   sps_range_extension_flag = 0;
@@ -230,7 +241,7 @@ P265_error seq_parameter_set::read(error_queue* errqueue, bitreader* br)
 
   if (chroma_format_idc<0 ||
       chroma_format_idc>3) {
-    errqueue->add_warning(P265_WARNING_INVALID_CHROMA_FORMAT, false);
+    errqueue->add_diagnostic(P265_WARNING_INVALID_CHROMA_FORMAT, "chroma_format_idc", seq_parameter_set_id);
     return P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE;
   }
 
@@ -269,14 +280,14 @@ P265_error seq_parameter_set::read(error_queue* errqueue, bitreader* br)
   READ_VLC_OFFSET(bit_depth_chroma,uvlc, 8);
   if (bit_depth_luma > 16 ||
       bit_depth_chroma > 16) {
-    errqueue->add_warning(P265_WARNING_SPS_HEADER_INVALID, false);
+    errqueue->add_diagnostic(P265_WARNING_SPS_HEADER_INVALID, "bit_depth_luma_minus8", seq_parameter_set_id);
     return P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE;
   }
 
   READ_VLC_OFFSET(log2_max_pic_order_cnt_lsb, uvlc, 4);
   if (log2_max_pic_order_cnt_lsb<4 ||
       log2_max_pic_order_cnt_lsb>16) {
-    errqueue->add_warning(P265_WARNING_SPS_HEADER_INVALID, false);
+    errqueue->add_diagnostic(P265_WARNING_SPS_HEADER_INVALID, "log2_max_pic_order_cnt_lsb_minus4", seq_parameter_set_id);
     return P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE;
   }
   MaxPicOrderCntLsb = 1<<(log2_max_pic_order_cnt_lsb);
@@ -296,7 +307,7 @@ P265_error seq_parameter_set::read(error_queue* errqueue, bitreader* br)
     vlc=get_uvlc(br);
     if (vlc == UVLC_ERROR ||
         vlc+1 > MAX_NUM_REF_PICS) {
-      errqueue->add_warning(P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE, false);
+      errqueue->add_diagnostic(P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE, "sps_max_dec_pic_buffering_minus1", seq_parameter_set_id);
       return P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE;
     }
 
@@ -348,15 +359,22 @@ P265_error seq_parameter_set::read(error_queue* errqueue, bitreader* br)
     sps_scaling_list_data_present_flag = get_bits(br,1);
     if (sps_scaling_list_data_present_flag) {
 
+      std::shared_ptr<scaling_list_data> sclist = std::make_shared<scaling_list_data>();
+
       P265_error err;
-      if ((err=read_scaling_list(br,this, &scaling_list, false)) != P265_OK) {
+      if ((err=read_scaling_list(br,this, sclist.get(), false)) != P265_OK) {
         return err;
       }
+
+      scaling_list = intern_scaling_lists(sclist);
     }
     else {
-      set_default_scaling_lists(&scaling_list);
+      scaling_list = get_default_scaling_lists();
     }
   }
+  else {
+    scaling_list = get_flat_scaling_lists();
+  }
 
   amp_enabled_flag = get_bits(br,1);
   sample_adaptive_offset_enabled_flag = get_bits(br,1);
@@ -380,7 +398,7 @@ P265_error seq_parameter_set::read(error_queue* errqueue, bitreader* br)
   READ_VLC(num_short_term_ref_pic_sets, uvlc);
   if (num_short_term_ref_pic_sets < 0 ||
       num_short_term_ref_pic_sets > 64) {
-    errqueue->add_warning(P265_WARNING_NUMBER_OF_SHORT_TERM_REF_PIC_SETS_OUT_OF_RANGE, false);
+    errqueue->add_diagnostic(P265_WARNING_NUMBER_OF_SHORT_TERM_REF_PIC_SETS_OUT_OF_RANGE, "num_short_term_ref_pic_sets", seq_parameter_set_id);
     return P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE;
   }
 
@@ -427,7 +445,15 @@ P265_error seq_parameter_set::read(error_queue* errqueue, bitreader* br)
 
   vui_parameters_present_flag = get_bits(br,1);
   if (vui_parameters_present_flag) {
-    vui.read(errqueue, br, this);
+    std::shared_ptr<video_usability_information> v = std::make_shared<video_usability_information>();
+
+    P265_error err = v->read(errqueue, br, this);
+    if (err != P265_OK) { return err; }
+
+    vui = v;
+  }
+  else {
+    vui.reset();
   }
 
 
@@ -457,6 +483,8 @@ P265_error seq_parameter_set::read(error_queue* errqueue, bitreader* br)
   P265_error err = compute_derived_values();
   if (err != P265_OK) { return err; }
 
+  compute_level_limits(errqueue);
+
   sps_read = true;
 
   return P265_OK;
@@ -614,6 +642,165 @@ P265_error seq_parameter_set::compute_derived_values(bool sanitize_values)
 
 
 
+// Annex A, Tables A.8 and A.9. MaxCPB and MaxBR are in units of 1000 bits (CpbVclFactor).
+static const struct {
+  int     level_idc;
+  int64_t MaxLumaPs;
+  int     MaxCPB_main, MaxCPB_high;
+  int     MaxSliceSegmentsPerPicture;
+  int     MaxTileRows, MaxTileCols;
+  int64_t MaxLumaSr;
+  int     MaxBR_main, MaxBR_high;
+} level_limits_tab[] = {
+  {  30,    36864,    350,      0,  16,  1,  1,     552960,    128,      0 },
+  {  60,   122880,   1500,      0,  16,  1,  1,    3686400,   1500,      0 },
+  {  63,   245760,   3000,      0,  20,  1,  1,    7372800,   3000,      0 },
+  {  90,   552960,   6000,      0,  30,  2,  2,   16588800,   6000,      0 },
+  {  93,   983040,  10000,      0,  40,  3,  3,   33177600,  10000,      0 },
+  { 120,  2228224,  12000,  30000,  75,  5,  5,   66846720,  12000,  30000 },
+  { 123,  2228224,  20000,  50000,  75,  5,  5,  133693440,  20000,  50000 },
+  { 150,  8912896,  25000, 100000, 200, 11, 10,  267386880,  25000, 100000 },
+  { 153,  8912896,  40000, 160000, 200, 11, 10,  534773760,  40000, 160000 },
+  { 156,  8912896,  60000, 240000, 200, 11, 10, 1069547520,  60000, 240000 },
+  { 180, 35651584,  60000, 240000, 600, 22, 20, 1069547520,  60000, 240000 },
+  { 183, 35651584, 120000, 480000, 600, 22, 20, 2139095040, 120000, 480000 },
+  { 186, 35651584, 240000, 800000, 600, 22, 20, 4278190080LL, 240000, 800000 }
+};
+
+#define NUM_LEVELS (sizeof(level_limits_tab)/sizeof(level_limits_tab[0]))
+
+// Main, Main 10 and Main Still Picture profiles (Table A.10 lists higher factors for RExt)
+#define CPB_VCL_FACTOR 1000
+#define CPB_NAL_FACTOR 1100
+
+
+bool seq_parameter_set::compute_level_limits(error_queue* errqueue)
+{
+  const profile_data& general = profile_tier_level_.general;
+
+  int lvl = -1;
+  for (int i=0;i<(int)NUM_LEVELS;i++) {
+    if (level_limits_tab[i].level_idc == general.level_idc) {
+      lvl = i;
+      break;
+    }
+  }
+
+  // Unknown levels (e.g. level 8.5, which is unconstrained) are treated like the highest level,
+  // but are not checked.
+
+  level_limits.level_known = (lvl >= 0);
+  if (lvl < 0) {
+    lvl = NUM_LEVELS-1;
+  }
+
+  bool high_tier = (general.tier_flag && level_limits_tab[lvl].MaxCPB_high > 0);
+
+  level_limits.MaxLumaPs = level_limits_tab[lvl].MaxLumaPs;
+  level_limits.MaxLumaSr = level_limits_tab[lvl].MaxLumaSr;
+  level_limits.MaxCPB = (int64_t)CPB_NAL_FACTOR * (high_tier ? level_limits_tab[lvl].MaxCPB_high :
+                                                               level_limits_tab[lvl].MaxCPB_main);
+  level_limits.MaxBR  = (int64_t)CPB_NAL_FACTOR * (high_tier ? level_limits_tab[lvl].MaxBR_high :
+                                                               level_limits_tab[lvl].MaxBR_main);
+  level_limits.MaxSliceSegmentsPerPicture = level_limits_tab[lvl].MaxSliceSegmentsPerPicture;
+  level_limits.MaxTileRows = level_limits_tab[lvl].MaxTileRows;
+  level_limits.MaxTileCols = level_limits_tab[lvl].MaxTileCols;
+
+
+  // --- A.4.2 MaxDpbSize ---
+
+  const int maxDpbPicBuf = 6;
+  const int64_t MaxLumaPs = level_limits.MaxLumaPs;
+
+  if      (PicSizeInSamplesY <= (MaxLumaPs >> 2))   { level_limits.MaxDpbSize = libP265_min(4*maxDpbPicBuf, 16); }
+  else if (PicSizeInSamplesY <= (MaxLumaPs >> 1))   { level_limits.MaxDpbSize = libP265_min(2*maxDpbPicBuf, 16); }
+  else if (PicSizeInSamplesY <= ((3*MaxLumaPs) >> 2)) { level_limits.MaxDpbSize = libP265_min((4*maxDpbPicBuf)/3, 16); }
+  else                                              { level_limits.MaxDpbSize = maxDpbPicBuf; }
+
+
+  // --- resource budgets ---
+
+  int64_t bytesY = (BitDepth_Y > 8 ? 2 : 1);
+  int64_t bytesC = (BitDepth_C > 8 ? 2 : 1);
+
+  level_limits.decoded_picture_bytes = PicSizeInSamplesY * bytesY;
+  if (chroma_format_idc != CHROMA_MONO) {
+    level_limits.decoded_picture_bytes += 2 * (PicSizeInSamplesY / (SubWidthC*SubHeightC)) * bytesC;
+  }
+
+  int HighestTid = sps_max_sub_layers-1;
+
+  level_limits.max_dpb_pictures = sps_max_dec_pic_buffering[HighestTid];
+  level_limits.max_dpb_bytes = level_limits.max_dpb_pictures * level_limits.decoded_picture_bytes;
+  level_limits.max_coded_picture_bytes = level_limits.MaxCPB / 8;
+  level_limits.max_slices_per_picture = libP265_min(level_limits.MaxSliceSegmentsPerPicture,
+                                                    PicSizeInCtbsY);
+
+
+  // --- check the limits ---
+
+  bool conforming = true;
+
+  if (PicSizeInSamplesY > MaxLumaPs ||
+      (int64_t)pic_width_in_luma_samples  * pic_width_in_luma_samples  > 8*MaxLumaPs ||
+      (int64_t)pic_height_in_luma_samples * pic_height_in_luma_samples > 8*MaxLumaPs) {
+    conforming = false;
+  }
+
+  for (int i=0;i<sps_max_sub_layers;i++) {
+    if (sps_max_dec_pic_buffering[i] > level_limits.MaxDpbSize) {
+      conforming = false;
+    }
+  }
+
+  // The HRD parameters are decoded into a temporary object, so that they do not
+  // take up space in the SPS when parsed lazily.
+
+  hrd_parameters hrd;
+  if (vui && vui->decode_hrd_parameters(&hrd)) {
+    for (int i=0;i<(int)hrd.sub_layers.size();i++) {
+      for (int nalOrVcl=0;nalOrVcl<2;nalOrVcl++) {
+
+        // the VCL limits are smaller by CpbVclFactor / CpbNalFactor
+        int64_t maxCPB = level_limits.MaxCPB;
+        int64_t maxBR  = level_limits.MaxBR;
+        if (nalOrVcl==1) {
+          maxCPB = maxCPB / CPB_NAL_FACTOR * CPB_VCL_FACTOR;
+          maxBR  = maxBR  / CPB_NAL_FACTOR * CPB_VCL_FACTOR;
+        }
+
+        for (int j=0;j<(int)hrd.sub_layers[i].cpb(nalOrVcl).size();j++) {
+          int64_t CpbSize = hrd.get_cpb_size(i,j,nalOrVcl);
+          int64_t BitRate = hrd.get_bit_rate(i,j,nalOrVcl);
+
+          if (CpbSize > maxCPB || BitRate > maxBR) {
+            conforming = false;
+          }
+
+          // a signalled CPB is a tighter bound for the coded picture size
+
+          if (nalOrVcl==0 && i==HighestTid) {
+            level_limits.max_coded_picture_bytes = libP265_min(level_limits.max_coded_picture_bytes,
+                                                               CpbSize/8);
+          }
+        }
+      }
+    }
+  }
+
+  if (!level_limits.level_known) {
+    return true;
+  }
+
+  if (!conforming) {
+    errqueue->add_warning(P265_WARNING_SPS_EXCEEDS_LEVEL_LIMITS, false);
+  }
+
+  return conforming;
+}
+
+
+
 void seq_parameter_set::dump(int fd) const
 {
   //#if (_MSC_VER >= 1500)
@@ -752,8 +939,8 @@ void seq_parameter_set::dump(int fd) const
     range_extension.dump(fd);
   }
 
-  if (vui_parameters_present_flag) {
-    vui.dump(fd);
+  if (vui) {
+    vui->dump(fd);
   }
 #undef LOG0
 #undef LOG1
@@ -797,6 +984,8 @@ void fill_scaling_factor(uint8_t* scalingFactors, const uint8_t* sclist, int siz
   int width;
   int subWidth;
 
+  init_scan_orders();
+
   switch (sizeId) {
   case 0:
     width=4;
@@ -1034,6 +1223,105 @@ void set_default_scaling_lists(scaling_list_data* sclist)
 }
 
 
+std::shared_ptr<const scaling_list_data> get_default_scaling_lists()
+{
+  static const std::shared_ptr<const scaling_list_data> defaults = [] {
+    std::shared_ptr<scaling_list_data> sclist = std::make_shared<scaling_list_data>();
+    set_default_scaling_lists(sclist.get());
+    return std::shared_ptr<const scaling_list_data>(sclist);
+  }();
+
+  return defaults;
+}
+
+
+std::shared_ptr<const scaling_list_data> get_flat_scaling_lists()
+{
+  static const std::shared_ptr<const scaling_list_data> flat = [] {
+    std::shared_ptr<scaling_list_data> sclist = std::make_shared<scaling_list_data>();
+    memset(sclist.get(), 16, sizeof(scaling_list_data));
+    return std::shared_ptr<const scaling_list_data>(sclist);
+  }();
+
+  return flat;
+}
+
+
+/* Table of all custom scaling lists that are currently in use, indexed by a hash of their content.
+   The table does not keep the lists alive. Expired entries are removed when the table grows.
+ */
+static std::mutex scaling_list_pool_mutex;
+static std::unordered_multimap<uint64_t, std::weak_ptr<const scaling_list_data> > scaling_list_pool;
+static size_t scaling_list_pool_cleanup_size = 64;
+
+
+static uint64_t hash_scaling_list(const scaling_list_data* sclist)
+{
+  // FNV-1a, processing 8 bytes per step
+
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(sclist);
+  uint64_t h = 14695981039346656037ULL;
+
+  for (size_t i=0; i+8<=sizeof(scaling_list_data); i+=8) {
+    uint64_t v;
+    memcpy(&v, p+i, 8);
+    h = (h ^ v) * 1099511628211ULL;
+  }
+
+  return h ^ (h >> 29);
+}
+
+
+std::shared_ptr<const scaling_list_data> intern_scaling_lists(std::shared_ptr<const scaling_list_data> sclist)
+{
+  if (!sclist) {
+    return sclist;
+  }
+
+  std::shared_ptr<const scaling_list_data> defaults = get_default_scaling_lists();
+  if (memcmp(sclist.get(), defaults.get(), sizeof(scaling_list_data))==0) {
+    return defaults;
+  }
+
+  std::shared_ptr<const scaling_list_data> flat = get_flat_scaling_lists();
+  if (memcmp(sclist.get(), flat.get(), sizeof(scaling_list_data))==0) {
+    return flat;
+  }
+
+
+  uint64_t hash = hash_scaling_list(sclist.get());
+
+  std::lock_guard<std::mutex> lock(scaling_list_pool_mutex);
+
+  auto range = scaling_list_pool.equal_range(hash);
+  for (auto it = range.first; it != range.second; ) {
+    std::shared_ptr<const scaling_list_data> existing = it->second.lock();
+    if (!existing) {
+      it = scaling_list_pool.erase(it);
+    }
+    else if (memcmp(existing.get(), sclist.get(), sizeof(scaling_list_data))==0) {
+      return existing;
+    }
+    else {
+      ++it;
+    }
+  }
+
+  if (scaling_list_pool.size() >= scaling_list_pool_cleanup_size) {
+    for (auto it = scaling_list_pool.begin(); it != scaling_list_pool.end(); ) {
+      if (it->second.expired()) { it = scaling_list_pool.erase(it); }
+      else                      { ++it; }
+    }
+
+    scaling_list_pool_cleanup_size = libP265_max((size_t)64, 2*scaling_list_pool.size());
+  }
+
+  scaling_list_pool.insert(std::make_pair(hash, std::weak_ptr<const scaling_list_data>(sclist)));
+
+  return sclist;
+}
+
+
 // P265_error seq_parameter_set::write(error_queue* errqueue, CABAC_encoder& out)
 // {
 //   out.write_bits(video_parameter_set_id, 4);
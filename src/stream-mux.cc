@@ -0,0 +1,507 @@
+/*
+ * H.265 video codec parser.
+ * Copyright (c) 2023 John Willard <john.willard@shotover.com>
+ *
+ * This file is part of libp265.
+ *
+ * libp265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libp265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libp265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libp265/stream-mux.h"
+
+#include <string.h>
+
+BEGIN_NAMESPACE_LIBP265
+
+stream_multiplexer::stream_multiplexer(int max_streams, thread_pool* pool)
+  : max_streams(max_streams),
+    streams(new std::atomic<stream*>[max_streams])
+{
+  pools.push_back(pool ? pool : get_shared_thread_pool());
+  init(max_streams);
+}
+
+
+stream_multiplexer::stream_multiplexer(int max_streams, numa_thread_pools* numa_pools)
+  : max_streams(max_streams),
+    streams(new std::atomic<stream*>[max_streams])
+{
+  for (int i=0;i<numa_pools->num_nodes();i++) {
+    pools.push_back(numa_pools->get_pool(i));
+  }
+
+  if (pools.empty()) {
+    pools.push_back(get_shared_thread_pool());
+  }
+
+  init(max_streams);
+}
+
+
+void stream_multiplexer::init(int max_streams)
+{
+  P265_mutex_init(&id_mutex);
+
+  for (int i=0;i<max_streams;i++) {
+    streams[i].store(NULL, std::memory_order_relaxed);
+  }
+
+  // hand out small ids first
+  for (int i=max_streams-1;i>=0;i--) {
+    free_ids.push_back(i);
+  }
+
+  streams_per_pool.reset(new std::atomic<int>[pools.size()]);
+  for (size_t i=0;i<pools.size();i++) {
+    streams_per_pool[i].store(0, std::memory_order_relaxed);
+  }
+
+  num_NALs = 0;
+}
+
+
+stream_multiplexer::~stream_multiplexer()
+{
+  for (int i=0;i<max_streams;i++) {
+    if (streams[i].load(std::memory_order_relaxed)) {
+      remove_stream(i);
+    }
+  }
+
+  P265_mutex_destroy(&id_mutex);
+}
+
+
+stream_multiplexer::stream* stream_multiplexer::get_stream(int stream_id) const
+{
+  if (stream_id < 0 || stream_id >= max_streams) {
+    return NULL;
+  }
+
+  return streams[stream_id].load(std::memory_order_acquire);
+}
+
+
+namespace {
+  // Allocates the stream state in a worker of the stream's pool (first touch on its node).
+  template <class T> class alloc_task : public thread_task
+  {
+  public:
+    T* result;
+    std::atomic<bool> done;
+
+    alloc_task() : result(NULL), done(false) { }
+
+    virtual void work() {
+      result = new T;
+      done.store(true, std::memory_order_release);
+    }
+  };
+}
+
+
+stream_multiplexer::stream* stream_multiplexer::alloc_stream(thread_pool* pool)
+{
+  // Already on the node, or the pool cannot run the task (stopped, or we would wait
+  // for ourselves): allocate here.
+
+  if (pools.size()==1 || is_worker_of(pool)) {
+    return new stream;
+  }
+
+  alloc_task<stream> task;
+  task.priority = thread_task_priority_high;
+  if (!add_task(pool, &task)) {
+    return new stream;
+  }
+
+  // Do not help the pool here, the allocation has to run on the node.
+  while (!task.done.load(std::memory_order_acquire)) {
+    std::this_thread::yield();
+  }
+
+  return task.result;
+}
+
+
+void stream_multiplexer::wait_unscheduled(stream* s)
+{
+  // Only help pools that are not bound to a node, so that we do not touch another node's
+  // streams from this thread.
+
+  bool help = s->pool->cpus.empty();
+
+  while (s->scheduled.load(std::memory_order_acquire)) {
+    if (!help || !run_pending_task(s->pool)) {
+      std::this_thread::yield();
+    }
+  }
+}
+
+
+int stream_multiplexer::add_stream(stream_handler* handler, int node)
+{
+  if (node >= static_cast<int>(pools.size())) {
+    return -1;
+  }
+
+  if (node < 0) {
+    node = 0;
+    for (size_t i=1;i<pools.size();i++) {
+      if (streams_per_pool[i].load(std::memory_order_relaxed) <
+          streams_per_pool[node].load(std::memory_order_relaxed)) {
+        node = static_cast<int>(i);
+      }
+    }
+  }
+
+  P265_mutex_lock(&id_mutex);
+  if (free_ids.empty()) {
+    P265_mutex_unlock(&id_mutex);
+    return -1;
+  }
+
+  int id = free_ids.back();
+  free_ids.pop_back();
+  P265_mutex_unlock(&id_mutex);
+
+  stream* s = alloc_stream(pools[node]);
+  s->id = id;
+  s->handler = handler;
+  s->node = node;
+  s->pool = pools[node];
+  streams_per_pool[node].fetch_add(1, std::memory_order_relaxed);
+  s->end_of_stream_delivered = false;
+  s->bytes_queued = 0;
+  s->scheduled = false;
+  s->task.mux = this;
+  s->task.s = s;
+  P265_mutex_init(&s->mutex);
+
+  streams[id].store(s, std::memory_order_release);
+
+  return id;
+}
+
+
+void stream_multiplexer::remove_stream(int stream_id)
+{
+  stream* s = get_stream(stream_id);
+  if (s == NULL) {
+    return;
+  }
+
+  // drop queued input and wait for a running task to finish
+
+  P265_mutex_lock(&s->mutex);
+  for (chunk* c : s->input) {
+    s->spare_chunks.push_back(c);
+  }
+  s->input.clear();
+  s->bytes_queued = 0;
+  P265_mutex_unlock(&s->mutex);
+
+  wait_unscheduled(s);
+
+  // the task may still be leaving process_stream()
+  P265_mutex_lock(&s->mutex);
+  P265_mutex_unlock(&s->mutex);
+
+  streams[stream_id].store(NULL, std::memory_order_release);
+
+
+  // free stream
+
+  for (chunk* c : s->spare_chunks) {
+    delete c;
+  }
+
+  for (NAL_unit* nal : s->output) {
+    s->parser.free_NAL_unit(nal);
+  }
+
+  for (NAL_unit* nal : s->returned) {
+    s->parser.free_NAL_unit(nal);
+  }
+
+  streams_per_pool[s->node].fetch_sub(1, std::memory_order_relaxed);
+
+  P265_mutex_destroy(&s->mutex);
+  delete s;
+
+  P265_mutex_lock(&id_mutex);
+  free_ids.push_back(stream_id);
+  P265_mutex_unlock(&id_mutex);
+}
+
+
+P265_error stream_multiplexer::enqueue(int stream_id, const unsigned char* data, int len,
+                                       P265_PTS pts, chunk::chunk_kind kind)
+{
+  stream* s = get_stream(stream_id);
+  if (s == NULL) {
+    return P265_ERROR_NO_SUCH_STREAM;
+  }
+
+  P265_mutex_lock(&s->mutex);
+
+  chunk* c;
+  if (s->spare_chunks.empty()) {
+    c = new chunk;
+  }
+  else {
+    c = s->spare_chunks.back();
+    s->spare_chunks.pop_back();
+  }
+
+  c->data.assign(data, data+len);
+  c->pts  = pts;
+  c->kind = kind;
+
+  s->input.push_back(c);
+  s->bytes_queued += len;
+
+  P265_mutex_unlock(&s->mutex);
+
+
+  // Schedule the stream unless a task is already queued or running. That task will
+  // see the new chunk (it checks the input queue under the mutex before it ends).
+
+  if (!s->scheduled.exchange(true, std::memory_order_acq_rel)) {
+    if (!add_task(s->pool, &s->task)) {
+      process_stream(s); // pool has been stopped, parse in this thread
+    }
+  }
+
+  return P265_OK;
+}
+
+
+P265_error stream_multiplexer::push_data(int stream_id, const unsigned char* data, int len, P265_PTS pts)
+{
+  return enqueue(stream_id, data, len, pts, chunk::byte_stream);
+}
+
+
+P265_error stream_multiplexer::push_NAL(int stream_id, const unsigned char* data, int len, P265_PTS pts)
+{
+  return enqueue(stream_id, data, len, pts, chunk::single_NAL);
+}
+
+
+P265_error stream_multiplexer::push_end_of_stream(int stream_id)
+{
+  return enqueue(stream_id, NULL, 0, 0, chunk::end_of_stream);
+}
+
+
+void stream_multiplexer::process_stream(stream* s)
+{
+  for (int n=0; ; n++) {
+
+    P265_mutex_lock(&s->mutex);
+
+    // take back NALs that were returned by the application
+
+    for (NAL_unit* nal : s->returned) {
+      s->parser.free_NAL_unit(nal);
+    }
+    s->returned.clear();
+
+    if (s->input.empty()) {
+      s->scheduled.store(false, std::memory_order_release);
+      P265_mutex_unlock(&s->mutex);
+      return;
+    }
+
+    if (n == P265_MUX_CHUNKS_PER_RUN) {
+      // give other streams a chance, continue later (behind the tasks already queued,
+      // a plain add_task() would put us into our own deque and we would run next)
+      P265_mutex_unlock(&s->mutex);
+
+      if (add_task_fifo(s->pool, &s->task)) {
+        return;
+      }
+
+      continue; // pool has been stopped, keep going here
+    }
+
+    chunk* c = s->input.front();
+    s->input.pop_front();
+    s->bytes_queued -= c->data.size();
+    P265_mutex_unlock(&s->mutex);
+
+
+    // parse chunk
+
+    P265_error err = P265_OK;
+    int len = static_cast<int>(c->data.size());
+
+    switch (c->kind) {
+    case chunk::byte_stream:
+      err = s->parser.push_data(c->data.data(), len, c->pts);
+      break;
+    case chunk::single_NAL:
+      err = s->parser.push_NAL(c->data.data(), len, c->pts);
+      break;
+    case chunk::end_of_stream:
+      err = s->parser.flush_data();
+      s->parser.mark_end_of_stream();
+      break;
+    }
+
+    if (err != P265_OK) {
+      s->ctx.add_warning(err, false);
+    }
+
+    deliver_NALs(s);
+
+    if (c->kind == chunk::end_of_stream) {
+      if (s->handler) {
+        s->handler->on_end_of_stream(s->id);
+      }
+      else {
+        P265_mutex_lock(&s->mutex);
+        s->end_of_stream_delivered = true;
+        P265_mutex_unlock(&s->mutex);
+      }
+    }
+
+    P265_mutex_lock(&s->mutex);
+    s->spare_chunks.push_back(c);
+    P265_mutex_unlock(&s->mutex);
+  }
+}
+
+
+void stream_multiplexer::deliver_NALs(stream* s)
+{
+  NAL_unit* nal;
+  while ( (nal = s->parser.pop_from_NAL_queue()) ) {
+    P265_error err = s->ctx.read_parameter_set_NAL(nal);
+
+    s->ctx.set_location(nal);
+
+    if (err != P265_OK) {
+      s->ctx.add_warning(err, false);
+    }
+
+    num_NALs.fetch_add(1, std::memory_order_relaxed);
+
+    if (s->handler) {
+      s->handler->on_NAL(s->id, nal, &s->ctx);
+      s->parser.free_NAL_unit(nal);
+    }
+    else {
+      P265_mutex_lock(&s->mutex);
+      s->output.push_back(nal);
+      P265_mutex_unlock(&s->mutex);
+    }
+  }
+
+  s->ctx.clear_location();
+}
+
+
+NAL_unit* stream_multiplexer::pop_NAL(int stream_id)
+{
+  stream* s = get_stream(stream_id);
+  if (s == NULL) {
+    return NULL;
+  }
+
+  NAL_unit* nal = NULL;
+
+  P265_mutex_lock(&s->mutex);
+  if (!s->output.empty()) {
+    nal = s->output.front();
+    s->output.pop_front();
+  }
+  P265_mutex_unlock(&s->mutex);
+
+  return nal;
+}
+
+
+void stream_multiplexer::free_NAL(int stream_id, NAL_unit* nal)
+{
+  stream* s = get_stream(stream_id);
+  if (s == NULL || nal == NULL) {
+    return;
+  }
+
+  // The NAL_Parser is owned by the stream's task, so the NAL is handed back through
+  // the stream and freed by the next task run.
+
+  P265_mutex_lock(&s->mutex);
+  s->returned.push_back(nal);
+  P265_mutex_unlock(&s->mutex);
+}
+
+
+bool stream_multiplexer::is_end_of_stream(int stream_id)
+{
+  stream* s = get_stream(stream_id);
+  if (s == NULL) {
+    return true;
+  }
+
+  P265_mutex_lock(&s->mutex);
+  bool eos = s->end_of_stream_delivered && s->output.empty();
+  P265_mutex_unlock(&s->mutex);
+
+  return eos;
+}
+
+
+void stream_multiplexer::wait_idle(int stream_id)
+{
+  stream* s = get_stream(stream_id);
+  if (s == NULL) {
+    return;
+  }
+
+  wait_unscheduled(s);
+}
+
+
+parse_context* stream_multiplexer::get_context(int stream_id)
+{
+  stream* s = get_stream(stream_id);
+  return (s ? &s->ctx : NULL);
+}
+
+
+int stream_multiplexer::get_stream_node(int stream_id) const
+{
+  stream* s = get_stream(stream_id);
+  return (s ? s->node : -1);
+}
+
+
+int64_t stream_multiplexer::get_bytes_queued(int stream_id) const
+{
+  stream* s = get_stream(stream_id);
+  if (s == NULL) {
+    return 0;
+  }
+
+  P265_mutex_lock(&s->mutex);
+  int64_t bytes = s->bytes_queued;
+  P265_mutex_unlock(&s->mutex);
+
+  return bytes;
+}
+
+END_NAMESPACE_LIBP265
@@ -0,0 +1,327 @@
+/*
+ * H.265 video codec parser.
+ * Copyright (c) 2023 John Willard <john.willard@shotover.com>
+ *
+ * This file is part of libp265.
+ *
+ * libp265 is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * libp265 is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with libp265.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "libp265/stream-stats.h"
+#include "libp265/nal.h"
+
+#include <string.h>
+#include <algorithm>
+
+BEGIN_NAMESPACE_LIBP265
+
+// maximum number of access units in the bitrate window
+#define MAX_WINDOW_ACCESS_UNITS 4096
+
+static_assert(sizeof(stream_stats_snapshot) % sizeof(int64_t) == 0,
+              "snapshot is copied as 64-bit words");
+
+
+void stream_stats_snapshot::clear()
+{
+  memset(this, 0, sizeof(*this));
+}
+
+
+void stream_stats_snapshot::accumulate(const stream_stats_snapshot& other)
+{
+  pts = std::max(pts, other.pts);
+
+  for (int i=0;i<P265_NUM_NAL_TYPES;i++) {
+    nal_count[i] += other.nal_count[i];
+    nal_bytes[i] += other.nal_bytes[i];
+  }
+
+  for (int i=0;i<P265_MAX_TEMPORAL_LAYERS;i++) {
+    temporal_layer_count[i] += other.temporal_layer_count[i];
+    temporal_layer_bytes[i] += other.temporal_layer_bytes[i];
+  }
+
+  au_count += other.au_count;
+  au_bytes += other.au_bytes;
+  last_au_bytes += other.last_au_bytes;
+  max_au_bytes = std::max(max_au_bytes, other.max_au_bytes);
+
+  gop_count += other.gop_count;
+  last_gop_bytes += other.last_gop_bytes;
+  last_gop_pictures += other.last_gop_pictures;
+  current_gop_bytes += other.current_gop_bytes;
+  current_gop_pictures += other.current_gop_pictures;
+
+  if (other.irap_count > 1) {
+    min_irap_interval = (irap_count > 1 ? std::min(min_irap_interval, other.min_irap_interval)
+                                        : other.min_irap_interval);
+  }
+  irap_count += other.irap_count;
+  last_irap_interval = std::max(last_irap_interval, other.last_irap_interval);
+  max_irap_interval = std::max(max_irap_interval, other.max_irap_interval);
+  last_irap_interval_pts = std::max(last_irap_interval_pts, other.last_irap_interval_pts);
+
+  instant_bitrate += other.instant_bitrate;
+  window_bitrate += other.window_bitrate;
+}
+
+
+stream_statistics::stream_statistics(int64_t _pts_per_second,
+                                     int64_t _bitrate_window,
+                                     int64_t _snapshot_interval)
+  : pts_per_second(_pts_per_second),
+    bitrate_window(_bitrate_window),
+    snapshot_interval(_snapshot_interval),
+    window(MAX_WINDOW_ACCESS_UNITS),
+    published_seq(0)
+{
+  reset();
+
+  for (int i=0;i<SNAPSHOT_WORDS;i++) {
+    published[i].store(0, std::memory_order_relaxed);
+  }
+}
+
+
+void stream_statistics::reset()
+{
+  stats.clear();
+
+  au_has_vcl = false;
+  au_irap = false;
+  au_bytes = 0;
+  au_pts = 0;
+
+  have_prev_au = false;
+  prev_au_pts = 0;
+  have_irap = false;
+  last_irap_pts = 0;
+  aus_since_irap = 0;
+
+  have_snapshot_pts = false;
+  next_snapshot_pts = 0;
+
+  window_start = 0;
+  window_size = 0;
+  window_bytes = 0;
+}
+
+
+void stream_statistics::finish_access_unit()
+{
+  if (!au_has_vcl) {
+    return;
+  }
+
+  stats.au_count++;
+  stats.au_bytes += au_bytes;
+  stats.last_au_bytes = au_bytes;
+  stats.max_au_bytes = std::max(stats.max_au_bytes, au_bytes);
+
+
+  // --- GOP and IRAP interval ---
+
+  if (au_irap) {
+    if (have_irap) {
+      stats.gop_count++;
+      stats.last_gop_bytes    = stats.current_gop_bytes;
+      stats.last_gop_pictures = stats.current_gop_pictures;
+
+      stats.last_irap_interval = aus_since_irap;
+      stats.min_irap_interval  = (stats.irap_count > 1 ?
+                                  std::min(stats.min_irap_interval, aus_since_irap) :
+                                  aus_since_irap);
+      stats.max_irap_interval  = std::max(stats.max_irap_interval, aus_since_irap);
+      stats.last_irap_interval_pts = au_pts - last_irap_pts;
+    }
+
+    stats.irap_count++;
+    stats.current_gop_bytes = 0;
+    stats.current_gop_pictures = 0;
+
+    have_irap = true;
+    last_irap_pts = au_pts;
+    aus_since_irap = 0;
+  }
+
+  stats.current_gop_bytes += au_bytes;
+  stats.current_gop_pictures++;
+  aus_since_irap++;
+
+
+  // --- bitrates ---
+
+  if (have_prev_au && au_pts > prev_au_pts) {
+    stats.instant_bitrate = au_bytes*8 * pts_per_second / (au_pts - prev_au_pts);
+  }
+
+  if (window_size == MAX_WINDOW_ACCESS_UNITS) {
+    window_bytes -= window[window_start].bytes;
+    window_start = (window_start+1) % MAX_WINDOW_ACCESS_UNITS;
+    window_size--;
+  }
+
+  window[(window_start + window_size) % MAX_WINDOW_ACCESS_UNITS] = window_entry { au_pts, au_bytes };
+  window_size++;
+  window_bytes += au_bytes;
+
+  while (window_size > 1 && au_pts - window[window_start].pts > bitrate_window) {
+    window_bytes -= window[window_start].bytes;
+    window_start = (window_start+1) % MAX_WINDOW_ACCESS_UNITS;
+    window_size--;
+  }
+
+  // The bytes of the oldest AU were sent before the start of the measured interval.
+  P265_PTS span = au_pts - window[window_start].pts;
+  if (span > 0) {
+    stats.window_bitrate = (window_bytes - window[window_start].bytes)*8 * pts_per_second / span;
+  }
+
+  have_prev_au = true;
+  prev_au_pts = au_pts;
+
+  stats.pts = au_pts;
+
+
+  // --- periodic snapshot ---
+
+  if (!have_snapshot_pts) {
+    next_snapshot_pts = au_pts + snapshot_interval;
+    have_snapshot_pts = true;
+  }
+  else if (au_pts >= next_snapshot_pts) {
+    publish();
+    next_snapshot_pts += snapshot_interval;
+    if (next_snapshot_pts <= au_pts) {
+      next_snapshot_pts = au_pts + snapshot_interval;
+    }
+  }
+
+  au_has_vcl = false;
+  au_irap = false;
+  au_bytes = 0;
+}
+
+
+void stream_statistics::add_NAL(const NAL_unit* nal)
+{
+  // continuation fragment (no NAL header): only the bytes count
+  if (nal->fragment > 1) {
+    au_bytes += nal->size() + nal->num_skipped_bytes();
+    return;
+  }
+
+  if (nal->size() < 2) {
+    return;
+  }
+
+  const unsigned char* data = nal->data();
+  int nal_unit_type = (data[0] >> 1) & 0x3F;
+  int temporal_id   = (data[1] & 7) - 1;
+  bool vcl = (nal_unit_type < 32);
+
+
+  // --- access unit boundary ---
+
+  if (au_has_vcl) {
+    if (vcl) {
+      bool first_slice_segment_in_pic_flag = (nal->size() > 2 && (data[2] & 0x80));
+      if (first_slice_segment_in_pic_flag) {
+        finish_access_unit();
+      }
+    }
+    else if (startsNewAccessUnit(nal_unit_type)) {
+      finish_access_unit();
+    }
+  }
+
+  if (au_bytes == 0) {
+    au_pts = nal->pts;
+  }
+
+  if (vcl) {
+    au_has_vcl = true;
+    au_irap |= isIRAP(nal_unit_type);
+  }
+
+
+  // --- NAL counters ---
+
+  int64_t bytes = nal->size() + nal->num_skipped_bytes();
+
+  au_bytes += bytes;
+
+  stats.nal_count[nal_unit_type]++;
+  stats.nal_bytes[nal_unit_type] += bytes;
+
+  if (temporal_id >= 0) {
+    stats.temporal_layer_count[temporal_id]++;
+    stats.temporal_layer_bytes[temporal_id] += bytes;
+  }
+}
+
+
+void stream_statistics::flush()
+{
+  finish_access_unit();
+  publish();
+}
+
+
+void stream_statistics::publish()
+{
+  stats.sequence++;
+
+  int64_t words[SNAPSHOT_WORDS];
+  memcpy(words, &stats, sizeof(stats));
+
+  // seqlock: odd sequence numbers mark an update in progress
+
+  uint64_t seq = published_seq.load(std::memory_order_relaxed);
+  published_seq.store(seq+1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  for (int i=0;i<SNAPSHOT_WORDS;i++) {
+    published[i].store(words[i], std::memory_order_relaxed);
+  }
+
+  published_seq.store(seq+2, std::memory_order_release);
+}
+
+
+void stream_statistics::get_snapshot(stream_stats_snapshot* out) const
+{
+  int64_t words[SNAPSHOT_WORDS];
+
+  for (;;) {
+    uint64_t seq1 = published_seq.load(std::memory_order_acquire);
+    if (seq1 & 1) {
+      continue;
+    }
+
+    for (int i=0;i<SNAPSHOT_WORDS;i++) {
+      words[i] = published[i].load(std::memory_order_relaxed);
+    }
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (published_seq.load(std::memory_order_relaxed) == seq1) {
+      break;
+    }
+  }
+
+  memcpy(out, words, sizeof(*out));
+}
+
+END_NAMESPACE_LIBP265
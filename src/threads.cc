@@ -19,8 +19,10 @@
  */
 
 #include "libp265/threads.h"
+#include "libp265/util.h"
 #include <assert.h>
 #include <string.h>
+#include <stdio.h>
 
 #if defined(_MSC_VER) || defined(__MINGW32__)
 # include <malloc.h>
@@ -38,6 +40,12 @@
 
 #include <stdio.h>
 
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 BEGIN_NAMESPACE_LIBP265
 
 int  P265_thread_create(P265_thread* t, void *(*start_routine) (void *), void *arg) { return pthread_create(t,NULL,start_routine,arg); }
@@ -87,59 +95,178 @@ void P265_cond_signal(P265_cond* c) { win32_cond_signal(c); }
 
 
 
+static inline void cpu_relax()
+{
+#if defined(__i386__) || defined(__x86_64__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#elif defined(_MSC_VER) && (defined(_M_IX86) || defined(_M_X64))
+  _mm_pause();
+#endif
+}
+
+
+#ifdef __linux__
+static void futex_wait(std::atomic<int>* addr, int expected)
+{
+  syscall(SYS_futex, (int*)addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futex_wake_all(std::atomic<int>* addr)
+{
+  syscall(SYS_futex, (int*)addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+#endif
+
+
 P265_progress_lock::P265_progress_lock()
 {
   mProgress = 0;
+  mMinWaiting = INT_MAX;
 
   P265_mutex_init(&mutex);
+#ifndef __linux__
   P265_cond_init(&cond);
+#endif
 }
 
 P265_progress_lock::~P265_progress_lock()
 {
   P265_mutex_destroy(&mutex);
+#ifndef __linux__
   P265_cond_destroy(&cond);
+#endif
 }
 
 void P265_progress_lock::wait_for_progress(int progress)
 {
-  if (mProgress >= progress) {
+  if (mProgress.load(std::memory_order_acquire) >= progress) {
     return;
   }
 
+  // spin (pointless on a single core, where the updating thread cannot run meanwhile)
+
+  static const int spinCount = (std::thread::hardware_concurrency() > 1 ? P265_PROGRESS_SPIN_COUNT : 0);
+
+  for (int i=0;i<spinCount;i++) {
+    cpu_relax();
+
+    if (mProgress.load(std::memory_order_acquire) >= progress) {
+      return;
+    }
+  }
+
+
+  // park
+
+  /* Publish our threshold, then check again. Either we see the update, or the updating
+     thread sees our threshold and wakes us. An update drops the thresholds it has reached
+     from mMinWaiting, so we publish it again before each wait (reset() may have moved the
+     progress back in the meantime). */
+
   P265_mutex_lock(&mutex);
-  while (mProgress < progress) {
+
+  mWaiting.push_back(progress);
+
+  for (;;) {
+    if (progress < mMinWaiting.load(std::memory_order_relaxed)) {
+      mMinWaiting.store(progress, std::memory_order_seq_cst);
+    }
+
+#ifdef __linux__
+    P265_mutex_unlock(&mutex);
+
+    int current = mProgress.load(std::memory_order_seq_cst);
+    if (current < progress) {
+      futex_wait(&mProgress, current);
+    }
+
+    P265_mutex_lock(&mutex);
+
+    if (current >= progress) {
+      break;
+    }
+#else
+    if (mProgress.load(std::memory_order_seq_cst) >= progress) {
+      break;
+    }
+
     P265_cond_wait(&cond, &mutex);
+#endif
   }
+
+  // unregister
+
+  for (size_t i=0;i<mWaiting.size();i++) {
+    if (mWaiting[i]==progress) {
+      mWaiting[i] = mWaiting.back();
+      mWaiting.pop_back();
+      break;
+    }
+  }
+
+  update_min_waiting(INT_MIN);
+
   P265_mutex_unlock(&mutex);
+
+  std::atomic_thread_fence(std::memory_order_acquire);
 }
 
-void P265_progress_lock::set_progress(int progress)
+// Set mMinWaiting to the lowest registered threshold above 'progress'. Holds the mutex.
+void P265_progress_lock::update_min_waiting(int progress)
 {
-  P265_mutex_lock(&mutex);
-
-  if (progress>mProgress) {
-    mProgress = progress;
+  int minWaiting = INT_MAX;
 
-    P265_cond_broadcast(&cond, &mutex);
+  for (int p : mWaiting) {
+    if (p > progress && p < minWaiting) {
+      minWaiting = p;
+    }
   }
 
-  P265_mutex_unlock(&mutex);
+  mMinWaiting.store(minWaiting, std::memory_order_seq_cst);
 }
 
-void P265_progress_lock::increase_progress(int progress)
+void P265_progress_lock::wake_waiters(int progress)
 {
+  if (progress < mMinWaiting.load(std::memory_order_seq_cst)) {
+    return;
+  }
+
+  // The woken threads drop out of mMinWaiting, so that the next updates do not wake
+  // them again. Those that are still below their threshold publish it again.
+
   P265_mutex_lock(&mutex);
+  update_min_waiting(progress);
+  P265_mutex_unlock(&mutex);
 
-  mProgress += progress;
+#ifdef __linux__
+  futex_wake_all(&mProgress);
+#else
+  // A waiter that checked the progress holds the mutex until it is in P265_cond_wait(),
+  // so taking the mutex above ensures that it is waiting when we broadcast.
   P265_cond_broadcast(&cond, &mutex);
+#endif
+}
 
-  P265_mutex_unlock(&mutex);
+void P265_progress_lock::set_progress(int progress)
+{
+  int current = mProgress.load(std::memory_order_relaxed);
+
+  do {
+    if (progress <= current) {
+      return;
+    }
+  } while (!mProgress.compare_exchange_weak(current, progress, std::memory_order_seq_cst));
+
+  wake_waiters(progress);
 }
 
-int  P265_progress_lock::get_progress() const
+void P265_progress_lock::increase_progress(int progress)
 {
-  return mProgress;
+  int current = mProgress.fetch_add(progress, std::memory_order_seq_cst);
+
+  wake_waiters(current + progress);
 }
 
 END_NAMESPACE_LIBP265
@@ -191,98 +318,341 @@ void printblks(const thread_pool* pool)
 
 BEGIN_NAMESPACE_LIBP265
 
-static THREAD_RESULT_TYPE THREAD_CALLING_CONVENTION worker_thread(THREAD_PARAM_TYPE pool_ptr)
+// --- work-stealing deque ---
+
+#define TASK_DEQUE_INITIAL_SIZE 64
+
+task_deque::task_deque()
 {
-  thread_pool* pool = (thread_pool*)pool_ptr;
+  buffer* a = new buffer;
+  a->size = TASK_DEQUE_INITIAL_SIZE;
+  a->tasks = new std::atomic<thread_task*>[a->size];
 
+  top.store(0, std::memory_order_relaxed);
+  bottom.store(0, std::memory_order_relaxed);
+  array.store(a, std::memory_order_relaxed);
+}
 
-  P265_mutex_lock(&pool->mutex);
 
-  while(true) {
+task_deque::~task_deque()
+{
+  retired.push_back(array.load(std::memory_order_relaxed));
 
-    // wait until we can pick a task or until the pool has been stopped
+  for (buffer* a : retired) {
+    delete[] a->tasks;
+    delete a;
+  }
+}
 
-    for (;;) {
-      // end waiting if thread-pool has been stopped or we have a task to execute
 
-      if (pool->stopped || pool->tasks.size()>0) {
-        break;
-      }
+void task_deque::push(thread_task* task)
+{
+  int64_t b = bottom.load(std::memory_order_relaxed);
+  int64_t t = top.load(std::memory_order_acquire);
+  buffer* a = array.load(std::memory_order_relaxed);
 
-      //printf("going idle\n");
-      P265_cond_wait(&pool->cond_var, &pool->mutex);
+  if (b-t > a->size-1) {
+    // full, copy into a buffer of twice the size
+
+    buffer* n = new buffer;
+    n->size = 2*a->size;
+    n->tasks = new std::atomic<thread_task*>[n->size];
+
+    for (int64_t i=t;i<b;i++) {
+      n->put(i, a->get(i));
     }
 
-    // if the pool was shut down, end the execution
+    retired.push_back(a);
+    array.store(n, std::memory_order_release);
+    a = n;
+  }
 
-    if (pool->stopped) {
-      P265_mutex_unlock(&pool->mutex);
-      return (THREAD_RESULT_TYPE)0;
+  a->put(b, task);
+  std::atomic_thread_fence(std::memory_order_release);
+  bottom.store(b+1, std::memory_order_relaxed);
+}
+
+
+thread_task* task_deque::pop()
+{
+  int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+  buffer* a = array.load(std::memory_order_relaxed);
+  bottom.store(b, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t t = top.load(std::memory_order_relaxed);
+
+  if (t > b) {
+    // empty
+    bottom.store(b+1, std::memory_order_relaxed);
+    return NULL;
+  }
+
+  thread_task* task = a->get(b);
+
+  if (t == b) {
+    // last element, race against thieves
+
+    if (!top.compare_exchange_strong(t, t+1,
+                                     std::memory_order_seq_cst,
+                                     std::memory_order_relaxed)) {
+      task = NULL;
     }
 
+    bottom.store(b+1, std::memory_order_relaxed);
+  }
 
-    // get a task
+  return task;
+}
 
-    thread_task* task = pool->tasks.front();
-    pool->tasks.pop_front();
 
-    pool->num_threads_working++;
+thread_task* task_deque::steal()
+{
+  int64_t t = top.load(std::memory_order_acquire);
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  int64_t b = bottom.load(std::memory_order_acquire);
 
-    //printblks(pool);
+  if (t >= b) {
+    return NULL;
+  }
 
-    P265_mutex_unlock(&pool->mutex);
+  buffer* a = array.load(std::memory_order_acquire);
+  thread_task* task = a->get(t);
 
+  if (!top.compare_exchange_strong(t, t+1,
+                                   std::memory_order_seq_cst,
+                                   std::memory_order_relaxed)) {
+    return NULL;
+  }
 
-    // execute the task
+  return task;
+}
 
-    task->work();
 
-    // end processing and check if this was the last task to be processed
 
-    P265_mutex_lock(&pool->mutex);
+// --- thread pool ---
+
+// worker that is executing in the current thread, NULL for threads outside of any pool
+static thread_local thread_pool_worker* current_worker = NULL;
+
 
-    pool->num_threads_working--;
+thread_pool::thread_pool()
+{
+  stopped = true;
+  num_threads = 0;
+  num_threads_working = 0;
+  inbox_size = 0;
+  num_tasks_queued = 0;
+  num_threads_sleeping = 0;
+  numa_node = -1;
+}
+
+
+thread_pool::~thread_pool()
+{
+  if (!stopped) {
+    stop_thread_pool(this);
+  }
+}
+
+
+static thread_task* take_from_inbox(thread_pool* pool, int priority)
+{
+  if (pool->inbox_size.load(std::memory_order_relaxed)==0) {
+    return NULL;
+  }
+
+  thread_task* task = NULL;
+
+  P265_mutex_lock(&pool->mutex);
+  if (!pool->inbox[priority].empty()) {
+    task = pool->inbox[priority].front();
+    pool->inbox[priority].pop_front();
+    pool->inbox_size.fetch_sub(1, std::memory_order_relaxed);
   }
   P265_mutex_unlock(&pool->mutex);
 
-  return (THREAD_RESULT_TYPE)0;
+  return task;
 }
 
 
-P265_error start_thread_pool(thread_pool* pool, int num_threads)
+static thread_task* steal_task(thread_pool* pool, thread_pool_worker* self, int priority)
+{
+  int n = pool->num_threads;
+  int start;
+
+  if (self) {
+    // xorshift
+    uint32_t x = self->random_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    self->random_state = x;
+
+    start = x % n;
+  }
+  else {
+    start = 0;
+  }
+
+  for (int i=0;i<n;i++) {
+    thread_pool_worker* victim = pool->workers[(start+i) % n];
+    if (victim == self) {
+      continue;
+    }
+
+    thread_task* task = victim->deques[priority].steal();
+    if (task) {
+      return task;
+    }
+  }
+
+  return NULL;
+}
+
+
+static thread_task* find_task(thread_pool* pool, thread_pool_worker* self)
+{
+  if (pool->num_tasks_queued.load(std::memory_order_relaxed)==0) {
+    return NULL;
+  }
+
+  for (int prio=0; prio<P265_NUM_TASK_PRIORITIES; prio++) {
+    thread_task* task = NULL;
+
+    if (self) {
+      task = self->deques[prio].pop();
+    }
+
+    if (!task) { task = take_from_inbox(pool, prio); }
+    if (!task) { task = steal_task(pool, self, prio); }
+
+    if (task) {
+      pool->num_tasks_queued.fetch_sub(1, std::memory_order_relaxed);
+      return task;
+    }
+  }
+
+  return NULL;
+}
+
+
+static void run_task(thread_pool* pool, thread_task* task)
 {
-  P265_error err = P265_OK;
+  pool->num_threads_working.fetch_add(1, std::memory_order_relaxed);
 
-  // limit number of threads to maximum
+  task->state = thread_task::Running;
+  task->work();  // the task may not exist anymore after this call
+
+  pool->num_threads_working.fetch_sub(1, std::memory_order_relaxed);
+}
 
-  if (num_threads > MAX_THREADS) {
-    num_threads = MAX_THREADS;
-    err = P265_WARNING_NUMBER_OF_THREADS_LIMITED_TO_MAXIMUM;
+
+static THREAD_RESULT_TYPE THREAD_CALLING_CONVENTION worker_thread(THREAD_PARAM_TYPE worker_ptr)
+{
+  thread_pool_worker* self = (thread_pool_worker*)worker_ptr;
+  thread_pool* pool = self->pool;
+
+  current_worker = self;
+
+#ifdef __linux__
+  if (!pool->cpus.empty()) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : pool->cpus) {
+      if (cpu < CPU_SETSIZE) { CPU_SET(cpu, &set); }
+    }
+
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
   }
+#endif
+
+  while(true) {
 
+    thread_task* task = find_task(pool, self);
+    if (task) {
+      run_task(pool, task);
+      continue;
+    }
+
+
+    // nothing to do: wait until we can pick a task or until the pool has been stopped
+
+    P265_mutex_lock(&pool->mutex);
+
+    pool->num_threads_sleeping.fetch_add(1, std::memory_order_seq_cst);
+
+    while (!pool->stopped &&
+           pool->num_tasks_queued.load(std::memory_order_seq_cst)==0) {
+      P265_cond_wait(&pool->cond_var, &pool->mutex);
+    }
+
+    pool->num_threads_sleeping.fetch_sub(1, std::memory_order_relaxed);
+
+    // if the pool was shut down, end the execution
+
+    if (pool->stopped) {
+      P265_mutex_unlock(&pool->mutex);
+      break;
+    }
+
+    P265_mutex_unlock(&pool->mutex);
+  }
+
+  current_worker = NULL;
+
+  return (THREAD_RESULT_TYPE)0;
+}
+
+
+P265_error start_thread_pool(thread_pool* pool, int num_threads, const std::vector<int>& cpus)
+{
+  pool->cpus = cpus;
+  return start_thread_pool(pool, num_threads);
+}
+
+
+P265_error start_thread_pool(thread_pool* pool, int num_threads)
+{
   pool->num_threads = 0; // will be increased below
 
   P265_mutex_init(&pool->mutex);
   P265_cond_init(&pool->cond_var);
 
-  P265_mutex_lock(&pool->mutex);
   pool->num_threads_working = 0;
+  pool->num_threads_sleeping = 0;
+  pool->num_tasks_queued = 0;
+  pool->inbox_size = 0;
   pool->stopped = false;
-  P265_mutex_unlock(&pool->mutex);
+
+  // All workers have to exist before the first one starts stealing.
+
+  for (int i=0; i<num_threads; i++) {
+    thread_pool_worker* w = new thread_pool_worker;
+    w->pool = pool;
+    w->index = i;
+    w->random_state = 2654435761u * (i+1);
+    pool->workers.push_back(w);
+  }
 
   // start worker threads
 
   for (int i=0; i<num_threads; i++) {
-    int ret = P265_thread_create(&pool->thread[i], worker_thread, pool);
+    int ret = P265_thread_create(&pool->workers[i]->thread, worker_thread, pool->workers[i]);
     if (ret != 0) {
       // cerr << "pthread_create() failed: " << ret << endl;
+
+      for (int k=i;k<num_threads;k++) {
+        delete pool->workers[k];
+      }
+      pool->workers.resize(i);
+
       return P265_ERROR_CANNOT_START_THREADPOOL;
     }
 
     pool->num_threads++;
   }
 
-  return err;
+  return P265_OK;
 }
 
 
@@ -295,27 +665,249 @@ void stop_thread_pool(thread_pool* pool)
   P265_cond_broadcast(&pool->cond_var, &pool->mutex);
 
   for (int i=0;i<pool->num_threads;i++) {
-    P265_thread_join(pool->thread[i]);
-    P265_thread_destroy(&pool->thread[i]);
+    P265_thread_join(pool->workers[i]->thread);
+    P265_thread_destroy(&pool->workers[i]->thread);
+  }
+
+  for (thread_pool_worker* w : pool->workers) {
+    delete w;
+  }
+
+  pool->workers.clear();
+  pool->num_threads = 0;
+
+  for (int i=0;i<P265_NUM_TASK_PRIORITIES;i++) {
+    pool->inbox[i].clear();
   }
+  pool->inbox_size = 0;
+  pool->num_tasks_queued = 0;
 
   P265_mutex_destroy(&pool->mutex);
   P265_cond_destroy(&pool->cond_var);
 }
 
 
-void   add_task(thread_pool* pool, thread_task* task)
+static bool queue_task(thread_pool* pool, thread_task* task, bool to_inbox)
 {
-  P265_mutex_lock(&pool->mutex);
-  if (!pool->stopped) {
+  int priority = task->priority;
+  if (priority < 0) { priority = 0; }
+  if (priority >= P265_NUM_TASK_PRIORITIES) { priority = P265_NUM_TASK_PRIORITIES-1; }
+
+  task->state = thread_task::Queued;
+
+  thread_pool_worker* self = current_worker;
+
+  if (self && self->pool == pool && !to_inbox) {
+    self->deques[priority].push(task);
+  }
+  else {
+    P265_mutex_lock(&pool->mutex);
+
+    if (pool->stopped) {
+      P265_mutex_unlock(&pool->mutex);
+      return false;
+    }
+
+    pool->inbox[priority].push_back(task);
+    pool->inbox_size.fetch_add(1, std::memory_order_relaxed);
+    P265_mutex_unlock(&pool->mutex);
+  }
 
-    pool->tasks.push_back(task);
+  pool->num_tasks_queued.fetch_add(1, std::memory_order_seq_cst);
 
-    // wake up one thread
 
+  // wake up one thread
+
+  if (pool->num_threads_sleeping.load(std::memory_order_seq_cst) > 0) {
+    P265_mutex_lock(&pool->mutex);
     P265_cond_signal(&pool->cond_var);
+    P265_mutex_unlock(&pool->mutex);
   }
-  P265_mutex_unlock(&pool->mutex);
+
+  return true;
+}
+
+
+bool   add_task(thread_pool* pool, thread_task* task)
+{
+  return queue_task(pool, task, false);
+}
+
+
+bool   add_task_fifo(thread_pool* pool, thread_task* task)
+{
+  return queue_task(pool, task, true);
+}
+
+
+bool run_pending_task(thread_pool* pool)
+{
+  thread_pool_worker* self = current_worker;
+  if (self && self->pool != pool) {
+    self = NULL;
+  }
+
+  thread_task* task = find_task(pool, self);
+  if (!task) {
+    return false;
+  }
+
+  run_task(pool, task);
+  return true;
+}
+
+
+bool is_worker_of(const thread_pool* pool)
+{
+  thread_pool_worker* self = current_worker;
+  return self && self->pool == pool;
+}
+
+
+thread_pool* get_shared_thread_pool()
+{
+  struct shared_pool {
+    thread_pool pool;
+
+    shared_pool() {
+      int n = libP265_max(1, (int)std::thread::hardware_concurrency());
+      start_thread_pool(&pool, n);
+    }
+  };
+
+  static shared_pool shared; // thread-safe initialization
+
+  return &shared.pool;
 }
 
+// --- NUMA ---
+
+// Parse a Linux CPU list like "0-3,8-11".
+static bool read_cpu_list(const char* filename, std::vector<int>* cpus)
+{
+  FILE* fh = fopen(filename, "r");
+  if (fh == NULL) {
+    return false;
+  }
+
+  cpus->clear();
+
+  int first, last;
+  for (;;) {
+    if (fscanf(fh, "%d", &first) != 1) {
+      break;
+    }
+
+    last = first;
+
+    int c = fgetc(fh);
+    if (c == '-') {
+      if (fscanf(fh, "%d", &last) != 1) {
+        break;
+      }
+      c = fgetc(fh);
+    }
+
+    for (int cpu=first; cpu<=last; cpu++) {
+      cpus->push_back(cpu);
+    }
+
+    if (c != ',') {
+      break;
+    }
+  }
+
+  fclose(fh);
+  return true;
+}
+
+
+int get_numa_node_count()
+{
+  int n = 0;
+
+#ifdef __linux__
+  std::vector<int> nodes;
+  if (read_cpu_list("/sys/devices/system/node/online", &nodes) && !nodes.empty()) {
+    n = nodes.back()+1;
+  }
+#endif
+
+  return libP265_max(1, n);
+}
+
+
+bool get_numa_node_cpus(int node, std::vector<int>* cpus)
+{
+#ifdef __linux__
+  char filename[100];
+  sprintf(filename, "/sys/devices/system/node/node%d/cpulist", node);
+
+  if (read_cpu_list(filename, cpus)) {
+    return true;
+  }
+#endif
+
+  // unknown topology: everything is on node 0
+
+  if (node != 0) {
+    return false;
+  }
+
+  cpus->clear();
+  int n = libP265_max(1, (int)std::thread::hardware_concurrency());
+  for (int i=0;i<n;i++) {
+    cpus->push_back(i);
+  }
+
+  return true;
+}
+
+
+P265_error numa_thread_pools::start(int threads_per_node)
+{
+  int nNodes = get_numa_node_count();
+
+  for (int node=0; node<nNodes; node++) {
+    std::vector<int> cpus;
+    if (!get_numa_node_cpus(node, &cpus) || cpus.empty()) {
+      continue; // memory-only node
+    }
+
+    thread_pool* pool = new thread_pool;
+    pool->numa_node = node;
+
+    int nThreads = (threads_per_node > 0 ? threads_per_node : static_cast<int>(cpus.size()));
+
+    // With unknown topology, the workers are not bound.
+    P265_error err;
+    if (nNodes > 1) {
+      err = start_thread_pool(pool, nThreads, cpus);
+    }
+    else {
+      err = start_thread_pool(pool, nThreads);
+    }
+
+    pools.push_back(pool);
+
+    if (err != P265_OK) {
+      stop();
+      return err;
+    }
+  }
+
+  return P265_OK;
+}
+
+
+void numa_thread_pools::stop()
+{
+  for (thread_pool* pool : pools) {
+    delete pool; // stops the pool
+  }
+
+  pools.clear();
+}
+
+
 END_NAMESPACE_LIBP265
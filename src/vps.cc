@@ -344,6 +344,8 @@ void profile_tier_level::read(bitreader* reader,
 
   // --- read the profile/levels of the sub-layers ---
 
+  sub_layer.resize(max_sub_layers > 1 ? max_sub_layers-1 : 0);
+
   for (int i=0; i<max_sub_layers-1; i++)
     {
       sub_layer[i].profile_present_flag = get_bits(reader,1);
@@ -567,7 +569,7 @@ void profile_tier_level::dump(int max_sub_layers, FILE* fh) const
 {
   general.dump(true, fh);
 
-  for (int i=0; i<max_sub_layers-1; i++)
+  for (int i=0; i<max_sub_layers-1 && i<(int)sub_layer.size(); i++)
     {
       LOG1("  Profile/Tier/Level [Layer %d]\n",i);
       sub_layer[i].dump(false, fh);
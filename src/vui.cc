@@ -25,12 +25,13 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <atomic>
 
 BEGIN_NAMESPACE_LIBP265
 
 #define READ_VLC_OFFSET(variable, vlctype, offset)   \
   if ((vlc = get_ ## vlctype(br)) == UVLC_ERROR) {   \
-    errqueue->add_warning(P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE, false);  \
+    errqueue->add_diagnostic(P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE, #variable); \
     return P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE; \
   } \
   variable = vlc + offset;
@@ -131,7 +132,10 @@ video_usability_information::video_usability_information()
   // --- hrd parameters ---
 
   vui_hrd_parameters_present_flag = false;
- 
+  memset(&hrd_common, 0, sizeof(hrd_common));
+  lazy_hrd_parsing = true;
+  hrd_raw_bit_offset = 0;
+  hrd_max_sub_layers = 0;
 
   // --- bitstream restriction ---
 
@@ -147,88 +151,233 @@ video_usability_information::video_usability_information()
 }
 
 
-P265_error video_usability_information::hrd_parameters(error_queue* errqueue, bitreader* br, const seq_parameter_set* sps)
+hrd_parameters::hrd_parameters()
+{
+  memset(&common, 0, sizeof(common));
+}
+
+
+/* Walk over hrd_parameters(). The sub-layer parameters are only stored if 'sub_layers' is
+   non-NULL, otherwise they are just skipped.
+ */
+static P265_error read_hrd(error_queue* errqueue, bitreader* br,
+                           bool commonInfPresentFlag, int maxNumSubLayers,
+                           hrd_common_info* common, std::vector<hrd_sub_layer>* sub_layers)
 {
   int vlc;
 
-  nal_hrd_parameters_present_flag = get_bits(br, 1);
-  vcl_hrd_parameters_present_flag = get_bits(br, 1);
+  if (commonInfPresentFlag) {
+    common->nal_hrd_parameters_present_flag = get_bits(br, 1);
+    common->vcl_hrd_parameters_present_flag = get_bits(br, 1);
 
-  if (nal_hrd_parameters_present_flag || vcl_hrd_parameters_present_flag)
-  {
-    sub_pic_hrd_params_present_flag = get_bits(br, 1);
-    if (sub_pic_hrd_params_present_flag)
+    common->sub_pic_hrd_params_present_flag = false;
+
+    if (common->nal_hrd_parameters_present_flag || common->vcl_hrd_parameters_present_flag)
     {
-      tick_divisor_minus2 = get_bits(br, 8);
-      du_cpb_removal_delay_increment_length_minus1 = get_bits(br, 5);
-      sub_pic_cpb_params_in_pic_timing_sei_flag = get_bits(br, 1);
-      dpb_output_delay_du_length_minus1 = get_bits(br, 5);
-    }
-    bit_rate_scale = get_bits(br, 4);
-    cpb_size_scale = get_bits(br, 4);
+      common->sub_pic_hrd_params_present_flag = get_bits(br, 1);
+      if (common->sub_pic_hrd_params_present_flag)
+      {
+        common->tick_divisor_minus2 = get_bits(br, 8);
+        common->du_cpb_removal_delay_increment_length_minus1 = get_bits(br, 5);
+        common->sub_pic_cpb_params_in_pic_timing_sei_flag = get_bits(br, 1);
+        common->dpb_output_delay_du_length_minus1 = get_bits(br, 5);
+      }
+      common->bit_rate_scale = get_bits(br, 4);
+      common->cpb_size_scale = get_bits(br, 4);
 
 
-    if (sub_pic_hrd_params_present_flag)
-    {
-      cpb_size_du_scale = get_bits(br, 4);
+      if (common->sub_pic_hrd_params_present_flag)
+      {
+        common->cpb_size_du_scale = get_bits(br, 4);
+      }
+      common->initial_cpb_removal_delay_length_minus1 = get_bits(br, 5);
+      common->au_cpb_removal_delay_length_minus1 = get_bits(br, 5);
+      common->dpb_output_delay_length_minus1 = get_bits(br, 5);
     }
-    initial_cpb_removal_delay_length_minus1 = get_bits(br, 5);
-    au_cpb_removal_delay_length_minus1 = get_bits(br, 5);
-    dpb_output_delay_length_minus1 = get_bits(br, 5);
   }
-  int  i, j, nalOrVcl;
 
-  for (i = 0; i < sps->sps_max_sub_layers; i++)
+  if (sub_layers) {
+    sub_layers->resize(maxNumSubLayers);
+  }
+
+  hrd_sub_layer tmp;
+
+  for (int i = 0; i < maxNumSubLayers; i++)
   {
-    fixed_pic_rate_general_flag[i] = get_bits(br, 1);
-    if (!fixed_pic_rate_general_flag[i])
+    hrd_sub_layer& layer = (sub_layers ? (*sub_layers)[i] : tmp);
+
+    layer.fixed_pic_rate_general_flag = get_bits(br, 1);
+    if (!layer.fixed_pic_rate_general_flag)
     {
-      fixed_pic_rate_within_cvs_flag[i] = get_bits(br, 1);
+      layer.fixed_pic_rate_within_cvs_flag = get_bits(br, 1);
     }
     else
     {
-      fixed_pic_rate_within_cvs_flag[i] = true;
+      layer.fixed_pic_rate_within_cvs_flag = true;
     }
 
-    low_delay_hrd_flag[i] = 0;// Infered to be 0 when not present
-    cpb_cnt_minus1[i] = 0;    // Infered to be 0 when not present
+    layer.low_delay_hrd_flag = 0;// Infered to be 0 when not present
+    layer.cpb_cnt_minus1 = 0;    // Infered to be 0 when not present
+    layer.elemental_duration_in_tc_minus1 = 0;
 
-    if (fixed_pic_rate_within_cvs_flag[i])
+    if (layer.fixed_pic_rate_within_cvs_flag)
     {
-      READ_VLC_OFFSET(elemental_duration_in_tc_minus1[i], uvlc, 0);
+      READ_VLC_OFFSET(layer.elemental_duration_in_tc_minus1, uvlc, 0);
     }
     else
     {
-      low_delay_hrd_flag[i] = get_bits(br, 1);
+      layer.low_delay_hrd_flag = get_bits(br, 1);
     }
-    if (!low_delay_hrd_flag[i])
+    if (!layer.low_delay_hrd_flag)
     {
-      READ_VLC_OFFSET(cpb_cnt_minus1[i], uvlc, 0);
+      READ_VLC_OFFSET(layer.cpb_cnt_minus1, uvlc, 0);
+
+      if (layer.cpb_cnt_minus1 >= MAX_HRD_CPB_CNT) {
+        errqueue->add_diagnostic(P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE, "cpb_cnt_minus1");
+        return P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE;
+      }
     }
 
-    for (nalOrVcl = 0; nalOrVcl < 2; nalOrVcl++)
+    for (int nalOrVcl = 0; nalOrVcl < 2; nalOrVcl++)
     {
-      if (((nalOrVcl == 0) && nal_hrd_parameters_present_flag) ||
-        ((nalOrVcl == 1) && vcl_hrd_parameters_present_flag))
+      if (((nalOrVcl == 0) && common->nal_hrd_parameters_present_flag) ||
+          ((nalOrVcl == 1) && common->vcl_hrd_parameters_present_flag))
       {
-        for (j = 0; j <= cpb_cnt_minus1[i]; j++)
+        std::vector<hrd_cpb_spec>& cpbs = (nalOrVcl==0 ? layer.nal_cpb : layer.vcl_cpb);
+        cpbs.resize(sub_layers ? layer.cpb_cnt_minus1+1 : 1);
+
+        for (uint32_t j = 0; j <= layer.cpb_cnt_minus1; j++)
         {
-          READ_VLC_OFFSET(bit_rate_value_minus1[i][j][nalOrVcl], uvlc, 0);
-          READ_VLC_OFFSET(cpb_size_value_minus1[i][j][nalOrVcl], uvlc, 0);
+          hrd_cpb_spec& cpb = cpbs[sub_layers ? j : 0];
 
-          if (sub_pic_hrd_params_present_flag)
+          READ_VLC_OFFSET(cpb.bit_rate_value_minus1, uvlc, 0);
+          READ_VLC_OFFSET(cpb.cpb_size_value_minus1, uvlc, 0);
+
+          if (common->sub_pic_hrd_params_present_flag)
           {
-            READ_VLC_OFFSET(cpb_size_du_value_minus1[i][j][nalOrVcl], uvlc, 0);
-            READ_VLC_OFFSET(bit_rate_du_value_minus1[i][j][nalOrVcl], uvlc, 0);
+            READ_VLC_OFFSET(cpb.cpb_size_du_value_minus1, uvlc, 0);
+            READ_VLC_OFFSET(cpb.bit_rate_du_value_minus1, uvlc, 0);
           }
-          cbr_flag[i][j][nalOrVcl] = get_bits(br, 1);
+          else
+          {
+            cpb.cpb_size_du_value_minus1 = 0;
+            cpb.bit_rate_du_value_minus1 = 0;
+          }
+          cpb.cbr_flag = get_bits(br, 1);
         }
       }
     }
   }
+
+  if (br->nextbits_cnt < 0) {
+    errqueue->add_warning(P265_ERROR_PARAMETER_PARSING, false);
+    return P265_ERROR_PARAMETER_PARSING;
+  }
+
   return P265_OK;
 }
 
+
+P265_error hrd_parameters::read(error_queue* errqueue, bitreader* br,
+                                bool commonInfPresentFlag, int maxNumSubLayers)
+{
+  return read_hrd(errqueue, br, commonInfPresentFlag, maxNumSubLayers, &common, &sub_layers);
+}
+
+
+void hrd_parameters::dump(int fd) const
+{
+  FILE* fh;
+  if (fd==1) fh=stdout;
+  else if (fd==2) fh=stderr;
+  else { return; }
+
+#define LOG0(t) log2fh(fh, t)
+#define LOG1(t,d) log2fh(fh, t,d)
+#define LOG2(t,d1,d2) log2fh(fh, t,d1,d2)
+#define LOG3(t,d1,d2,d3) log2fh(fh, t,d1,d2,d3)
+
+  LOG1("  nal_hrd_parameters_present_flag : %d\n", common.nal_hrd_parameters_present_flag);
+  LOG1("  vcl_hrd_parameters_present_flag : %d\n", common.vcl_hrd_parameters_present_flag);
+  LOG1("  sub_pic_hrd_params_present_flag : %d\n", common.sub_pic_hrd_params_present_flag);
+  LOG1("  bit_rate_scale                  : %d\n", common.bit_rate_scale);
+  LOG1("  cpb_size_scale                  : %d\n", common.cpb_size_scale);
+
+  for (size_t i=0;i<sub_layers.size();i++) {
+    const hrd_sub_layer& layer = sub_layers[i];
+
+    LOG1("  sub-layer %d:\n", (int)i);
+    LOG1("    fixed_pic_rate_within_cvs_flag  : %d\n", layer.fixed_pic_rate_within_cvs_flag);
+    LOG1("    elemental_duration_in_tc_minus1 : %d\n", layer.elemental_duration_in_tc_minus1);
+    LOG1("    low_delay_hrd_flag              : %d\n", layer.low_delay_hrd_flag);
+    LOG1("    cpb_cnt_minus1                  : %d\n", layer.cpb_cnt_minus1);
+
+    for (int nalOrVcl=0;nalOrVcl<2;nalOrVcl++) {
+      for (size_t j=0;j<layer.cpb(nalOrVcl).size();j++) {
+        LOG3("    %s CPB %d: bit rate %lld",
+             nalOrVcl==0 ? "NAL" : "VCL", (int)j, (long long)get_bit_rate(i,j,nalOrVcl));
+        LOG2(", CPB size %lld, cbr %d\n",
+             (long long)get_cpb_size(i,j,nalOrVcl), layer.cpb(nalOrVcl)[j].cbr_flag);
+      }
+    }
+  }
+
+#undef LOG0
+#undef LOG1
+#undef LOG2
+#undef LOG3
+}
+
+
+bool video_usability_information::decode_hrd_parameters(hrd_parameters* out) const
+{
+  if (!vui_hrd_parameters_present_flag) {
+    return false;
+  }
+
+  std::shared_ptr<const hrd_parameters> decoded = std::atomic_load(&hrd);
+  if (decoded) {
+    *out = *decoded;
+    return true;
+  }
+
+  // The raw bits have been checked in read(), decoding them again cannot fail.
+
+  bitreader br;
+  bitreader_init(&br, const_cast<uint8_t*>(hrd_raw.data()), hrd_raw.size());
+  skip_bits(&br, hrd_raw_bit_offset);
+
+  error_queue errqueue;
+  P265_error err = out->read(&errqueue, &br, true, hrd_max_sub_layers);
+  assert(err == P265_OK);
+
+  return err == P265_OK;
+}
+
+
+std::shared_ptr<const hrd_parameters> video_usability_information::get_hrd_parameters() const
+{
+  std::shared_ptr<const hrd_parameters> decoded = std::atomic_load(&hrd);
+  if (decoded || !vui_hrd_parameters_present_flag) {
+    return decoded;
+  }
+
+  std::shared_ptr<hrd_parameters> params = std::make_shared<hrd_parameters>();
+  if (!decode_hrd_parameters(params.get())) {
+    return nullptr;
+  }
+
+  // If another thread was faster, use its copy.
+
+  std::shared_ptr<const hrd_parameters> expected;
+  decoded = params;
+  if (!std::atomic_compare_exchange_strong(&hrd, &expected, decoded)) {
+    decoded = expected;
+  }
+
+  return decoded;
+}
+
 P265_error video_usability_information::read(error_queue* errqueue, bitreader* br,
                                               const seq_parameter_set* sps)
 {
@@ -363,7 +512,35 @@ P265_error video_usability_information::read(error_queue* errqueue, bitreader* b
     vui_hrd_parameters_present_flag = get_bits(br, 1);
     if (vui_hrd_parameters_present_flag) {
       P265_error err;
-      err = hrd_parameters(errqueue, br, sps);
+
+      if (lazy_hrd_parsing) {
+        // first byte containing unread bits and position of the first unread bit in it
+
+        const uint8_t* start = br->data - (br->nextbits_cnt+7)/8;
+        hrd_raw_bit_offset = (8 - (br->nextbits_cnt & 7)) & 7;
+
+        err = read_hrd(errqueue, br, true, sps->sps_max_sub_layers, &hrd_common, NULL);
+        if (err != P265_OK) {
+          return err;
+        }
+
+        const uint8_t* end = br->data - br->nextbits_cnt/8;
+
+        hrd_raw.assign(start, end);
+        hrd_max_sub_layers = sps->sps_max_sub_layers;
+        std::atomic_store(&hrd, std::shared_ptr<const hrd_parameters>());
+      }
+      else {
+        std::shared_ptr<hrd_parameters> params = std::make_shared<hrd_parameters>();
+        err = params->read(errqueue, br, true, sps->sps_max_sub_layers);
+        if (err != P265_OK) {
+          return err;
+        }
+
+        hrd_common = params->common;
+        hrd_raw.clear();
+        std::atomic_store(&hrd, std::shared_ptr<const hrd_parameters>(params));
+      }
     }
   }
 
@@ -377,31 +554,31 @@ P265_error video_usability_information::read(error_queue* errqueue, bitreader* b
 
     READ_VLC(min_spatial_segmentation_idc, uvlc);
     if (min_spatial_segmentation_idc > 4095) {
-      errqueue->add_warning(P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE, false);
+      errqueue->add_diagnostic(P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE, "min_spatial_segmentation_idc");
       min_spatial_segmentation_idc = 0;
     }
 
     READ_VLC(max_bytes_per_pic_denom, uvlc);
     if (max_bytes_per_pic_denom > 16) {
-      errqueue->add_warning(P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE, false);
+      errqueue->add_diagnostic(P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE, "max_bytes_per_pic_denom");
       max_bytes_per_pic_denom = 2;
     }
 
     READ_VLC(max_bits_per_min_cu_denom, uvlc);
     if (max_bits_per_min_cu_denom > 16) {
-      errqueue->add_warning(P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE, false);
+      errqueue->add_diagnostic(P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE, "max_bits_per_min_cu_denom");
       max_bits_per_min_cu_denom = 1;
     }
 
     READ_VLC(log2_max_mv_length_horizontal, uvlc);
     if (log2_max_mv_length_horizontal > 15) {
-      errqueue->add_warning(P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE, false);
+      errqueue->add_diagnostic(P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE, "log2_max_mv_length_horizontal");
       log2_max_mv_length_horizontal = 15;
     }
 
     READ_VLC(log2_max_mv_length_vertical, uvlc);
     if (log2_max_mv_length_vertical > 15) {
-      errqueue->add_warning(P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE, false);
+      errqueue->add_diagnostic(P265_ERROR_CODED_PARAMETER_OUT_OF_RANGE, "log2_max_mv_length_vertical");
       log2_max_mv_length_vertical = 15;
     }
   }
@@ -483,7 +660,10 @@ void video_usability_information::dump(int fd) const
 
   LOG1("vui_hrd_parameters_present_flag : %d\n", vui_hrd_parameters_present_flag);
   if (vui_hrd_parameters_present_flag) {
-    //hrd_parameters vui_hrd_parameters;
+    std::shared_ptr<const hrd_parameters> params = get_hrd_parameters();
+    if (params) {
+      params->dump(fd);
+    }
   }
 
 